@@ -1,12 +1,16 @@
 #include "mustela.hpp"
+#include <algorithm>
+#include <thread>
+#include <exception>
 
 using namespace mustela;
 
 
 Bucket::Bucket(TX * my_txn, BucketDesc * bucket_desc, Val name):my_txn(my_txn), bucket_desc(bucket_desc), persistent_name(name) {
-	if(bucket_desc)
+	if(bucket_desc){
    		this->my_txn->my_buckets.insert_after_this(this, &Bucket::tx_buckets);
-	else
+		cursor_slot = &this->my_txn->bucket_cursors(bucket_desc);
+	}else
 		this->my_txn = nullptr;
 }
 Bucket::~Bucket(){
@@ -14,15 +18,17 @@ Bucket::~Bucket(){
 }
 void Bucket::unlink(){
 	tx_buckets.unlink(&Bucket::tx_buckets);
+	append_cursor = Cursor();
 	my_txn = nullptr;
 	bucket_desc = nullptr;
+	cursor_slot = nullptr;
 	persistent_name = Val{};
 }
-Bucket::Bucket(Bucket && other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), persistent_name(other.persistent_name){
+Bucket::Bucket(Bucket && other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), cursor_slot(other.cursor_slot), persistent_name(other.persistent_name){
 	if(my_txn)
 		my_txn->my_buckets.insert_after_this(this, &Bucket::tx_buckets);
 }
-Bucket::Bucket(const Bucket & other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), persistent_name(other.persistent_name){
+Bucket::Bucket(const Bucket & other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), cursor_slot(other.cursor_slot), persistent_name(other.persistent_name){
 	if(my_txn)
 		my_txn->my_buckets.insert_after_this(this, &Bucket::tx_buckets);
 }
@@ -30,6 +36,7 @@ Bucket & Bucket::operator=(Bucket && other){
 	unlink();
 	my_txn = other.my_txn;
 	bucket_desc = other.bucket_desc;
+	cursor_slot = other.cursor_slot;
 	persistent_name = other.persistent_name;
 	if(my_txn)
    		my_txn->my_buckets.insert_after_this(this, &Bucket::tx_buckets);
@@ -39,6 +46,7 @@ Bucket & Bucket::operator=(const Bucket & other){
 	unlink();
 	my_txn = other.my_txn;
 	bucket_desc = other.bucket_desc;
+	cursor_slot = other.cursor_slot;
 	persistent_name = other.persistent_name;
 	if(my_txn)
    		my_txn->my_buckets.insert_after_this(this, &Bucket::tx_buckets);
@@ -46,13 +54,33 @@ Bucket & Bucket::operator=(const Bucket & other){
 }
 
 char * Bucket::put(const Val & key, size_t value_size, bool nooverwrite){
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	if( is_dupsort() )
+		throw Exception("Bucket::put with value_size cannot be used with dupsort bucket");
+	return put_stored(key, value_size, nooverwrite);
+}
+void Bucket::check_put_stored(const Val & key, size_t value_size)const{
 	if( my_txn->read_only )
 		throw Exception("Attempt to modify read-only transaction");
 	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
-	if(key.size > max_key_size(my_txn->page_size))
+	if(key.size > max_key_size(my_txn->page_layout_size, bucket_desc->key_head_size))
 		throw Exception("Key size too big in Bucket::put");
+	if(bucket_desc->key_size != 0 && (key.size != bucket_desc->key_size || value_size != bucket_desc->value_size))
+		throw Exception("Key or value size differs from fixed sizes in Bucket::put");
+}
+size_t Bucket::dup_value_prefix_size(const Val & key)const{
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	std::string buf;
+	const size_t max_size = max_key_size(my_txn->page_layout_size, bucket_desc->key_head_size);
+	const size_t key_size = encode_dup_key(key, buf).size;
+	if( key_size > max_size )
+		throw Exception("Key size too big in Bucket::dup_value_prefix_size");
+	return max_size - key_size;
+}
+char * Bucket::put_stored(const Val & key, size_t value_size, bool nooverwrite){
+	check_put_stored(key, value_size);
 	Cursor main_cursor(my_txn, bucket_desc, persistent_name);
-	const bool same_key = main_cursor.seek(key);
+	const bool same_key = main_cursor.seek_stored(key);
 //		CLeafPtr dap = my_txn.readable_leaf(main_cursor.path.at(0).first);
 //		bool same_key = item != dap.size() && Val(dap.get_key(item)) == key;
 	TX::BucketMirror * bu = nullptr;
@@ -63,64 +91,337 @@ char * Bucket::put(const Val & key, size_t value_size, bool nooverwrite){
 	}
 	if( same_key && nooverwrite )
 		return nullptr;
+	char * result = same_key ? replace_stored(main_cursor, key, value_size) : insert_here_stored(main_cursor, key, value_size);
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		if(same_key) // Update only value, existing cursor should stay pointing to the same key-value
+			bu->at(key.to_string()).first = std::string();
+		else
+			ass(bu->insert(std::make_pair(key.to_string(), std::make_pair(std::string(), main_cursor))).second, "inconsistent mirror");
+	}
+	return result;
+}
+char * Bucket::replace_stored(Cursor & main_cursor, const Val & key, size_t value_size){
 	my_txn->meta_page_dirty = true;
 	// TODO - optimize - if page will split and it is not writable yet, we can save make_page_writable
-	LeafPtr wr_dap(my_txn->page_size, (LeafPage *)my_txn->make_pages_writable(main_cursor, 0));
-	auto path_el = main_cursor.path.at(0);
-	if( same_key ){
-		Pid overflow_page, overflow_count;
-		Tid overflow_tid;
-		wr_dap.erase(path_el.item, overflow_page, overflow_count, overflow_tid);
-		if( overflow_page ){
-			bucket_desc->overflow_page_count -= overflow_count;
-			my_txn->mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
-		}
-	}else{
-		for(IntrusiveNode<Cursor> * c = &my_txn->my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
-			c->get_current()->on_insert(bucket_desc, 0, path_el.pid, path_el.item);
-		ass(main_cursor.path.at(0).item == path_el.item + 1, "Main cursor was unaffectet by on_insert");
-		main_cursor.path.at(0).item = path_el.item;
+	LeafPtr wr_dap(my_txn->page_layout_size, (LeafPage *)my_txn->make_pages_writable(main_cursor, 0), bucket_desc->get_options());
+	auto path_el = main_cursor.at(0);
+	char * result = put_in_place(wr_dap, path_el.item, value_size);
+	if( result )
+		return result;
+	Pid overflow_page;
+	size_t overflow_size;
+	Tid overflow_tid;
+	wr_dap.erase(path_el.item, overflow_page, overflow_size, overflow_tid);
+	if( overflow_page ){
+		Pid overflow_count = my_txn->get_overflow_count(overflow_size);
+		bucket_desc->overflow_page_count -= overflow_count;
+		my_txn->mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
 	}
+	// Erase and insert at the same index, so other cursors need no fix-up
+	return insert_stored(main_cursor, key, value_size);
+}
+char * Bucket::insert_here_stored(Cursor & main_cursor, const Val & key, size_t value_size){
+	my_txn->meta_page_dirty = true;
+	my_txn->make_pages_writable(main_cursor, 0);
+	auto path_el = main_cursor.at(0);
+	for(IntrusiveNode<Cursor> * c = cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+		c->get_current()->on_insert(bucket_desc, 0, path_el.pid, path_el.item);
+	ass(main_cursor.at(0).item == path_el.item + 1, "Main cursor was unaffectet by on_insert");
+	main_cursor.at(0).item = path_el.item;
+	char * result = insert_stored(main_cursor, key, value_size);
+	bucket_desc->count += 1;
+	return result;
+}
+char * Bucket::insert_stored(Cursor & main_cursor, const Val & key, size_t value_size){
 	bool overflow;
 	my_txn->start_update(bucket_desc);
 	char * result = my_txn->new_insert2leaf(main_cursor, key, value_size, &overflow);
 	if( overflow ){
-		Pid overflow_count = (value_size + my_txn->page_size - 1)/my_txn->page_size;
+		Pid overflow_count = my_txn->get_overflow_count(value_size);
 		Pid opa = my_txn->get_free_page(overflow_count);
 		bucket_desc->overflow_page_count += overflow_count;
-		pack_uint_le(result, NODE_PID_SIZE, opa);
-		pack_uint_le(result + NODE_PID_SIZE, sizeof(Tid), my_txn->tid());
+		pack_overflow_ref(result, opa, my_txn->tid());
 		result = my_txn->writable_overflow(opa, overflow_count);
 	}
 	my_txn->finish_update(bucket_desc);
-	if( !same_key )
-		bucket_desc->count += 1;
+	return result;
+}
+void Bucket::set_append_cursor(){
+	// Cursor at end() follows inserts, splits and merges, so we seldom have to descend from root
+	if( !append_cursor.is_valid() || append_cursor.bucket_desc != bucket_desc || !append_cursor.is_at_bucket_end() ){
+		append_cursor = get_cursor();
+		append_cursor.end();
+	}
+}
+char * Bucket::append_stored(const Val & key, size_t value_size){
+	check_put_stored(key, value_size);
+	set_append_cursor();
+	auto path_el = append_cursor.at(0);
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, path_el.pid);
+	std::string last_buf;
+	if( dap.size() != 0 && compare_keys(dap.options.comparator, key, dap.get_key(dap.size() - 1, last_buf)) <= 0 )
+		throw Exception("Key must be greater than last key in Bucket::append");
+	TX::BucketMirror * bu = nullptr;
 	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
-		if(same_key) // Update only value, existing cursor should stay pointing to the same key-value
-			bu->at(key.to_string()).first = std::string();
-		else
-			ass(bu->insert(std::make_pair(key.to_string(), std::make_pair(std::string(), main_cursor))).second, "inconsistent mirror");
+	 	bu = &my_txn->debug_mirror.at(persistent_name.to_string());
+		ass(bu->count(key.to_string()) == 0, "Mirror key different in bucket append");
+		my_txn->before_mirror_operation(bucket_desc, persistent_name);
 	}
+	char * result = insert_here_stored(append_cursor, key, value_size);
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket)
+		ass(bu->insert(std::make_pair(key.to_string(), std::make_pair(std::string(), append_cursor))).second, "inconsistent mirror");
+	append_cursor.at(0).item += 1; // from appended item back to end()
 	return result;
 }
+char * Bucket::put_in_place(LeafPtr wr_dap, int item, size_t value_size){
+	// No erase and insert, so no compaction, split or cursor fix-ups
+	Pid overflow_page;
+	size_t overflow_size;
+	Tid overflow_tid;
+	wr_dap.get_item_size(item, overflow_page, overflow_size, overflow_tid);
+	bool overflow;
+	char * result = wr_dap.resize_value_in_place(item, value_size, overflow);
+	if( !result || !overflow )
+		return result;
+	Pid overflow_count = my_txn->get_overflow_count(value_size);
+	Pid old_overflow_count = my_txn->get_overflow_count(overflow_size);
+	if( overflow_tid == my_txn->tid() && overflow_count == old_overflow_count ) // overflow run is ours, reuse it
+		return my_txn->writable_overflow(overflow_page, overflow_count);
+	bucket_desc->overflow_page_count -= old_overflow_count;
+	my_txn->mark_free_in_future_page(overflow_page, old_overflow_count, overflow_tid);
+	my_txn->start_update(bucket_desc);
+	Pid opa = my_txn->get_free_page(overflow_count);
+	bucket_desc->overflow_page_count += overflow_count;
+	pack_overflow_ref(result, opa, my_txn->tid());
+	my_txn->finish_update(bucket_desc);
+	return my_txn->writable_overflow(opa, overflow_count);
+}
+void Bucket::append(const Val & key, const Val & value){
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	std::string stored_buf, tails;
+	Val stored_key = key;
+	Val stored_value = value;
+	if( is_dupsort() ){ // pairs are ordered by key, then by value
+		Val tail;
+		stored_value = Val();
+		if( encode_dup_item(key, value, max_key_size(my_txn->page_layout_size, bucket_desc->key_head_size), stored_buf, &stored_key, &tail) ){
+			set_append_cursor();
+			Cursor last_cursor(append_cursor);
+			last_cursor.prev_stored();
+			Val c_key, c_value;
+			if( last_cursor.get_stored(&c_key, &c_value) && c_key == stored_key ){ // value goes into last item
+				if( get_dup_tail(c_value, count_dup_tails(c_value) - 1).compare(tail) >= 0 )
+					throw Exception("Key must be greater than last key in Bucket::append");
+				ass(put_dup_tail(stored_key, tail, true), "Pair found in Bucket::append after order check");
+				return;
+			}
+			insert_dup_tail(Val(), 0, tail, tails);
+			stored_value = Val(tails);
+		}
+	}
+	char * dst = append_stored(stored_key, stored_value.size);
+	memcpy(dst, stored_value.data, stored_value.size);
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+	 	auto & part = my_txn->debug_mirror.at(persistent_name.to_string());
+	 	part.at(stored_key.to_string()).first = stored_value.to_string();
+		my_txn->check_mirror();
+	}
+}
 bool Bucket::put(const Val & key, const Val & value, bool nooverwrite) { // false if nooverwrite and key existed
-	char * dst = put(key, value.size, nooverwrite);
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	std::string stored_buf;
+	Val stored_key = key;
+	Val stored_value = value;
+	if( is_dupsort() ){ // value is part of key
+		Val tail;
+		if( encode_dup_item(key, value, max_key_size(my_txn->page_layout_size, bucket_desc->key_head_size), stored_buf, &stored_key, &tail) )
+			return put_dup_tail(stored_key, tail, nooverwrite);
+		stored_value = Val();
+	}
+	char * dst = put_stored(stored_key, stored_value.size, nooverwrite);
 	if( dst )
-		memcpy(dst, value.data, value.size);
+		memcpy(dst, stored_value.data, stored_value.size);
 	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
 	 	auto & part = my_txn->debug_mirror.at(persistent_name.to_string());
-	 	part.at(key.to_string()).first = value.to_string();
+	 	part.at(stored_key.to_string()).first = stored_value.to_string();
 		my_txn->check_mirror();
 	}
 	return dst != nullptr;
 }
+bool Bucket::put_dup_tail(const Val & stored_key, const Val & tail, bool nooverwrite){
+	check_put_stored(stored_key, 0);
+	Cursor main_cursor(my_txn, bucket_desc, persistent_name, cursor_slot);
+	std::string tails;
+	size_t insert_index = 0;
+	const bool same_key = main_cursor.seek_stored(stored_key);
+	if( same_key ){
+		Val c_key, c_value;
+		ass(main_cursor.get_stored(&c_key, &c_value), "Cursor get_stored failed after found in Bucket::put_dup_tail");
+		bool found;
+		insert_index = find_dup_tail(c_value, tail, &found);
+		if( found )
+			return !nooverwrite;
+		insert_dup_tail(c_value, insert_index, tail, tails);
+	}else
+		insert_dup_tail(Val(), 0, tail, tails);
+	char * dst = put_stored(stored_key, tails.size(), false);
+	memcpy(dst, tails.data(), tails.size());
+	Cursor * mirror_cursor = nullptr; // mirror keeps items, not values in them
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+	 	auto & part = my_txn->debug_mirror.at(persistent_name.to_string());
+	 	part.at(stored_key.to_string()).first = tails;
+	 	mirror_cursor = &part.at(stored_key.to_string()).second;
+	}
+	if( same_key ){ // main cursor followed item, cursors at later values of it are moved forward
+		const auto path_el = main_cursor.at(0);
+		for(IntrusiveNode<Cursor> * c = cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+			if( c->get_current() != mirror_cursor )
+				c->get_current()->on_insert_dup(bucket_desc, path_el.pid, path_el.item, insert_index);
+	}
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket)
+		my_txn->check_mirror();
+	return true;
+}
+Val Bucket::keep_value(const Cursor & cur, Val value)const{
+	if( !cur.is_in_key_buffer(value) && !cur.is_in_value_buffer(value) )
+		return value;
+	value_buffers.push_back(value.to_string());
+	return Val(value_buffers.back());
+}
 bool Bucket::get(const Val & key, Val * value)const{
 	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	value_buffers.clear();
 	Cursor main_cursor(my_txn, bucket_desc, persistent_name);
 	if( !main_cursor.seek(key) )
 		return false;
 	Val c_key;
-	return main_cursor.get(&c_key, value);
+	if( !main_cursor.get(&c_key, value) )
+		return false;
+	*value = keep_value(main_cursor, *value);
+	return true;
+}
+static const size_t GET_MANY_PREFETCH_WINDOW = 64; // leaves of that many keys are prefetched together
+
+size_t Bucket::get_many(const std::vector<Val> & keys, std::vector<Val> * values, std::vector<bool> * found)const{
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	value_buffers.clear();
+	values->assign(keys.size(), Val());
+	if( found )
+		found->assign(keys.size(), false);
+	std::vector<std::string> dup_keys; // dupsort keys are searched as stored prefix of pairs
+	if( is_dupsort() ){
+		dup_keys.resize(keys.size());
+		for(size_t i = 0; i != keys.size(); ++i)
+			encode_dup_key(keys[i], dup_keys[i]);
+	}
+	auto stored_key = [&](size_t index){ return is_dupsort() ? Val(dup_keys[index]) : keys[index]; };
+	const Comparator comparator = static_cast<Comparator>(bucket_desc->comparator);
+	std::vector<size_t> order(keys.size());
+	for(size_t i = 0; i != order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+		return compare_keys(comparator, stored_key(a), stored_key(b)) < 0;
+	});
+	Cursor main_cursor(my_txn, bucket_desc, persistent_name);
+	std::vector<Pid> leaves(order.size());
+	std::vector<Pid> prefetch;
+	size_t found_count = 0;
+	for(size_t window = 0; window < order.size(); window += GET_MANY_PREFETCH_WINDOW){
+		const size_t window_end = std::min(order.size(), window + GET_MANY_PREFETCH_WINDOW);
+		prefetch.clear();
+		for(size_t i = window; i != window_end; ++i){ // nodes only
+			leaves[i] = main_cursor.seek_leaf_from_previous(stored_key(order[i]));
+			if( prefetch.empty() || prefetch.back() != leaves[i] )
+				prefetch.push_back(leaves[i]);
+		}
+		std::sort(prefetch.begin(), prefetch.end()); // neighbour leaves often have contiguous pids
+		for(size_t i = 0; i != prefetch.size(); ){
+			size_t j = i + 1;
+			while( j != prefetch.size() && prefetch[j] == prefetch[j - 1] + 1 )
+				j += 1;
+			my_txn->prefetch_pages(prefetch[i], prefetch[j - 1] + 1 - prefetch[i]);
+			i = j;
+		}
+		for(size_t i = window; i != window_end; ++i){
+			const size_t index = order[i];
+			CLeafPtr dap = my_txn->readable_leaf(bucket_desc, leaves[i]);
+			bool key_found = false;
+			const int item = dap.lower_bound_item(stored_key(index), &key_found);
+			main_cursor.at(0) = Cursor::Element{leaves[i], item}; // node part of path is for the last key of window
+			Val c_key, c_value;
+			if( is_dupsort() && item == dap.size() ){ // first value can be in the next leaf, rare
+				Cursor next_cursor(my_txn, bucket_desc, persistent_name);
+				if( !next_cursor.seek(keys[index]) || !next_cursor.get(&c_key, &c_value) )
+					continue;
+				c_value = keep_value(next_cursor, c_value);
+			}else{
+				if( is_dupsort() )
+					key_found = main_cursor.get(&c_key, &c_value) && c_key == keys[index];
+				else if( key_found )
+					ass(main_cursor.get(&c_key, &c_value), "Cursor get failed after found in Bucket::get_many");
+				if( !key_found )
+					continue;
+				c_value = keep_value(main_cursor, c_value);
+			}
+			(*values)[index] = c_value;
+			if( found )
+				(*found)[index] = true;
+			found_count += 1;
+		}
+	}
+	return found_count;
+}
+std::vector<std::string> Bucket::get_partition_keys(size_t partition_count)const{
+	// Subtrees of the same height have roughly the same size, so we go down until level has enough of them
+	std::vector<std::pair<Pid, std::string>> level{{bucket_desc->root_page, std::string()}}; // subtree and separator before it
+	for(size_t height = bucket_desc->height; height != 0 && level.size() < partition_count; --height){
+		std::vector<std::pair<Pid, std::string>> next_level;
+		for(auto && sub : level){
+			CNodePtr nap = my_txn->readable_node(bucket_desc, sub.first);
+			next_level.emplace_back(nap.get_value(-1), sub.second);
+			for(int pi = 0; pi != nap.size(); ++pi)
+				next_level.emplace_back(nap.get_value(pi), nap.get_key(pi).to_string());
+		}
+		level.swap(next_level);
+	}
+	std::vector<std::string> result;
+	const size_t count = std::min(partition_count, level.size());
+	for(size_t i = 1; i < count; ++i)
+		result.push_back(level.at(i * level.size() / count).second);
+	return result;
+}
+void Bucket::scan_partitions(size_t partition_count, std::function<void(size_t partition, const Val & key, const Val & value)> on_item)const{
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	const std::vector<std::string> separators = get_partition_keys(std::max<size_t>(partition_count, 1));
+	const Comparator comparator = static_cast<Comparator>(bucket_desc->comparator);
+	std::vector<std::exception_ptr> errors(separators.size() + 1);
+	auto scan = [&](size_t partition){
+		try {
+			ReadIterator it(my_txn, bucket_desc);
+			Val c_key, c_value;
+			if( partition == 0 )
+				it.first();
+			else
+				it.seek_stored(Val(separators.at(partition - 1)));
+			for(; it.get_stored(&c_key, &c_value); it.next()){
+				if( partition != separators.size() && compare_keys(comparator, c_key, Val(separators.at(partition))) >= 0 )
+					break;
+				ass(it.get(&c_key, &c_value), "ReadIterator get failed after get_stored in Bucket::scan_partitions");
+				on_item(partition, c_key, c_value);
+			}
+		}catch(...){
+			errors.at(partition) = std::current_exception();
+		}
+	};
+	std::vector<std::thread> threads;
+	for(size_t partition = 1; partition < errors.size(); ++partition)
+		threads.emplace_back(scan, partition);
+	scan(0); // in our thread
+	for(auto && th : threads)
+		th.join();
+	for(auto && err : errors)
+		if( err )
+			std::rethrow_exception(err);
 }
 bool Bucket::del(const Val & key){
 	if( my_txn->read_only )
@@ -129,9 +430,75 @@ bool Bucket::del(const Val & key){
 	Cursor main_cursor(my_txn, bucket_desc, persistent_name);
 	if( !main_cursor.seek(key) )
 		return false;
-	ass(main_cursor.del(), "Cursor del returned false after successfull seek");
+	if( !is_dupsort() ){
+		ass(main_cursor.del(), "Cursor del returned false after successfull seek");
+		return true;
+	}
+	std::string prefix_buf;
+	const Val prefix = encode_dup_key(key, prefix_buf);
+	Val c_key, c_value;
+	while( main_cursor.get_stored(&c_key, &c_value) && c_key.has_prefix(prefix) ) // pairs and shared items of key follow its seek
+		ass(main_cursor.del_stored(), "Cursor del returned false for dupsort item");
 	return true;
 }
+size_t Bucket::del_range(const Val & from, const Val & to){
+	if( my_txn->read_only )
+		throw Exception("Attempt to modify read-only transaction");
+	ass(bucket_desc, "Bucket not valid (using after tx commit?)");
+	std::string from_buf, to_buf;
+	Val stored_from = from;
+	Val stored_to = to;
+	if( is_dupsort() ){ // range of keys includes all their values
+		stored_from = encode_dup_key(from, from_buf);
+		stored_to = encode_dup_key(to, to_buf);
+	}
+	const Comparator comparator = static_cast<Comparator>(bucket_desc->comparator);
+	if( compare_keys(comparator, stored_from, stored_to) >= 0 )
+		return 0;
+	TX::BucketMirror * bu = nullptr;
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+	 	bu = &my_txn->debug_mirror.at(persistent_name.to_string());
+		my_txn->before_mirror_operation(bucket_desc, persistent_name);
+	}
+	const size_t old_count = bucket_desc->count;
+	Cursor main_cursor(my_txn, bucket_desc, persistent_name);
+	main_cursor.seek_stored(stored_from);
+	Val c_key, c_value;
+	std::string key_buf;
+	while( main_cursor.get_stored(&c_key, &c_value) && compare_keys(comparator, c_key, stored_to) < 0 ){
+		my_txn->meta_page_dirty = true;
+		const size_t height = my_txn->find_erasable_subtree(main_cursor, stored_to);
+		if( height != 0 ){
+			my_txn->new_erase_subtree(main_cursor, height, bu);
+			continue;
+		}
+		// Boundary leaf, erase items up to the end of range or leaf, then merge once
+		LeafPtr wr_dap(my_txn->page_layout_size, (LeafPage *)my_txn->make_pages_writable(main_cursor, 0), bucket_desc->get_options());
+		const auto path_el = main_cursor.at(0);
+		while( path_el.item < wr_dap.size() && compare_keys(comparator, wr_dap.get_key(path_el.item, key_buf), stored_to) < 0 ){
+			if( bu )
+				ass(bu->erase(wr_dap.get_key(path_el.item, key_buf).to_string()) == 1, "inconsistent mirror in del_range");
+			Pid overflow_page;
+			size_t overflow_size;
+			Tid overflow_tid;
+			wr_dap.erase(path_el.item, overflow_page, overflow_size, overflow_tid);
+			if( overflow_page ){
+				Pid overflow_count = my_txn->get_overflow_count(overflow_size);
+				bucket_desc->overflow_page_count -= overflow_count;
+				my_txn->mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
+			}
+			for(IntrusiveNode<Cursor> * c = cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+				c->get_current()->on_erase(bucket_desc, 0, path_el.pid, path_el.item);
+			bucket_desc->count -= 1;
+		}
+		my_txn->start_update(bucket_desc);
+		my_txn->new_merge_leaf(main_cursor, wr_dap);
+		my_txn->finish_update(bucket_desc);
+	}
+	if( bu )
+		my_txn->check_mirror();
+	return old_count - bucket_desc->count;
+}
 std::string Bucket::debug_print_db(){
 	return bucket_desc ? my_txn->print_db(bucket_desc) : std::string();
 }
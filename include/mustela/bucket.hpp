@@ -1,8 +1,12 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <functional>
 #include "pages.hpp"
 #include "cursor.hpp"
+#include "read_iterator.hpp"
 
 namespace mustela {
 	
@@ -18,12 +22,33 @@ namespace mustela {
 		bool is_valid()const { return bucket_desc != nullptr; }
 		Val get_name()const { return persistent_name; }
 		
-		Cursor get_cursor()const { return Cursor(my_txn, bucket_desc, persistent_name); } // cursor is set to before_first(), this is the fastest operation
+		Cursor get_cursor()const { return Cursor(my_txn, bucket_desc, persistent_name, cursor_slot); } // cursor is set to before_first(), this is the fastest operation
+		ReadIterator get_read_iterator()const { return ReadIterator(my_txn, bucket_desc); } // set to before_first(), for scans without modifications
 				
 		char * put(const Val & key, size_t value_size, bool nooverwrite); // danger! db will alloc space for key/value in db and return address for you to copy value to
 		bool put(const Val & key, const Val & value, bool nooverwrite); // false if nooverwrite and key existed
+		// Fast sequential load, key must be greater than all keys in bucket (in bucket comparator order), throws otherwise
+		// Keeps path to the last leaf for the whole transaction. For descending keys use REVERSE_BYTEWISE bucket
+		void append(const Val & key, const Val & value);
 		bool get(const Val & key, Val * value)const;
+		// Batch get, keys in any order. values (and found, if not null) are resized to keys.size(), missing keys get empty values.
+		// Keys are sorted, path is reused between neighbour keys and leaves are prefetched before reading. Returns found count
+		size_t get_many(const std::vector<Val> & keys, std::vector<Val> * values, std::vector<bool> * found = nullptr)const;
+		// Splits bucket into at most partition_count ranges of roughly equal size using separator keys of upper node levels.
+		// Ranges are scanned in parallel threads of this snapshot, on_item is called in key order within each range.
+		// on_item must not modify transaction. First exception thrown by on_item is rethrown after all threads finish
+		void scan_partitions(size_t partition_count, std::function<void(size_t partition, const Val & key, const Val & value)> on_item)const;
 		bool del(const Val & key);
+		// Deletes keys in [from, to), returns count of deleted items (in dupsort buckets pairs, long values sharing item count once)
+		// Subtrees fully inside range are unlinked and freed without visiting items, only boundary leaves are edited
+		size_t del_range(const Val & from, const Val & to);
+		// In dupsort buckets put adds value to the set of key (false if nooverwrite and value existed),
+		// get returns the first value and del removes all values. put with value_size is not supported
+		bool is_dupsort()const { return bucket_desc->dupsort != 0; }
+		// Each pair is stored as tree key (key with zero bytes doubled, 00 00, value). Values of at least
+		// dup_value_prefix_size are cut there, values with the same prefix share one item with their sorted
+		// tails as item value (in overflow pages when large). Throws if key alone does not fit
+		size_t dup_value_prefix_size(const Val & key)const;
 		
 		std::string get_stats()const;
 	//{'branch_pages': 1040L,
@@ -37,12 +62,28 @@ namespace mustela {
 	private:
 		friend class TX;
 		friend class Cursor;
+		friend class BulkImporter;
 		Bucket(TX * my_txn, BucketDesc * bucket_desc, Val name = Val());
+		char * put_stored(const Val & key, size_t value_size, bool nooverwrite); // key as stored in tree
+		char * put_in_place(LeafPtr wr_dap, int item, size_t value_size); // nullptr if value does not fit existing item
+		void check_put_stored(const Val & key, size_t value_size)const;
+		std::vector<std::string> get_partition_keys(size_t partition_count)const; // stored separators, ascending
+		char * replace_stored(Cursor & main_cursor, const Val & key, size_t value_size); // cursor points to key, key must not be in page
+		char * insert_here_stored(Cursor & main_cursor, const Val & key, size_t value_size); // with cursor fix-ups, cursor is set to inserted item
+		char * insert_stored(Cursor & main_cursor, const Val & key, size_t value_size); // cursor points to insert position
+		char * append_stored(const Val & key, size_t value_size);
+		void set_append_cursor();
+		bool put_dup_tail(const Val & stored_key, const Val & tail, bool nooverwrite); // into shared item of dupsort values
 
 		TX * my_txn = nullptr;
 		BucketDesc * bucket_desc = nullptr;
+		IntrusiveNode<Cursor> * cursor_slot = nullptr; // in TX, looked up once per bucket
 		Val persistent_name;
 
+		Cursor append_cursor; // at end(), not copied with bucket
+		// Dupsort values which leaf prefix covers partially or which are assembled from shared item are copied here, valid until next get
+		mutable std::deque<std::string> value_buffers; // deque keeps strings in place
+		Val keep_value(const Cursor & cur, Val value)const;
 		IntrusiveNode<Bucket> tx_buckets;
 		void unlink();
 	};
@@ -0,0 +1,356 @@
+#include "bulk_import.hpp"
+#include <algorithm>
+#include <chrono>
+#include "mustela.hpp"
+
+using namespace mustela;
+
+class BulkImporter::RunReader {
+public:
+	explicit RunReader(Chunk * chunk):chunk(chunk){
+		if( chunk->file )
+			rewind(chunk->file);
+	}
+	bool next(){ // false at end of run
+		if( !chunk->file ){
+			if( pos == chunk->records.size() )
+				return false;
+			key = chunk->get_key(chunk->records[pos]);
+			value = chunk->get_value(chunk->records[pos]);
+			pos += 1;
+			return true;
+		}
+		uint64_t key_size = 0, value_size = 0;
+		if( !read_size(key_size) )
+			return false;
+		ass(read_size(value_size), "Truncated run in BulkImporter");
+		buf.resize(key_size + value_size);
+		ass(fread(&buf[0], 1, buf.size(), chunk->file) == buf.size(), "Truncated run in BulkImporter");
+		key = Val(buf.data(), key_size);
+		value = Val(buf.data() + key_size, value_size);
+		return true;
+	}
+	Val key;
+	Val value;
+private:
+	bool read_size(uint64_t & val){
+		unsigned char size_buf[9];
+		if( fread(size_buf, 1, 1, chunk->file) != 1 )
+			return false;
+		size_t rest = size_buf[0] <= 240 ? 0 : size_buf[0] <= 248 ? 1 : size_buf[0] == 249 ? 2 : size_buf[0] - 250 + 3;
+		ass(fread(size_buf + 1, 1, rest, chunk->file) == rest, "Truncated run in BulkImporter");
+		read_u64_sqlite4(val, size_buf);
+		return true;
+	}
+	Chunk * chunk;
+	size_t pos = 0;
+	std::string buf;
+};
+
+// Writes sorted items into leaves left to right, each filled to fill_percent of capacity,
+// then node levels over them. Pages are new, so there is no COW and no cursor fix-ups
+class BulkImporter::TreeBuilder {
+public:
+	TreeBuilder(TX & txn, BucketDesc * bucket_desc, size_t fill_percent):my_txn(txn), bucket_desc(bucket_desc), fill_percent(fill_percent)
+	{}
+	char * add(Val key, size_t value_size){ // keys ascending, returns where value is copied
+		bool overflow = false;
+		if( leaf_pid ){
+			LeafPtr wr_dap = my_txn.writable_leaf(bucket_desc, leaf_pid);
+			ass2(compare_keys(wr_dap.options.comparator, Val(last_key), key) < 0, "Wrong key order in BulkImporter", DEBUG_PAGES);
+			// If key does not have page prefix, all items will grow
+			const size_t prefix_size = wr_dap.get_insert_prefix_size(key);
+			const size_t required_size = wr_dap.get_item_size(prefix_size, key, value_size, overflow);
+			if( wr_dap.data_size(prefix_size) + required_size > wr_dap.capacity() * fill_percent / 100 )
+				start_leaf(key);
+		}else
+			start_leaf(key);
+		LeafPtr wr_dap = my_txn.writable_leaf(bucket_desc, leaf_pid);
+		char * result = wr_dap.insert_at(wr_dap.size(), key, value_size, overflow);
+		last_key.assign(key.data, key.size);
+		stat.count += 1;
+		if( !overflow )
+			return result;
+		Pid overflow_count = my_txn.get_overflow_count(value_size);
+		Pid opa = my_txn.get_free_page(overflow_count);
+		stat.overflow_page_count += overflow_count;
+		pack_overflow_ref(result, opa, my_txn.tid());
+		return my_txn.writable_overflow(opa, overflow_count);
+	}
+	void finish(){ // installs tree into empty bucket
+		if( stat.count == 0 )
+			return; // empty root leaf stays
+		std::vector<Entry> level;
+		level.swap(leaves);
+		while( level.size() > 1 ){
+			level = build_node_level(level);
+			stat.height += 1;
+			ass(stat.height <= MAX_HEIGHT, "Maximum bucket height reached, congratulation!");
+		}
+		const DataPage * dap = my_txn.readable_page(bucket_desc->root_page, 1);
+		my_txn.mark_free_in_future_page(bucket_desc->root_page, 1, dap->tid());
+		for(IntrusiveNode<Cursor> * c = &my_txn.bucket_cursors(bucket_desc); !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+			c->get_current()->before_first(); // path was in replaced root
+		bucket_desc->root_page = level.front().pid;
+		bucket_desc->height = stat.height;
+		bucket_desc->count = stat.count;
+		bucket_desc->leaf_page_count = stat.leaf_page_count;
+		bucket_desc->node_page_count = stat.node_page_count;
+		bucket_desc->overflow_page_count = stat.overflow_page_count;
+		my_txn.meta_page_dirty = true;
+	}
+private:
+	struct Entry { // child page, separator is empty for first child of level
+		std::string key;
+		Pid pid;
+	};
+	void start_leaf(Val first_key){
+		const Pid pid = my_txn.get_free_page(1);
+		std::string separator;
+		if( leaf_pid )
+			separator = get_leaf_separator(static_cast<Comparator>(bucket_desc->comparator), Val(last_key), first_key).to_string();
+		leaves.push_back(Entry{separator, pid});
+		leaf_pid = pid;
+		stat.leaf_page_count += 1;
+		my_txn.writable_leaf(bucket_desc, leaf_pid).init_dirty(my_txn.tid());
+	}
+	std::vector<Entry> build_node_level(const std::vector<Entry> & children){
+		// Child starting node goes to -1 link, its separator goes to parent level
+		CNodePtr sizer(my_txn.page_layout_size, nullptr, bucket_desc->get_options());
+		const size_t limit = sizer.capacity() * fill_percent / 100;
+		std::vector<size_t> begins;
+		size_t size = 0;
+		for(size_t i = 0; i != children.size(); ++i){
+			const size_t item_size = i == 0 ? 0 : sizer.get_item_size(Val(children[i].key), children[i].pid);
+			if( i == 0 || (i != begins.back() + 1 && size + item_size > limit) ){
+				begins.push_back(i);
+				size = 0;
+			}else
+				size += item_size;
+		}
+		// Node must have at least 1 key. Last node borrows child from previous one,
+		// or joins it (2 keys always fit, as max_key_size guarantees)
+		if( begins.size() > 1 && begins.back() + 1 == children.size() ){
+			if( begins.back() - begins.at(begins.size() - 2) > 2 )
+				begins.back() -= 1;
+			else
+				begins.pop_back();
+		}
+		begins.push_back(children.size());
+		std::vector<Entry> parents;
+		for(size_t g = 0; g + 1 != begins.size(); ++g){
+			const Pid pid = my_txn.get_free_page(1);
+			stat.node_page_count += 1;
+			NodePtr wr_dap = my_txn.writable_node(bucket_desc, pid);
+			wr_dap.init_dirty(my_txn.tid());
+			wr_dap.set_value(-1, children.at(begins[g]).pid);
+			for(size_t i = begins[g] + 1; i != begins[g + 1]; ++i)
+				wr_dap.append(Val(children[i].key), children[i].pid);
+			parents.push_back(Entry{children.at(begins[g]).key, pid});
+		}
+		return parents;
+	}
+	TX & my_txn;
+	BucketDesc * bucket_desc;
+	const size_t fill_percent;
+	BucketDesc stat{}; // of built tree, installed by finish
+	Pid leaf_pid = 0; // being filled
+	std::string last_key;
+	std::vector<Entry> leaves;
+};
+
+BulkImporter::BulkImporter(TX & txn, const Val & bucket_name, const BucketOptions & options, const BulkImportOptions & import_options):
+	my_txn(txn), bucket_name(bucket_name.to_string()), options(options), import_options(import_options), current(new Chunk()) {
+	if( my_txn.read_only )
+		throw Exception("Attempt to modify read-only transaction in BulkImporter");
+	if( this->import_options.thread_count == 0 )
+		this->import_options.thread_count = 1;
+	if( this->import_options.fill_percent < 50 || this->import_options.fill_percent > 100 )
+		throw Exception("BulkImporter fill_percent must be 50..100");
+	// Records are sorted as the bucket stores them, so its options are used if it already exists
+	Bucket bucket = my_txn.get_bucket(bucket_name, true, options);
+	if( bucket.bucket_desc->count != 0 )
+		throw Exception("BulkImporter requires empty bucket");
+	this->options = bucket.bucket_desc->get_options();
+}
+BulkImporter::~BulkImporter(){
+	for(auto && run : runs){
+		if( run->sorter.joinable() )
+			run->sorter.join();
+		if( run->file )
+			fclose(run->file);
+	}
+}
+void BulkImporter::add(const Val & key, const Val & value){
+	ass(!finished, "BulkImporter::add after finish");
+	Val stored_key = key;
+	Val stored_value = value;
+	if( options.dupsort ){ // sorted as stored pairs
+		stored_key = encode_dup(key, value, dup_buf);
+		stored_value = Val();
+	}
+	current->records.push_back(Record{current->data.size(), static_cast<uint32_t>(stored_key.size), static_cast<uint32_t>(stored_value.size)});
+	current->data.append(stored_key.data, stored_key.size);
+	current->data.append(stored_value.data, stored_value.size);
+	record_count += 1;
+	// One chunk is filled while others are sorted
+	const size_t chunk_budget = import_options.memory_budget / (import_options.thread_count + 1);
+	if( current->data.size() + current->records.size() * sizeof(Record) >= chunk_budget )
+		flush_chunk(true);
+}
+void BulkImporter::sort_chunk(Chunk * chunk, Comparator comparator, bool spill){
+	std::stable_sort(chunk->records.begin(), chunk->records.end(), [&](const Record & a, const Record & b){
+		return compare_keys(comparator, chunk->get_key(a), chunk->get_key(b)) < 0;
+	});
+	// Keep last of equal keys, so runs have unique keys
+	size_t count = 0;
+	for(size_t i = 0; i != chunk->records.size(); ++i)
+		if( i + 1 == chunk->records.size() || chunk->get_key(chunk->records[i]) != chunk->get_key(chunk->records[i + 1]) )
+			chunk->records[count++] = chunk->records[i];
+	chunk->records.resize(count);
+	if( !spill )
+		return;
+	chunk->file = std::tmpfile();
+	ass(chunk->file, "BulkImporter failed to create spill file");
+	unsigned char size_buf[18];
+	for(auto && r : chunk->records){
+		size_t sizes = write_u64_sqlite4(r.key_size, size_buf);
+		sizes += write_u64_sqlite4(r.value_size, size_buf + sizes);
+		ass(fwrite(size_buf, 1, sizes, chunk->file) == sizes, "BulkImporter failed to write spill file");
+		ass(fwrite(chunk->data.data() + r.offset, 1, r.key_size + r.value_size, chunk->file) == r.key_size + r.value_size, "BulkImporter failed to write spill file");
+	}
+	ass(fflush(chunk->file) == 0, "BulkImporter failed to write spill file");
+	std::string().swap(chunk->data);
+	std::vector<Record>().swap(chunk->records);
+}
+void BulkImporter::join_sorter(Chunk * chunk){
+	chunk->sorter.join();
+	if( chunk->sort_error )
+		std::rethrow_exception(chunk->sort_error);
+}
+void BulkImporter::flush_chunk(bool spill){
+	auto sort_start = std::chrono::high_resolution_clock::now();
+	size_t sorting = 0; // wait for oldest sorter, if all threads are busy
+	for(auto && run : runs)
+		sorting += run->sorter.joinable() ? 1 : 0;
+	for(auto it = runs.begin(); sorting >= import_options.thread_count && it != runs.end(); ++it)
+		if( (*it)->sorter.joinable() ){
+			join_sorter(it->get());
+			sorting -= 1;
+		}
+	Chunk * chunk = current.get();
+	runs.push_back(std::move(current));
+	current.reset(new Chunk());
+	run_count += 1;
+	const Comparator comparator = options.comparator;
+	if( spill )
+		chunk->sorter = std::thread([chunk, comparator](){
+			try { // exception escaping thread would terminate
+				sort_chunk(chunk, comparator, true);
+			}catch(...){
+				chunk->sort_error = std::current_exception();
+			}
+		});
+	else
+		sort_chunk(chunk, comparator, false);
+	sort_seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - sort_start).count();
+}
+void BulkImporter::finish(){
+	ass(!finished, "BulkImporter::finish called twice");
+	finished = true;
+	flush_chunk(false); // last run stays in memory
+	auto sort_start = std::chrono::high_resolution_clock::now();
+	for(auto && run : runs)
+		if( run->sorter.joinable() )
+			join_sorter(run.get());
+	auto build_start = std::chrono::high_resolution_clock::now();
+	sort_seconds += std::chrono::duration<double>(build_start - sort_start).count();
+	Bucket bucket = my_txn.get_bucket(Val(bucket_name), true, options);
+	if( bucket.bucket_desc->count != 0 )
+		throw Exception("BulkImporter requires empty bucket");
+	if( (bucket.bucket_desc->dupsort != 0) != options.dupsort || bucket.bucket_desc->comparator != static_cast<uint8_t>(options.comparator) )
+		throw Exception("BulkImporter bucket was recreated with different options");
+	const Comparator comparator = options.comparator;
+	std::vector<std::unique_ptr<RunReader>> readers;
+	std::vector<size_t> heap; // indices of readers, smallest key on top, for equal keys earlier run on top
+	auto heap_less = [&](size_t a, size_t b){
+		int cmp = compare_keys(comparator, readers[a]->key, readers[b]->key);
+		return cmp != 0 ? cmp > 0 : a > b;
+	};
+	for(auto && run : runs){
+		readers.emplace_back(new RunReader(run.get()));
+		if( readers.back()->next() )
+			heap.push_back(readers.size() - 1);
+	}
+	std::make_heap(heap.begin(), heap.end(), heap_less);
+	TX::BucketMirror * bu = DEBUG_MIRROR ? &my_txn.debug_mirror.at(bucket_name) : nullptr;
+	TreeBuilder builder(my_txn, bucket.bucket_desc, import_options.fill_percent);
+	auto append_item = [&](Val key, Val value){
+		if( !import_options.build_pages ){
+			char * dst = bucket.append_stored(key, value.size);
+			memcpy(dst, value.data, value.size);
+			if( DEBUG_MIRROR )
+				bu->at(key.to_string()).first = value.to_string();
+			return;
+		}
+		bucket.check_put_stored(key, value.size);
+		char * dst = builder.add(key, value.size);
+		memcpy(dst, value.data, value.size);
+		if( DEBUG_MIRROR ) // cursors are set after tree is installed
+			ass(bu->insert(std::make_pair(key.to_string(), std::make_pair(value.to_string(), Cursor()))).second, "inconsistent mirror");
+	};
+	// Dupsort runs have whole pairs, long values cut to the same stored key are collected into one item
+	const size_t max_size = max_key_size(my_txn.page_layout_size, bucket.bucket_desc->key_head_size);
+	std::string pair_key_buf, stored_buf, shared_key, shared_tails;
+	auto append_shared = [&](){
+		if( !shared_tails.empty() )
+			append_item(Val(shared_key), Val(shared_tails));
+		shared_tails.clear();
+	};
+	auto append_pair = [&](Val pair){
+		Val key, value, stored_key, tail;
+		ass(decode_dup(pair, &key, &value, pair_key_buf), "Wrong dupsort pair in BulkImporter");
+		if( !encode_dup_item(key, value, max_size, stored_buf, &stored_key, &tail) ){
+			append_shared();
+			return append_item(stored_key, Val());
+		}
+		if( stored_key != Val(shared_key) )
+			append_shared();
+		shared_key = stored_key.to_string();
+		append_dup_tail(shared_tails, tail);
+	};
+	while( !heap.empty() ){
+		std::pop_heap(heap.begin(), heap.end(), heap_less);
+		const size_t top = heap.back();
+		RunReader & reader = *readers[top];
+		// Later run has the same key, its value wins
+		if( heap.size() == 1 || readers[heap.front()]->key != reader.key ){
+			if( options.dupsort )
+				append_pair(reader.key);
+			else
+				append_item(reader.key, reader.value);
+		}
+		if( reader.next() )
+			std::push_heap(heap.begin(), heap.end(), heap_less);
+		else
+			heap.pop_back();
+	}
+	append_shared();
+	if( import_options.build_pages ){
+		builder.finish();
+		if( DEBUG_MIRROR ){
+			Cursor cur = bucket.get_cursor();
+			Val c_key, c_value;
+			size_t found_count = 0; // mirror is in bytewise order, bucket in comparator order
+			for(cur.first(); cur.get_stored(&c_key, &c_value); cur.next_stored(), ++found_count){
+				auto mit = bu->find(c_key.to_string());
+				ass(mit != bu->end() && c_value.to_string() == mit->second.first, "Built tree differs from mirror");
+				mit->second.second = cur;
+			}
+			ass(found_count == bu->size(), "Built tree differs from mirror");
+		}
+	}
+	if( DEBUG_MIRROR )
+		my_txn.check_mirror();
+	build_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - build_start).count();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstdio>
+#include <exception>
+#include "pages.hpp"
+
+namespace mustela {
+
+	struct BulkImportOptions {
+		size_t memory_budget = 256*1024*1024; // records kept in memory, split between sorting threads
+		size_t thread_count = 4; // runs are sorted and spilled in parallel
+		size_t fill_percent = 100; // 50..100, share of leaf and node capacity filled. Lower leaves room for later puts without splits
+		bool build_pages = true; // false appends records one by one (fallback, pages are filled by splits)
+	};
+	// Loads unsorted stream into fresh (empty) bucket. Records are sorted into spill runs, merged stream
+	// is written into leaves left to right, then node levels are built over them and root is installed into bucket.
+	// For equal keys last added value wins, in dupsort buckets equal pairs are stored once.
+	// Bucket is created or opened in constructor, options of existing bucket win over requested ones
+	class BulkImporter {
+	public:
+		explicit BulkImporter(TX & txn, const Val & bucket_name, const BucketOptions & options = BucketOptions{}, const BulkImportOptions & import_options = BulkImportOptions{});
+		~BulkImporter();
+		BulkImporter(const BulkImporter &) = delete;
+		BulkImporter & operator=(const BulkImporter &) = delete;
+
+		void add(const Val & key, const Val & value);
+		void finish(); // merges runs into bucket, caller commits transaction
+
+		size_t get_record_count()const { return record_count; } // added, including duplicates
+		size_t get_run_count()const { return run_count; }
+		double get_sort_seconds()const { return sort_seconds; }
+		double get_build_seconds()const { return build_seconds; }
+	private:
+		struct Record {
+			size_t offset; // in chunk data, key followed by value
+			uint32_t key_size;
+			uint32_t value_size;
+		};
+		struct Chunk {
+			std::string data;
+			std::vector<Record> records; // sorted stable, so later duplicates stay later
+			FILE * file = nullptr; // spilled run, records are released then
+			std::thread sorter;
+			std::exception_ptr sort_error; // from sorter, rethrown after join
+			Val get_key(const Record & r)const { return Val(data.data() + r.offset, r.key_size); }
+			Val get_value(const Record & r)const { return Val(data.data() + r.offset + r.key_size, r.value_size); }
+		};
+		class RunReader;
+		class TreeBuilder;
+		void flush_chunk(bool spill);
+		static void sort_chunk(Chunk * chunk, Comparator comparator, bool spill);
+		static void join_sorter(Chunk * chunk);
+
+		TX & my_txn;
+		std::string bucket_name;
+		BucketOptions options; // of bucket, not requested ones
+		BulkImportOptions import_options;
+		std::string dup_buf;
+		std::unique_ptr<Chunk> current;
+		std::vector<std::unique_ptr<Chunk>> runs; // in order of adding
+		size_t record_count = 0;
+		size_t run_count = 0;
+		double sort_seconds = 0;
+		double build_seconds = 0;
+		bool finished = false;
+	};
+}
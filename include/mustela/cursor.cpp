@@ -1,11 +1,14 @@
 #include "mustela.hpp"
+#include <algorithm>
 #include <iostream>
 
 using namespace mustela;
 	
-Cursor::Cursor(TX * my_txn, BucketDesc * bucket_desc, Val name):my_txn(my_txn), bucket_desc(bucket_desc), persistent_name(name){
+Cursor::Cursor(TX * my_txn, BucketDesc * bucket_desc, Val name, IntrusiveNode<Cursor> * cursor_slot):my_txn(my_txn), bucket_desc(bucket_desc), cursor_slot(cursor_slot), persistent_name(name){
 	ass(my_txn && bucket_desc, "get_cursor called on invalid bucket");
-    my_txn->my_cursors.insert_after_this(this, &Cursor::tx_cursors);
+	if( !this->cursor_slot )
+		this->cursor_slot = &my_txn->bucket_cursors(bucket_desc);
+    this->cursor_slot->insert_after_this(this, &Cursor::tx_cursors);
 	before_first();
 }
 Cursor::~Cursor(){
@@ -15,34 +18,39 @@ void Cursor::unlink(){
 	tx_cursors.unlink(&Cursor::tx_cursors);
 	my_txn = nullptr;
 	bucket_desc = nullptr;
+	cursor_slot = nullptr;
 	persistent_name = Val{};
 }
-Cursor::Cursor(Cursor && other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), persistent_name(other.persistent_name), path(std::move(other.path)){
+Cursor::Cursor(Cursor && other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), cursor_slot(other.cursor_slot), persistent_name(other.persistent_name), dup_index(other.dup_index), path(std::move(other.path)){
 	if(my_txn)
-    	my_txn->my_cursors.insert_after_this(this, &Cursor::tx_cursors);
+    	cursor_slot->insert_after_this(this, &Cursor::tx_cursors);
 }
-Cursor::Cursor(const Cursor & other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), persistent_name(other.persistent_name), path(other.path){
+Cursor::Cursor(const Cursor & other):my_txn(other.my_txn), bucket_desc(other.bucket_desc), cursor_slot(other.cursor_slot), persistent_name(other.persistent_name), dup_index(other.dup_index), path(other.path){
 	if(my_txn)
-    	my_txn->my_cursors.insert_after_this(this, &Cursor::tx_cursors);
+    	cursor_slot->insert_after_this(this, &Cursor::tx_cursors);
 }
 Cursor & Cursor::operator=(Cursor && other){
 	unlink();
 	my_txn = other.my_txn;
 	bucket_desc = other.bucket_desc;
+	cursor_slot = other.cursor_slot;
 	persistent_name = other.persistent_name;
+	dup_index = other.dup_index;
 	path = std::move(other.path);
 	if(my_txn)
-    	my_txn->my_cursors.insert_after_this(this, &Cursor::tx_cursors);
+    	cursor_slot->insert_after_this(this, &Cursor::tx_cursors);
 	return *this;
 }
 Cursor & Cursor::operator=(const Cursor & other){
 	unlink();
 	my_txn = other.my_txn;
 	bucket_desc = other.bucket_desc;
+	cursor_slot = other.cursor_slot;
 	persistent_name = other.persistent_name;
+	dup_index = other.dup_index;
 	path = other.path;
 	if(my_txn)
-    	my_txn->my_cursors.insert_after_this(this, &Cursor::tx_cursors);
+    	cursor_slot->insert_after_this(this, &Cursor::tx_cursors);
 	return *this;
 }
 
@@ -62,7 +70,7 @@ bool Cursor::operator==(const Cursor & other)const{
 	for(size_t i = 0; i != bucket_desc->height + 1; ++i)
 		if(at(i).pid != other.at(i).pid || at(i).item != other.at(i).item)
 			return false;
-	return true;
+	return dup_index == other.dup_index;
 }
 Bucket Cursor::get_bucket(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
@@ -71,28 +79,60 @@ Bucket Cursor::get_bucket(){
 
 bool Cursor::seek(const Val & key){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	if( bucket_desc->dupsort == 0 )
+		return seek_stored(key);
+	Val prefix = encode_dup_key(key, dup_buffer);
+	seek_stored(prefix); // pair with empty value is the first one
+	Val c_key, c_value;
+	return get_stored(&c_key, &c_value) && c_key.has_prefix(prefix);
+}
+bool Cursor::seek_stored(const Val & key){
+	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	dup_index = 0;
 	Pid pa = bucket_desc->root_page;
 	size_t height = bucket_desc->height;
 	while(true){
 		if( height == 0 ){
-			CLeafPtr dap = my_txn->readable_leaf(pa);
+			CLeafPtr dap = my_txn->readable_leaf(bucket_desc, pa);
 			bool found;
 			int item = dap.lower_bound_item(key, &found);
 			at(height) = Element{pa, item};
 			return found;
 		}
-		CNodePtr nap = my_txn->readable_node(pa);
+		CNodePtr nap = my_txn->readable_node(bucket_desc, pa);
 		int nitem = nap.upper_bound_item(key) - 1;
 		at(height) = Element{pa, nitem};
 		pa = nap.get_value(nitem);
 		height -= 1;
 	}
 }
+Pid Cursor::seek_leaf_from_previous(const Val & key){
+	dup_index = 0;
+	size_t height = 1;
+	if( is_before_first() ) // no previous call
+		height = bucket_desc->height + 1;
+	for(; height <= bucket_desc->height; ++height){ // find lowest node where child still covers key
+		CNodePtr nap = my_txn->readable_node(bucket_desc, at(height).pid);
+		const int next_item = at(height).item + 1;
+		if( next_item < nap.size() && compare_keys(static_cast<Comparator>(bucket_desc->comparator), key, nap.get_key(next_item)) < 0 )
+			break;
+	}
+	Pid pa = height > bucket_desc->height ? bucket_desc->root_page : at(height - 1).pid;
+	height -= 1;
+	for(; height != 0; --height){
+		CNodePtr nap = my_txn->readable_node(bucket_desc, pa);
+		int nitem = nap.upper_bound_item(key) - 1;
+		at(height) = Element{pa, nitem};
+		pa = nap.get_value(nitem);
+	}
+	at(0) = Element{pa, 0};
+	return pa;
+}
 bool Cursor::fix_cursor_after_last_item(){
 	if( is_before_first() )
 		return false;
 	auto path_el = at(0);
-	CLeafPtr dap = my_txn->readable_leaf(path_el.pid);
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, path_el.pid);
 	if(path_el.item < dap.size())
 		return true;
 	ass(path_el.item == dap.size(), "Cursor corrupted at Cursor::fix_cursor_after_last_item");
@@ -101,7 +141,7 @@ bool Cursor::fix_cursor_after_last_item(){
 	while(true){
 		if( height == bucket_desc->height + 1 )
 			return false;
-		CNodePtr nap = my_txn->readable_node(at(height).pid);
+		CNodePtr nap = my_txn->readable_node(bucket_desc, at(height).pid);
 		if( at(height).item + 1 < nap.size() ){
 			at(height).item += 1;
 			pa = nap.get_value(at(height).item);
@@ -111,23 +151,49 @@ bool Cursor::fix_cursor_after_last_item(){
 		height += 1;
 	}
 	set_at_direction(height, pa, -1);
+	my_txn->scan_readahead(bucket_desc, at(1).pid, at(1).item); // scan moved to next leaf
 	return true;
 }
 void Cursor::set_at_direction(size_t height, Pid pa, int dir){
+	dup_index = 0;
 	while(true){
 		if( height == 0 ){
-			CLeafPtr dap = my_txn->readable_leaf(pa);
+			CLeafPtr dap = my_txn->readable_leaf(bucket_desc, pa);
 			ass(bucket_desc->count == 0 || dap.size() > 0, "Empty leaf page in Cursor::set_at_direction");
 			at(height) = Element{pa, dir > 0 ? dap.size() : 0};
 			break;
 		}
-		CNodePtr nap = my_txn->readable_node(pa);
+		CNodePtr nap = my_txn->readable_node(bucket_desc, pa);
 		int nitem = dir > 0 ? nap.size() - 1 : -1;
 		at(height) = Element{pa, nitem};
 		pa = nap.get_value(nitem);
 		height -= 1;
 	}
 }
+void Cursor::on_erase_subtree(BucketDesc * desc, size_t height, Pid pa, int erase_index){
+	if( bucket_desc != desc || at(height).pid != pa || at(height).item < erase_index )
+		return;
+	if( at(height).item > erase_index ){
+		at(height).item -= 1;
+		return;
+	}
+	// We were in erased subtree, set to the first item of next child or after last item of previous one
+	CNodePtr nap = my_txn->readable_node(bucket_desc, pa);
+	if( erase_index < nap.size() )
+		return set_at_direction(height - 1, nap.get_value(erase_index), -1);
+	at(height).item -= 1;
+	set_at_direction(height - 1, nap.get_value(at(height).item), 1);
+}
+bool Cursor::is_at_bucket_end()const{
+	if( is_before_first() )
+		return false;
+	for(size_t height = bucket_desc->height; height != 0; --height){
+		CNodePtr nap = my_txn->readable_node(bucket_desc, at(height).pid);
+		if( at(height).item != nap.size() - 1 || nap.get_value(at(height).item) != at(height - 1).pid )
+			return false;
+	}
+	return at(bucket_desc->height).pid == bucket_desc->root_page && at(0).item == my_txn->readable_leaf(bucket_desc, at(0).pid).size();
+}
 void Cursor::end(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
 	set_at_direction(bucket_desc->height, bucket_desc->root_page, 1);
@@ -135,27 +201,112 @@ void Cursor::end(){
 void Cursor::before_first(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
 	at(0).pid = 0;
+	dup_index = 0;
 }
 
 void Cursor::first(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
 	set_at_direction(bucket_desc->height, bucket_desc->root_page, -1);
+	if( bucket_desc->height != 0 )
+		my_txn->scan_readahead(bucket_desc, at(1).pid, at(1).item);
 }
 void Cursor::last(){
 	end();
 	prev();
 }
 bool Cursor::get(Val * key, Val * value){
+	Val stored_value;
+	if( !get_stored(key, &stored_value) )
+		return false;
+	if( bucket_desc->dupsort == 0 ){
+		*value = stored_value;
+		return true;
+	}
+	ass(decode_dup(*key, key, value, dup_buffer), "Wrong dupsort pair in Cursor::get");
+	if( !stored_value.empty() ){ // long value, start is in stored key and tail in shared item
+		Val tail = get_dup_tail(stored_value, dup_index);
+		dup_value_buffer.assign(value->data, value->size);
+		dup_value_buffer.append(tail.data, tail.size);
+		*value = Val(dup_value_buffer);
+		return true;
+	}
+	if( is_in_key_buffer(*value) ){ // value is suffix of pair, point it into page unless leaf prefix covers part of it
+		Val tail = my_txn->readable_leaf(bucket_desc, at(0).pid).get_key_tail(at(0).item);
+		if( value->size <= tail.size )
+			*value = Val(tail.end() - value->size, value->size);
+	}
+	return true;
+}
+bool Cursor::seek_dup(const Val & key, const Val & value){
+	ass(is_valid() && bucket_desc->dupsort != 0, "Cursor::seek_dup requires valid dupsort cursor");
+	Val stored_key, tail;
+	if( !encode_dup_item(key, value, max_dup_stored_size(), dup_buffer, &stored_key, &tail) )
+		return seek_stored(stored_key);
+	if( !seek_stored(stored_key) ) // values cut to other keys are all less or all greater
+		return false;
+	Val c_key, c_value;
+	ass(get_stored(&c_key, &c_value), "Cursor get_stored failed after found in Cursor::seek_dup");
+	bool found;
+	dup_index = find_dup_tail(c_value, tail, &found);
+	if( dup_index == count_dup_tails(c_value) ) // all values of item are less
+		next_stored();
+	return found;
+}
+bool Cursor::next_dup(){
+	ass(is_valid() && bucket_desc->dupsort != 0, "Cursor::next_dup requires valid dupsort cursor");
+	Val c_key, c_value;
+	if( !get(&c_key, &c_value) )
+		return false;
+	std::string prefix_buf;
+	Val prefix = encode_dup_key(c_key, prefix_buf);
+	next();
+	if( get_stored(&c_key, &c_value) && c_key.has_prefix(prefix) )
+		return true;
+	prev();
+	return false;
+}
+size_t Cursor::count_dups(){
+	ass(is_valid() && bucket_desc->dupsort != 0, "Cursor::count_dups requires valid dupsort cursor");
+	Val c_key, c_value;
+	if( !get(&c_key, &c_value) )
+		return 0;
+	std::string prefix_buf;
+	Val prefix = encode_dup_key(c_key, prefix_buf);
+	Cursor cur(my_txn, bucket_desc, persistent_name, cursor_slot);
+	cur.seek_stored(prefix);
+	size_t result = 0;
+	for(; cur.get_stored(&c_key, &c_value) && c_key.has_prefix(prefix); cur.next_stored())
+		result += c_value.empty() ? 1 : count_dup_tails(c_value);
+	return result;
+}
+size_t Cursor::max_dup_stored_size()const{
+	return max_key_size(my_txn->page_layout_size, bucket_desc->key_head_size);
+}
+size_t Cursor::count_item_dups(){
+	Val c_key, c_value;
+	if( !get_stored(&c_key, &c_value) )
+		return 0;
+	return c_value.empty() ? 1 : count_dup_tails(c_value);
+}
+bool Cursor::del_dup(const Val & key, const Val & value){
+	if( !seek_dup(key, value) )
+		return false;
+	ass(del(), "Cursor del returned false after successfull seek_dup");
+	return true;
+}
+bool Cursor::get_stored(Val * key, Val * value){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
 	if( !fix_cursor_after_last_item() )
 		return false;
 	auto path_el = at(0);
-	CLeafPtr dap = my_txn->readable_leaf(path_el.pid);
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, path_el.pid);
 	ass( path_el.item < dap.size(), "fix_cursor_after_last_item failed at Cursor::get" );
 	Pid overflow_page;
-	auto kv = dap.get_kv(path_el.item, overflow_page);
+	auto kv = dap.get_kv(path_el.item, overflow_page, key_buffer);
 	if( overflow_page ){
-		Pid overflow_count = (kv.value.size + my_txn->page_size - 1)/my_txn->page_size;
+		if( my_txn->verify_on_read )
+			my_txn->verify_overflow_checksum(dap, path_el.item);
+		Pid overflow_count = my_txn->get_overflow_count(kv.value.size);
 		kv.value.data = my_txn->readable_overflow(overflow_page, overflow_count);
 	}
 	*key = kv.key;
@@ -166,11 +317,41 @@ bool Cursor::del(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
 	if( my_txn->read_only )
 		throw Exception("Attempt to modify read-only transaction in Cursor::del");
+	Val c_key, c_value;
+	if( bucket_desc->dupsort == 0 || !get_stored(&c_key, &c_value) || c_value.empty() || count_dup_tails(c_value) == 1 )
+		return del_stored();
+	// Shared item keeps other values, cursors at later values of item are moved back
+	const std::string key = c_key.to_string();
+	std::string tails;
+	erase_dup_tail(c_value, dup_index, tails);
+	TX::BucketMirror * bu = nullptr;
+	Cursor * mirror_cursor = nullptr; // mirror keeps items, not values in them
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		bu = &my_txn->debug_mirror.at(persistent_name.to_string());
+		ass(bu->count(key) == 1, "Mirror key different in cursor del");
+		mirror_cursor = &bu->at(key).second;
+		my_txn->before_mirror_operation(bucket_desc, persistent_name);
+	}
+	char * dst = get_bucket().replace_stored(*this, Val(key), tails.size());
+	memcpy(dst, tails.data(), tails.size());
+	const auto path_el = at(0);
+	const size_t erase_index = dup_index;
+	const bool erased_last = erase_index == count_dup_tails(Val(tails));
+	for(IntrusiveNode<Cursor> * c = cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+		if( c->get_current() != mirror_cursor )
+			c->get_current()->on_erase_dup(bucket_desc, path_el.pid, path_el.item, erase_index, erased_last);
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		bu->at(key).first = tails;
+		my_txn->check_mirror();
+	}
+	return true;
+}
+bool Cursor::del_stored(){
 	if( !fix_cursor_after_last_item() )
 		return false;
 	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
 		Val c_key, c_value;
-		ass(get(&c_key, &c_value), "cursor get failed in del");
+		ass(get_stored(&c_key, &c_value), "cursor get failed in del");
  		auto & part = my_txn->debug_mirror.at(persistent_name.to_string());
  		auto mit = part.find(c_key.to_string());
 		ass(mit != part.end(), "inconsistent mirror in cursor del");
@@ -180,17 +361,19 @@ bool Cursor::del(){
 		my_txn->before_mirror_operation(bucket_desc, persistent_name);
 	}
 	my_txn->meta_page_dirty = true;
-	LeafPtr wr_dap(my_txn->page_size, (LeafPage *)my_txn->make_pages_writable(*this, 0));
+	LeafPtr wr_dap(my_txn->page_layout_size, (LeafPage *)my_txn->make_pages_writable(*this, 0), bucket_desc->get_options());
 	auto path_el = at(0);
 	ass( path_el.item < wr_dap.size(), "fix_cursor_after_last_item failed at Cursor::del" );
-	Pid overflow_page, overflow_count;
+	Pid overflow_page;
+	size_t overflow_size;
 	Tid overflow_tid;
-	wr_dap.erase(path_el.item, overflow_page, overflow_count, overflow_tid);
+	wr_dap.erase(path_el.item, overflow_page, overflow_size, overflow_tid);
 	if( overflow_page ) {
+		Pid overflow_count = my_txn->get_overflow_count(overflow_size);
 		bucket_desc->overflow_page_count -= overflow_count;
 		my_txn->mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
 	}
-	for(IntrusiveNode<Cursor> * c = &my_txn->my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+	for(IntrusiveNode<Cursor> * c = cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
 		c->get_current()->on_erase(bucket_desc, 0, path_el.pid, path_el.item);
 	my_txn->start_update(bucket_desc);
 	my_txn->new_merge_leaf(*this, wr_dap);
@@ -200,19 +383,137 @@ bool Cursor::del(){
 		my_txn->check_mirror();
 	return true;
 }
+bool Cursor::replace(const Val & value){
+	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	if( my_txn->read_only )
+		throw Exception("Attempt to modify read-only transaction in Cursor::replace");
+	if( bucket_desc->dupsort != 0 )
+		throw Exception("Cursor::replace cannot be used with dupsort bucket");
+	Val c_key, c_value;
+	if( !get_stored(&c_key, &c_value) )
+		return false;
+	const std::string key = c_key.to_string(); // item is erased if value does not fit
+	Bucket bucket = get_bucket();
+	bucket.check_put_stored(Val(key), value.size);
+	TX::BucketMirror * bu = nullptr;
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		bu = &my_txn->debug_mirror.at(persistent_name.to_string());
+		ass(bu->count(key) == 1, "Mirror key different in cursor replace");
+		my_txn->before_mirror_operation(bucket_desc, persistent_name);
+	}
+	char * dst = bucket.replace_stored(*this, Val(key), value.size);
+	memcpy(dst, value.data, value.size);
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		bu->at(key).first = value.to_string();
+		my_txn->check_mirror();
+	}
+	return true;
+}
+void Cursor::check_insert_order(const Val & key){
+	const Comparator comparator = static_cast<Comparator>(bucket_desc->comparator);
+	auto path_el = at(0);
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, path_el.pid);
+	if( path_el.item > 0 && path_el.item < dap.size() ){ // both neighbours in our leaf
+		std::string buf;
+		if( compare_keys(comparator, dap.get_key(path_el.item - 1, buf), key) >= 0 || compare_keys(comparator, key, dap.get_key(path_el.item, buf)) >= 0 )
+			throw Exception("Key must be between neighbour keys in Cursor::insert_here");
+		return;
+	}
+	Val c_key, c_value;
+	Cursor next_cursor(*this);
+	if( next_cursor.get_stored(&c_key, &c_value) && compare_keys(comparator, key, c_key) >= 0 )
+		throw Exception("Key must be between neighbour keys in Cursor::insert_here");
+	Cursor prev_cursor(*this);
+	prev_cursor.prev();
+	if( prev_cursor.get_stored(&c_key, &c_value) && compare_keys(comparator, c_key, key) >= 0 )
+		throw Exception("Key must be between neighbour keys in Cursor::insert_here");
+}
+void Cursor::check_dup_insert_order(const Val & key, const Val & value){
+	// Pairs are ordered as their encodings before cut, cursor may point into shared item
+	std::string buf, other_buf;
+	const Val pair = encode_dup(key, value, buf);
+	Val c_key, c_value;
+	Cursor next_cursor(*this);
+	if( next_cursor.get(&c_key, &c_value) && pair.compare(encode_dup(c_key, c_value, other_buf)) >= 0 )
+		throw Exception("Key must be between neighbour keys in Cursor::insert_here");
+	Cursor prev_cursor(*this);
+	prev_cursor.prev();
+	if( prev_cursor.get(&c_key, &c_value) && encode_dup(c_key, c_value, other_buf).compare(pair) >= 0 )
+		throw Exception("Key must be between neighbour keys in Cursor::insert_here");
+}
+void Cursor::insert_here(const Val & key, const Val & value){
+	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	if( my_txn->read_only )
+		throw Exception("Attempt to modify read-only transaction in Cursor::insert_here");
+	std::string stored_buf;
+	Val stored_key = key;
+	Val stored_value = value;
+	Bucket bucket = get_bucket();
+	if( bucket_desc->dupsort != 0 ){ // value is part of key
+		Val tail;
+		const bool cut = encode_dup_item(key, value, max_dup_stored_size(), stored_buf, &stored_key, &tail);
+		bucket.check_put_stored(stored_key, 0);
+		if( is_before_first() )
+			first();
+		check_dup_insert_order(key, value);
+		if( cut ){ // into shared item
+			ass(bucket.put(key, value, true), "Pair found in Cursor::insert_here after order check");
+			ass(seek_dup(key, value), "Pair not found in Cursor::insert_here after put");
+			return;
+		}
+		stored_value = Val();
+	}else{
+		bucket.check_put_stored(stored_key, stored_value.size);
+		if( is_before_first() )
+			first();
+		check_insert_order(stored_key);
+	}
+	TX::BucketMirror * bu = nullptr;
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		bu = &my_txn->debug_mirror.at(persistent_name.to_string());
+		ass(bu->count(stored_key.to_string()) == 0, "Mirror key different in cursor insert_here");
+		my_txn->before_mirror_operation(bucket_desc, persistent_name);
+	}
+	char * dst = bucket.insert_here_stored(*this, stored_key, stored_value.size);
+	memcpy(dst, stored_value.data, stored_value.size);
+	if(DEBUG_MIRROR && bucket_desc != &my_txn->meta_page.meta_bucket){
+		ass(bu->insert(std::make_pair(stored_key.to_string(), std::make_pair(stored_value.to_string(), *this))).second, "inconsistent mirror");
+		my_txn->check_mirror();
+	}
+}
 void Cursor::next(){
+	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	if( bucket_desc->dupsort != 0 && dup_index + 1 < count_item_dups() ){
+		dup_index += 1;
+		return;
+	}
+	next_stored();
+}
+void Cursor::next_stored(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
 	if( is_before_first())
 		return first();
 	if( !fix_cursor_after_last_item() )
 		return;
 	auto & path_el = at(0);
-	CLeafPtr dap = my_txn->readable_leaf(path_el.pid);
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, path_el.pid);
 	ass( path_el.item < dap.size(), "fix_cursor_after_last_item failed at Cursor::next" );
 	path_el.item += 1;
+	dup_index = 0;
 }
 void Cursor::prev(){
 	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	if( dup_index > 0 ){
+		dup_index -= 1;
+		return;
+	}
+	prev_stored();
+	if( bucket_desc->dupsort != 0 ) // to the last value of shared item
+		dup_index = std::max<size_t>(count_item_dups(), 1) - 1;
+}
+void Cursor::prev_stored(){
+	ass(is_valid(), "Cursor not valid (using after tx commit?)");
+	dup_index = 0;
 	if( is_before_first())
 		return;
 	if( at(0).item > 0 ) {
@@ -227,7 +528,7 @@ void Cursor::prev(){
 	while(true){
 		if( height == bucket_desc->height + 1 )
 			return before_first();
-		CNodePtr nap = my_txn->readable_node(at(height).pid);
+		CNodePtr nap = my_txn->readable_node(bucket_desc, at(height).pid);
 		if( at(height).item != -1 ){
 			at(height).item -= 1;
 			pa = nap.get_value(at(height).item);
@@ -247,7 +548,7 @@ void Cursor::debug_make_pages_writable(){
 	if( !fix_cursor_after_last_item() )
 		return;
 	my_txn->meta_page_dirty = true;
-	LeafPtr wr_dap(my_txn->page_size, (LeafPage *)my_txn->make_pages_writable(*this, 0));
+	LeafPtr wr_dap(my_txn->page_layout_size, (LeafPage *)my_txn->make_pages_writable(*this, 0), bucket_desc->get_options());
 }
 
 void Cursor::debug_check_cursor_path_up(){
@@ -256,7 +557,7 @@ void Cursor::debug_check_cursor_path_up(){
 		return;
 	for(size_t i = 0; i != bucket_desc->height; ++i){
 		auto path_pa = path.at(i+1);
-		CNodePtr nap = my_txn->readable_node(path_pa.pid);
+		CNodePtr nap = my_txn->readable_node(bucket_desc, path_pa.pid);
 		ass(path_pa.item < nap.size(), "check cursor failed");
 		Pid pa = nap.get_value(path_pa.item);
 		ass(pa == path.at(i).pid, "check cursor failed 2");
@@ -30,11 +30,23 @@ namespace mustela {
 		void first(); // sets to end(), if db is empty
 		void last(); // sets to end(), if db is empty
 		
-		bool get(Val * key, Val * value); // you can get from any position except end() and before_first()
+		bool get(Val * key, Val * value); // you can get from any position except end() and before_first(). key is valid until cursor is moved
 		bool del(); // If you can get, you can del. After successfull del, cursor points to the next item, or end() if it was last one
 		
+		// Writes at cursor path without seek from root, for updating while scanning
+		bool replace(const Val & value); // false at end(), cursor stays at item. Not for dupsort buckets, where value is part of key
+		void insert_here(const Val & key, const Val & value); // key must be between previous item and item at cursor (throws otherwise), cursor is set to inserted item
+		// (in dupsort buckets long values are inserted into their shared item with seek from root)
+		
 		void next(); // next from last() goes to the end(), next from end() is nop
 		void prev(); // prev from first() goes to the before_first(), prev from before_first() is nop
+
+		// Dupsort buckets only. seek sets to the first value of key, get returns key and value.
+		// Long values with the same start share one item, cursor keeps index of value in it
+		bool seek_dup(const Val & key, const Val & value); // sets to value of key and returns true if found, otherwise sets to next value or next key or end()
+		bool next_dup(); // sets to next value of the same key, returns false and does not move if it was the last one
+		size_t count_dups(); // values of key at cursor, 0 at end()
+		bool del_dup(const Val & key, const Val & value); // seek_dup + del, false if value not found
 		// for( cur.first(); cur.get(key, val) /*&& key.prefix("a", &key_tail)*/; cur.next() ) {}
 		// for( cur.last(); cur.get(key, val) /*&& key.prefix("a", &key_tail)*/; cur.prev() ) {}
 		
@@ -48,11 +60,17 @@ namespace mustela {
 		}
 		friend class TX;
 		friend class Bucket;
-		explicit Cursor(TX * my_txn, BucketDesc * bucket_desc, Val name);
+		friend class BulkImporter;
+		explicit Cursor(TX * my_txn, BucketDesc * bucket_desc, Val name, IntrusiveNode<Cursor> * cursor_slot = nullptr); // slot is looked up in TX if not given
 
 		TX * my_txn = nullptr;
 		BucketDesc * bucket_desc = nullptr;
+		IntrusiveNode<Cursor> * cursor_slot = nullptr; // list of cursors of our bucket in TX, copies and fix-ups use it without lookup
 		Val persistent_name; // used for mirror only for now
+		std::string key_buffer; // keys in leaves are stored without common prefix, we assemble them here
+		std::string dup_buffer; // unescaped dupsort keys, encoded keys for search
+		std::string dup_value_buffer; // long dupsort values, assembled from stored key and tail
+		size_t dup_index = 0; // of value tail in shared item of long dupsort values, 0 for other items
 
 		IntrusiveNode<Cursor> tx_cursors;
 
@@ -69,7 +87,20 @@ namespace mustela {
 		// Cursor is at end() if it is set at last leaf end
 		// To speed up Cursor construction, we define another special value for end - path.at(0).first == 0
 		
+		// Keys and values as stored in tree, for dupsort buckets key contains encoded pair and value is empty
+		bool seek_stored(const Val & key);
+		// For sorted batches, key must not be less than key of previous call. Path is reused while key stays
+		// in the same subtree. Sets node part of path, returns leaf for key, leaf item is not searched
+		Pid seek_leaf_from_previous(const Val & key);
+		bool get_stored(Val * key, Val * value);
+		void next_stored(); // by items, shared items of dupsort values are not entered
+		void prev_stored();
+		bool del_stored(); // whole item
+		size_t max_dup_stored_size()const; // dupsort pairs are cut to this size
+		size_t count_item_dups(); // values in item at cursor, 0 at end()
+		void check_dup_insert_order(const Val & key, const Val & value); // compares pairs with neighbour pairs
 		bool fix_cursor_after_last_item(); // true if points to item
+		void check_insert_order(const Val & key); // compares with neighbours only
 		void set_at_direction(size_t height, Pid pa, int dir);
 
 		void on_insert(BucketDesc * desc, size_t height, Pid pa, int insert_index, int insert_count = 1){
@@ -80,6 +111,21 @@ namespace mustela {
 		void on_erase(BucketDesc * desc, size_t height, Pid pa, int erase_index, int erase_count = 1){
 			if( bucket_desc == desc && at(height).pid == pa && at(height).item > erase_index ){
 				at(height).item -= erase_count;
+			}else if( height == 0 && bucket_desc == desc && at(height).pid == pa && at(height).item == erase_index )
+				dup_index = 0; // next item is at our index now
+		}
+		void on_insert_dup(BucketDesc * desc, Pid pa, int item, size_t insert_index){
+			if( bucket_desc == desc && at(0).pid == pa && at(0).item == item && dup_index >= insert_index )
+				dup_index += 1;
+		}
+		void on_erase_dup(BucketDesc * desc, Pid pa, int item, size_t erase_index, bool erased_last){
+			if( bucket_desc != desc || at(0).pid != pa || at(0).item != item || dup_index < erase_index )
+				return;
+			if( dup_index > erase_index )
+				dup_index -= 1;
+			else if( erased_last ){ // to the next item, as after del of item
+				dup_index = 0;
+				at(0).item += 1;
 			}
 		}
 		void on_split(BucketDesc * desc, size_t height, Pid pa, Pid new_pa, int split_index, int is_node){
@@ -109,7 +155,11 @@ namespace mustela {
 				at(height + 1).item -= 1;
 			}
 		}
+		bool is_in_key_buffer(Val val)const { return val.size != 0 && val.data >= key_buffer.data() && val.data < key_buffer.data() + key_buffer.size(); }
+		bool is_in_value_buffer(Val val)const { return val.size != 0 && val.data >= dup_value_buffer.data() && val.data < dup_value_buffer.data() + dup_value_buffer.size(); }
+		void on_erase_subtree(BucketDesc * desc, size_t height, Pid pa, int erase_index); // node is already without subtree
 		bool is_before_first()const { return path.at(0).pid == 0; }
+		bool is_at_bucket_end()const; // leaf item is after last and all node items are last
 	};
 }
 
@@ -10,10 +10,12 @@
 #include <iostream>
 #include <algorithm>
 #include <memory>
+#include <atomic>
 
 using namespace mustela;
 	
 const size_t additional_granularity = 1;// 65536;  // on Windows mmapped regions should be aligned to 65536
+static std::atomic<uint64_t> transaction_serial_counter{0}; // shared by all DBs, TX at reused address gets new serial
 
 static uint64_t grow_to_granularity(uint64_t value, uint64_t page_size){
 	return ((value + page_size - 1) / page_size) * page_size;
@@ -21,6 +23,10 @@ static uint64_t grow_to_granularity(uint64_t value, uint64_t page_size){
 static uint64_t grow_to_granularity(uint64_t value, uint64_t a, uint64_t b, uint64_t c){
 	return grow_to_granularity(grow_to_granularity(grow_to_granularity(value, a), b), c);
 }
+static void advise_mapping(void * addr, size_t size, AccessAdvice advice){
+	const int advices[] = {MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL};
+	madvise(addr, size, advices[static_cast<int>(advice)]); // only advice, errors ignored
+}
 DB::FD::~FD(){
 	close(fd); fd = -1;
 }
@@ -77,6 +83,7 @@ DB::DB(const std::string & file_path, DBOptions options):fd(open(file_path.c_str
 		throw Exception("Incompatible database version");
 	if(newest_meta->pid_size != NODE_PID_SIZE)
 		throw Exception("Incompatible pid size");
+	page_checksum_size = newest_meta->page_checksums ? sizeof(uint32_t) : 0;
 	if( !get_newest_meta_page(&oldest_index, &earliest_tid, true))
 		throw Exception("Database corrupted (possibly truncated or meta pages are mismatched)");
 }
@@ -171,14 +178,19 @@ void DB::start_transaction(TX * tx){
 		std::cerr << "Freeing reader table lock " << (size_t)this << std::endl;
 	}
 	if(!tx->read_only){
+		file_size = static_cast<uint64_t>(lseek(fd.fd, 0, SEEK_END)); // writer in other process could shrink or grow file
+		if( file_size == uint64_t(-1))
+			throw Exception("file lseek SEEK_END failed");
 		grow_wr_mappings(false);
 		wr_guard = std::move(local_wr_guard);
 		wr_file_lock = std::move(local_wr_file_lock);
 	}
 	tx->c_file_ptr = c_mappings.at(0).addr;
+	tx->serial = ++transaction_serial_counter;
 	tx->wr_file_ptr = wr_mappings.empty() ? nullptr : wr_mappings.at(0).addr;
 	tx->file_page_count = file_size / page_size;
 	tx->used_mapping_size = c_mappings.at(0).end_addr;
+	tx->access_advice = options.access_advice;
 	c_mappings.at(0).ref_count += 1;
 }
 void DB::grow_transaction(TX * tx, Pid new_file_page_count){
@@ -187,8 +199,69 @@ void DB::grow_transaction(TX * tx, Pid new_file_page_count){
 	ass(!c_mappings.empty() && !wr_mappings.empty(), "Mappings should not be empty in grow_transaction");
 	grow_wr_mappings(new_file_page_count);
 	tx->c_file_ptr = c_mappings.at(0).addr;
+	tx->serial = ++transaction_serial_counter;
 	tx->wr_file_ptr = wr_mappings.at(0).addr;
 	tx->file_page_count = file_size / page_size;
+	release_transaction_advice(tx); // advice moves to new mapping
+	apply_transaction_advice(tx);
+}
+void DB::set_transaction_advice(TX * tx, AccessAdvice advice){
+	std::unique_lock<std::mutex> lock(mu);
+	release_transaction_advice(tx);
+	tx->access_advice = advice;
+	tx->serial = ++transaction_serial_counter; // c_file_ptr can move
+	apply_transaction_advice(tx);
+}
+DB::Mapping & DB::transaction_mapping(TX * tx){
+	if( !tx->read_only )
+		return c_mappings.at(0);
+	for(auto && ma : c_mappings)
+		if( ma.end_addr == tx->used_mapping_size )
+			return ma;
+	throw Exception("Transaction mapping not found");
+}
+void DB::apply_transaction_advice(TX * tx){
+	if( tx->access_advice == options.access_advice )
+		return;
+	Mapping & ma = transaction_mapping(tx);
+	if( ma.advice_count != 0 && ma.advice != tx->access_advice )
+		return map_transaction_own(tx, ma.end_addr); // rare, concurrent transactions want different advice
+	if( ma.advice_count == 0 ){
+		ma.advice = tx->access_advice;
+		advise_mapping(ma.addr, ma.end_addr, ma.advice);
+	}
+	ma.advice_count += 1;
+	tx->advised_mapping_size = ma.end_addr;
+}
+void DB::release_transaction_advice(TX * tx){
+	map_transaction_own(tx, 0);
+	if( tx->advised_mapping_size != 0 ){
+		for(auto && ma : c_mappings)
+			if( ma.end_addr == tx->advised_mapping_size ){
+				ma.advice_count -= 1;
+				if( ma.advice_count == 0 )
+					advise_mapping(ma.addr, ma.end_addr, options.access_advice);
+				break;
+			}
+		tx->advised_mapping_size = 0;
+	}
+	tx->c_file_ptr = transaction_mapping(tx).addr;
+}
+void DB::map_transaction_own(TX * tx, size_t size){
+	if( tx->own_mapping ){
+		munmap(tx->own_mapping, tx->own_mapping_size);
+		tx->own_mapping = nullptr;
+		tx->own_mapping_size = 0;
+	}
+	if( size == 0 )
+		return;
+	void * cm = mmap(0, size, PROT_READ, MAP_SHARED, fd.fd, 0);
+	if (cm == MAP_FAILED)
+		throw Exception("mmap PROT_READ failed");
+	advise_mapping(cm, size, tx->access_advice);
+	tx->own_mapping = (char *)cm;
+	tx->own_mapping_size = size;
+	tx->c_file_ptr = tx->own_mapping;
 }
 void DB::commit_transaction(TX * tx, MetaPage meta_page){
 	std::unique_lock<std::mutex> lock(mu);
@@ -217,6 +290,10 @@ void DB::commit_transaction(TX * tx, MetaPage meta_page){
 		high = ((high + physical_page_size - 1) / physical_page_size) *	physical_page_size;
 		msync(wr_mappings.at(0).addr + low, high - low, MS_SYNC);
 	}
+	if(options.shrink_file_on_commit){
+		shrink_file();
+		tx->file_page_count = file_size / page_size;
+	}
 }
 void DB::finish_transaction(TX * tx){
 	std::unique_lock<std::mutex> lock(mu);
@@ -226,6 +303,7 @@ void DB::finish_transaction(TX * tx){
 		 	(!tx->read_only && ma.end_addr >= tx->used_mapping_size)) {
 			ma.ref_count -= 1;
 		}
+	release_transaction_advice(tx);
 	tx->c_file_ptr = nullptr;
 	tx->wr_file_ptr = nullptr;
 	tx->file_page_count = 0;
@@ -268,10 +346,10 @@ void DB::debug_print_db(){
 	}
 }
 size_t DB::max_key_size()const{
-    return mustela::max_key_size(page_size);
+    return mustela::max_key_size(page_size - page_checksum_size);
 }
 size_t DB::max_bucket_name_size()const{
-    return mustela::max_key_size(page_size) - 1;
+    return mustela::max_key_size(page_size - page_checksum_size) - 1;
 }
 
 void DB::remove_db(const std::string & file_path){
@@ -290,6 +368,7 @@ void DB::create_db(){
 	mp->version = OUR_VERSION;
 	mp->page_size = static_cast<uint32_t>(page_size);
 	mp->pid_size = NODE_PID_SIZE;
+	mp->page_checksums = options.new_db_page_checksums ? 1 : 0;
 	mp->meta_bucket.leaf_page_count = 1;
 	mp->meta_bucket.root_page = META_PAGES_COUNT;
 	for(mp->pid = 0; mp->pid != META_PAGES_COUNT; ++mp->pid){
@@ -297,9 +376,12 @@ void DB::create_db(){
 		if( write(fd.fd, data_buf, page_size) == -1)
 			throw Exception("file write failed in create_db");
 	}
-	LeafPtr wr_dap(page_size, (LeafPage *)data_buf);
+	const size_t checksum_size = options.new_db_page_checksums ? sizeof(uint32_t) : 0;
+	LeafPtr wr_dap(page_size - checksum_size, (LeafPage *)data_buf);
 //	wr_dap.mpage()->pid = META_PAGES_COUNT;
 	wr_dap.init_dirty(0);
+	if( checksum_size != 0 )
+		pack_uint_le(data_buf + page_size - checksum_size, checksum_size, crc32c(0, data_buf, page_size - checksum_size));
 	if( write(fd.fd, data_buf, page_size) == -1)
 		throw Exception("file write failed in create_db");
 	if( fsync(fd.fd) == -1 )
@@ -319,19 +401,38 @@ void DB::grow_c_mappings() {
 		fs = std::max<uint64_t>(fs, options.minimal_mapping_size) * 128 / 64; // x1.5
 	fs = std::max<uint64_t>(fs, META_PAGES_COUNT * MAX_PAGE_SIZE); // for initial meta discovery in open_db
 	uint64_t new_fs = grow_to_granularity(fs, page_size, physical_page_size, additional_granularity);
-	void * cm = mmap(0, new_fs, PROT_READ, MAP_SHARED, fd.fd, 0);
+	const int populate = c_mappings.empty() && options.populate_on_open ? MAP_POPULATE : 0; // first mapping is made on open
+	void * cm = mmap(0, new_fs, PROT_READ, MAP_SHARED | populate, fd.fd, 0);
 	if (cm == MAP_FAILED)
 		throw Exception("mmap PROT_READ failed");
+	advise_mapping(cm, new_fs, options.access_advice);
 	c_mappings.insert(c_mappings.begin(), Mapping(new_fs, (char *)cm, wr_transaction ? 1 : 0));
 }
+void DB::shrink_file(){
+	// Readers of older meta pages do not use pages beyond their page_count, and free pages are cut from
+	// meta page_count only after no reader can see them, so file can be cut at largest page_count of all meta pages
+	Pid page_count = 0;
+	for(Pid i = 0; i != META_PAGES_COUNT; ++i){
+		const MetaPage * mp = readable_meta_page(i);
+		if( is_valid_meta(i, mp) )
+			page_count = std::max(page_count, mp->page_count);
+	}
+	// Same reserve as grow_wr_mappings adds, so we do not truncate and grow on every commit
+	uint64_t fs = std::max<uint64_t>(options.minimal_mapping_size, page_count * page_size) * 77 / 64;
+	uint64_t new_fs = grow_to_granularity(fs, page_size, physical_page_size, additional_granularity);
+	if( page_count == 0 || new_fs >= file_size )
+		return;
+	if( ftruncate(fd.fd, static_cast<off_t>(new_fs)) == -1)
+		throw Exception("failed to shrink db file using ftruncate");
+	file_size = new_fs; // mappings stay, pages beyond file end are never accessed
+}
 void DB::grow_wr_mappings(Pid new_file_page_count){
 	uint64_t fs = file_size;
 	if( new_file_page_count != 0 )
 	 	fs = std::max<uint64_t>(fs, std::max<uint64_t>(options.minimal_mapping_size, new_file_page_count * page_size)) * 77 / 64; // x1.2
 	uint64_t new_fs = grow_to_granularity(fs, page_size, physical_page_size, additional_granularity);
-	ass(wr_mappings.empty() || wr_mappings.at(0).end_addr == file_size, "latest wr mapping should be exactly at the size of file");
-	if(!wr_mappings.empty() && new_fs == file_size && wr_mappings.at(0).end_addr == new_fs)
-		return;
+	if(!wr_mappings.empty() && new_fs == file_size && wr_mappings.at(0).end_addr >= new_fs)
+		return; // after shrink_file mapping is larger than file
 	if(new_fs != file_size){
 		if( ftruncate(fd.fd, static_cast<off_t>(new_fs)) == -1)
 			throw Exception("failed to grow db file using ftruncate");
@@ -343,9 +444,12 @@ void DB::grow_wr_mappings(Pid new_file_page_count){
 		if( new_fs != file_size )
 			throw Exception("file failed to grow in grow_file");
 	}
+	if(!wr_mappings.empty() && wr_mappings.at(0).end_addr >= new_fs)
+		return grow_c_mappings();
 	void * wm = mmap(0, new_fs, PROT_READ | PROT_WRITE, MAP_SHARED, fd.fd, 0);
 	if (wm == MAP_FAILED)
 		throw Exception("mmap PROT_READ | PROT_WRITE failed");
+	advise_mapping(wm, new_fs, options.access_advice);
 	wr_mappings.insert(wr_mappings.begin(), Mapping(new_fs, (char *)wm, wr_transaction ? 1 : 0));
 	grow_c_mappings();
 }
@@ -10,11 +10,21 @@
 
 namespace mustela {
 	
+	enum class ChecksumVerification { CHECK_DATABASE, FIRST_READ }; // FIRST_READ - also when page is first read by transaction
 	struct DBOptions {
 		bool read_only = false;
 		bool meta_sync = true;
 		size_t new_db_page_size = 0; // 0 - select automatically. Used only when creating file
+		bool new_db_page_checksums = false; // Used only when creating file. Overflow values are checksummed in their leaf items
+		// Checksum takes 4 bytes at the end of each leaf and node page, so DB::max_key_size is lower (44 instead of 46 for 128-byte pages)
+		ChecksumVerification checksum_verification = ChecksumVerification::CHECK_DATABASE;
 		size_t minimal_mapping_size = 1024; // Good for test, TODO - set to larger value closer to release
+		AccessAdvice access_advice = AccessAdvice::NORMAL; // For all mappings, transactions can override with TX::set_access_advice
+		bool populate_on_open = false; // MAP_POPULATE, file is read into page cache when DB is opened
+		size_t scan_readahead_leaves = 16; // Cursors moving to next leaf prefetch next leaves of parent node and overflows of leaf, 0 - off
+		size_t dropped_pages_per_commit = 1024; // Pages of dropped buckets freed by each r/w commit, 0 - only by TX::free_dropped_pages
+		size_t check_threads = 0; // Threads of TX::check_database, 0 - hardware concurrency
+		bool shrink_file_on_commit = true; // Free pages at the end of file are cut by ftruncate, growth reserve is kept
 	};
 
 	class DB {
@@ -35,6 +45,7 @@ namespace mustela {
 		void grow_transaction(TX * tx, Pid new_file_page_count);
 		void commit_transaction(TX * tx, MetaPage meta_page);
 		void finish_transaction(TX * tx);
+		void set_transaction_advice(TX * tx, AccessAdvice advice);
 	private:
 		struct FD {
 			int fd;
@@ -51,6 +62,8 @@ namespace mustela {
 			size_t end_addr;
 			char * addr;
 			int ref_count;
+			AccessAdvice advice = AccessAdvice::NORMAL; // set by transactions, valid if advice_count != 0
+			int advice_count = 0; // transactions which set advice on this mapping
 			explicit Mapping(size_t end_addr, char * addr, int ref_count):end_addr(end_addr), addr(addr), ref_count(ref_count)
 			{}
 		};
@@ -58,6 +71,7 @@ namespace mustela {
 		FD lock_fd;
 		const DBOptions options;
 		size_t page_size = 0;
+		size_t page_checksum_size = 0; // stored at the end of leaf and node pages
 		const size_t physical_page_size; // We allow to work with smaller/larger pages when reading file from different platform (or portable variant)
 
 		std::mutex mu; // protect vars shared between all transactions
@@ -79,7 +93,12 @@ namespace mustela {
 		const MetaPage * get_newest_meta_page(Pid * oldest_meta_index, Tid * earliest_tid, bool strict)const;
 		
 		void grow_c_mappings();
+		Mapping & transaction_mapping(TX * tx); // r-tx reads through mapping it started with, w-tx through the largest
+		void apply_transaction_advice(TX * tx); // on shared mapping, private one only if shared has different advice of other tx
+		void release_transaction_advice(TX * tx); // c_file_ptr is back to shared mapping
+		void map_transaction_own(TX * tx, size_t size); // private read mapping with transaction advice
 		void grow_wr_mappings(Pid new_file_page_count);
+		void shrink_file(); // to largest page_count of valid meta pages
 
 		const MetaPage * readable_meta_page(Pid index)const;
 		MetaPage * writable_meta_page(Pid index);
@@ -14,12 +14,13 @@ namespace mustela {
 	constexpr int MIN_KEY_COUNT = 2;
 	static_assert(MIN_KEY_COUNT == 2, "Should be 2 for invariants, do not change");
 
-	constexpr uint32_t OUR_VERSION = 4;
+	constexpr uint32_t OUR_VERSION = 13;
 
 	constexpr uint64_t META_MAGIC = 0x58616c657473754d; // MustelaX in LE
 	
 	constexpr int META_PAGES_COUNT = 3; // We might end up using 2 like lmdb
 	constexpr int NODE_PID_SIZE = 5; // We use fixed number of bytes for some page references
+	constexpr size_t OVERFLOW_REF_SIZE = NODE_PID_SIZE + sizeof(Tid) + sizeof(uint32_t); // leaf value of overflow item - pid, tid, CRC32C of value (0 without page checksums)
 	
 	constexpr size_t MIN_PAGE_SIZE = 128;
 	constexpr size_t GOOD_PAGE_SIZE = 4096;
@@ -29,6 +30,8 @@ namespace mustela {
 	
 	constexpr int MAX_HEIGHT = 40; // TODO - calculate from NODE_PID_SIZE?
 	// fixed pid size allows simple logic when replacing page in node index
+
+	enum class AccessAdvice { NORMAL, RANDOM, SEQUENTIAL }; // madvise of mappings, RANDOM also turns off scan readahead
 	
 // turn on/off health checks
 	constexpr bool CLEAR_FREE_SPACE = true;
@@ -40,6 +43,8 @@ namespace mustela {
 	class TX;
 	class FreeList;
 	class Cursor;
+	class ReadIterator;
 	class Bucket;
+	class BulkImporter;
 }
 
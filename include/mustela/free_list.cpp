@@ -1,5 +1,7 @@
 #include "mustela.hpp"
 #include <iostream>
+#include <algorithm>
+#include <iterator>
 
 using namespace mustela;
 
@@ -16,6 +18,210 @@ static size_t get_max_record_packed_size(){
 	return 2*get_max_compact_size_sqlite4();
 }
 
+void ExtentSet::clear(){
+	while( !blocks.empty() )
+		remove_block(blocks.size() - 1);
+	item_count = 0;
+}
+size_t ExtentSet::find_block(Extent ex)const{
+	auto it = std::upper_bound(firsts.begin(), firsts.end(), ex);
+	return it == firsts.begin() ? 0 : static_cast<size_t>(it - firsts.begin()) - 1;
+}
+std::unique_ptr<ExtentSet::Block> ExtentSet::new_block(){
+	if( spare_blocks.empty() )
+		return std::unique_ptr<Block>(new Block());
+	std::unique_ptr<Block> block = std::move(spare_blocks.back());
+	spare_blocks.pop_back();
+	return block;
+}
+void ExtentSet::remove_block(size_t bi){
+	blocks.at(bi)->size = 0;
+	if( spare_blocks.size() < MAX_SPARE_BLOCKS )
+		spare_blocks.push_back(std::move(blocks.at(bi)));
+	blocks.erase(blocks.begin() + bi);
+	firsts.erase(firsts.begin() + bi);
+}
+bool ExtentSet::insert(Extent ex){
+	if( blocks.empty() ){
+		blocks.push_back(new_block());
+		firsts.push_back(ex);
+	}
+	size_t bi = find_block(ex);
+	Block * block = blocks[bi].get();
+	Extent * pos = std::lower_bound(block->items, block->items + block->size, ex);
+	if( pos != block->items + block->size && *pos == ex )
+		return false;
+	if( block->size == BLOCK_CAPACITY ){ // split in halves
+		std::unique_ptr<Block> right = new_block();
+		const size_t half = BLOCK_CAPACITY / 2;
+		std::copy(block->items + half, block->items + block->size, right->items);
+		right->size = block->size - half;
+		block->size = half;
+		firsts.insert(firsts.begin() + bi + 1, right->items[0]);
+		blocks.insert(blocks.begin() + bi + 1, std::move(right));
+		if( ex > firsts[bi + 1] ){
+			bi += 1;
+			block = blocks[bi].get();
+		}
+		pos = std::lower_bound(block->items, block->items + block->size, ex);
+	}
+	std::copy_backward(pos, block->items + block->size, block->items + block->size + 1);
+	*pos = ex;
+	block->size += 1;
+	item_count += 1;
+	firsts[bi] = block->items[0];
+	return true;
+}
+bool ExtentSet::erase(Extent ex){
+	if( blocks.empty() )
+		return false;
+	size_t bi = find_block(ex);
+	Block * block = blocks[bi].get();
+	Extent * end = block->items + block->size;
+	Extent * pos = std::lower_bound(block->items, end, ex);
+	if( pos == end || *pos != ex )
+		return false;
+	std::copy(pos + 1, end, pos);
+	block->size -= 1;
+	item_count -= 1;
+	if( block->size == 0 ){
+		remove_block(bi);
+		return true;
+	}
+	firsts[bi] = block->items[0];
+	// Neighbours are merged, when both fit into half of block, so blocks are not too sparse
+	if( bi != 0 && blocks[bi - 1]->size + block->size <= BLOCK_CAPACITY / 2 ){
+		bi -= 1;
+		block = blocks[bi].get();
+	}
+	if( bi + 1 != blocks.size() && block->size + blocks[bi + 1]->size <= BLOCK_CAPACITY / 2 ){
+		Block * right = blocks[bi + 1].get();
+		std::copy(right->items, right->items + right->size, block->items + block->size);
+		block->size += right->size;
+		remove_block(bi + 1);
+	}
+	return true;
+}
+bool ExtentSet::replace(Extent ex, Extent with){
+	if( blocks.empty() )
+		return false;
+	const size_t bi = find_block(ex);
+	Block * block = blocks[bi].get();
+	Extent * end = block->items + block->size;
+	Extent * pos = std::lower_bound(block->items, end, ex);
+	if( pos == end || *pos != ex )
+		return false;
+	const bool after_prev = pos == block->items ? (bi == 0 || with > blocks[bi - 1]->items[blocks[bi - 1]->size - 1]) : with > *(pos - 1);
+	const bool before_next = pos + 1 == end ? (bi + 1 == blocks.size() || with < firsts[bi + 1]) : with < *(pos + 1);
+	if( !after_prev || !before_next ){ // moves to other place
+		if( !insert(with) )
+			return false;
+		ass(erase(ex), "ExtentSet erase after insert failed");
+		return true;
+	}
+	*pos = with;
+	firsts[bi] = block->items[0];
+	return true;
+}
+bool ExtentSet::lower_bound(Extent ex, Extent * result)const{
+	if( blocks.empty() )
+		return false;
+	const size_t bi = find_block(ex);
+	const Block * block = blocks[bi].get();
+	const Extent * pos = std::lower_bound(block->items, block->items + block->size, ex);
+	if( pos != block->items + block->size ){
+		*result = *pos;
+		return true;
+	}
+	if( bi + 1 == blocks.size() )
+		return false;
+	*result = firsts[bi + 1];
+	return true;
+}
+bool ExtentSet::before(Extent ex, Extent * result)const{
+	if( blocks.empty() )
+		return false;
+	const size_t bi = find_block(ex);
+	const Block * block = blocks[bi].get();
+	const Extent * pos = std::lower_bound(block->items, block->items + block->size, ex);
+	if( pos != block->items ){
+		*result = *(pos - 1);
+		return true;
+	}
+	if( bi == 0 )
+		return false;
+	*result = blocks[bi - 1]->items[blocks[bi - 1]->size - 1];
+	return true;
+}
+bool ExtentSet::front(Extent * result)const{
+	if( blocks.empty() )
+		return false;
+	*result = firsts.front();
+	return true;
+}
+bool ExtentSet::back(Extent * result)const{
+	if( blocks.empty() )
+		return false;
+	*result = blocks.back()->items[blocks.back()->size - 1];
+	return true;
+}
+void ExtentSet::debug_test(size_t op_count){
+	// Small page range, so inserts meet existing extents, and set grows and shrinks by phases over many blocks,
+	// so blocks split, merge and replace moves extents across block boundaries
+	Random random;
+	ExtentSet set;
+	std::set<Extent> mirror;
+	auto rnd = [&](uint64_t limit){ return (random.rand() >> 33) % limit; }; // low bits of MMIX are weak
+	auto random_extent = [&](){ return Extent(rnd(BLOCK_CAPACITY * 40), rnd(4)); };
+	auto near_extent = [&](){ // existing one, if any
+		auto it = mirror.lower_bound(random_extent());
+		return it == mirror.end() ? random_extent() : *it;
+	};
+	for(size_t op = 0; op != op_count; ++op){
+		const bool growing = (op / (BLOCK_CAPACITY * 40)) % 2 == 0;
+		const uint64_t kind = rnd(100);
+		if( kind < (growing ? 50u : 15u) ){
+			Extent ex = random_extent();
+			ass(set.insert(ex) == mirror.insert(ex).second, "ExtentSet insert differs");
+		}else if( kind < 80 ){
+			Extent ex = rnd(2) ? near_extent() : random_extent();
+			ass(set.erase(ex) == (mirror.erase(ex) == 1), "ExtentSet erase differs");
+		}else if( kind < 95 ){
+			Extent ex = near_extent();
+			Extent with = rnd(2) ? Extent(ex.first, ex.second + 1 + rnd(2)) : random_extent(); // in place or moved
+			if( with == ex )
+				continue;
+			const bool expected = mirror.count(ex) == 1 && mirror.count(with) == 0;
+			if( expected ){
+				mirror.erase(ex);
+				mirror.insert(with);
+			}
+			ass(set.replace(ex, with) == expected, "ExtentSet replace differs");
+		}else if( kind < 99 ){
+			Extent ex = random_extent(), result;
+			auto it = mirror.lower_bound(ex);
+			ass(set.lower_bound(ex, &result) == (it != mirror.end()) && (it == mirror.end() || result == *it), "ExtentSet lower_bound differs");
+			ass(set.before(ex, &result) == (it != mirror.begin()) && (it == mirror.begin() || result == *std::prev(it)), "ExtentSet before differs");
+			ass(set.front(&result) == !mirror.empty() && (mirror.empty() || result == *mirror.begin()), "ExtentSet front differs");
+			ass(set.back(&result) == !mirror.empty() && (mirror.empty() || result == *mirror.rbegin()), "ExtentSet back differs");
+		}else if( rnd(100) == 0 ){
+			set.clear(); // blocks go to spare ones
+			mirror.clear();
+		}
+		ass(set.size() == mirror.size(), "ExtentSet size differs");
+		if( op % 1000 == 0 || op + 1 == op_count ){
+			auto it = mirror.begin();
+			set.for_each([&](const Extent & ex){
+				ass(it != mirror.end() && ex == *it, "ExtentSet items differ");
+				++it;
+			});
+			ass(it == mirror.end(), "ExtentSet items differ");
+			for(size_t bi = 0; bi != set.blocks.size(); ++bi)
+				ass(set.blocks[bi]->size != 0 && set.firsts[bi] == set.blocks[bi]->items[0], "ExtentSet firsts differ");
+		}
+	}
+}
+
 void MergablePageCache::clear(){
 	cache.clear();
 	record_count = 0;
@@ -29,101 +235,93 @@ Pid MergablePageCache::get_packed_page_count(size_t page_size)const{
 	return (packed_size + reduced_size - 1)/reduced_size;
 }
 
-void MergablePageCache::add_to_size_index(Pid page, Pid count){
-	auto & sitem = size_index[count];
-	bool ins = sitem.insert(page).second;
-	ass(ins, "Page is twice in size_index");
+void MergablePageCache::add_record(Pid page, Pid count){
+	ass(cache.insert(ExtentSet::Extent(page, count)), "Page is twice in cache");
+	if( update_index )
+		ass(size_index.insert(ExtentSet::Extent(count, page)), "Page is twice in size_index");
+	record_count += 1;
+	page_count += count;
+	packed_size += get_record_packed_size(page, count);
+}
+void MergablePageCache::remove_record(Pid page, Pid count){
+	ass(cache.erase(ExtentSet::Extent(page, count)), "Cache erase page failed");
+	if( update_index )
+		ass(size_index.erase(ExtentSet::Extent(count, page)), "Size index erase page failed");
+	record_count -= 1;
+	page_count -= count;
+	packed_size -= get_record_packed_size(page, count);
 }
-void MergablePageCache::remove_from_size_index(Pid page, Pid count){
-	auto siit = size_index.find(count);
-	ass(siit != size_index.end(), "Size index find count failed");
-	ass(siit->second.erase(page) == 1, "Size index erase page failed");
-	if(siit->second.empty())
-		size_index.erase(siit);
+
+void MergablePageCache::replace_record(Pid page, Pid count, Pid new_page, Pid new_count){
+	ass(cache.replace(ExtentSet::Extent(page, count), ExtentSet::Extent(new_page, new_count)), "Cache replace page failed");
+	if( update_index )
+		ass(size_index.replace(ExtentSet::Extent(count, page), ExtentSet::Extent(new_count, new_page)), "Size index replace page failed");
+	record_count -= 1;
+	page_count -= count;
+	packed_size -= get_record_packed_size(page, count);
+	record_count += 1;
+	page_count += new_count;
+	packed_size += get_record_packed_size(new_page, new_count);
 }
 
 void MergablePageCache::add_to_cache(Pid page, Pid count){
-//	if( count == 255 )
-//		std::cerr << "MergablePageCache::add_to_cache i=" << int(update_index) << " " << page << ":" << count << std::endl;
-	auto it = cache.lower_bound(page);
-	ass(it == cache.end() || it->first != page, "adding existing page to cache");
-	ass(it == cache.end() || it->first >= page + count, "adding overlapping page to cache (to the right)");
-	if(it != cache.end() && it->first == page + count){
-		if( update_index)
-			remove_from_size_index(it->first, it->second);
-		record_count -= 1;
-		page_count -= it->second;
-		packed_size -= get_record_packed_size(it->first, it->second);
-		count += it->second;
-		it = cache.erase(it);
+	ExtentSet::Extent right;
+	bool merge_right = false;
+	if( cache.lower_bound(ExtentSet::Extent(page, 0), &right) ){
+		ass(right.first != page, "adding existing page to cache");
+		ass(right.first >= page + count, "adding overlapping page to cache (to the right)");
+		merge_right = right.first == page + count;
 	}
-	if( it != cache.begin() ){
-		--it;
-		ass(it->first + it->second <= page, "adding overlapping page to cache (to the left)");
-		if( it->first + it->second == page){
-			if( update_index)
-				remove_from_size_index(it->first, it->second);
-			record_count -= 1;
-			page_count -= it->second;
-			packed_size -= get_record_packed_size(it->first, it->second);
-			page = it->first;
-			count += it->second;
-			it = cache.erase(it);
-		}
+	ExtentSet::Extent left;
+	bool merge_left = false;
+	if( cache.before(ExtentSet::Extent(page, 0), &left) ){
+		ass(left.first + left.second <= page, "adding overlapping page to cache (to the left)");
+		merge_left = left.first + left.second == page;
 	}
-	record_count += 1;
-	page_count += count;
-	packed_size += get_record_packed_size(page, count);
-	cache.insert(std::make_pair(page, count));
-	if( update_index)
-		add_to_size_index(page, count);
+	// Merged run stays at the place of neighbour in cache
+	if( merge_right && merge_left ){
+		remove_record(right.first, right.second);
+		replace_record(left.first, left.second, left.first, left.second + count + right.second);
+	}else if( merge_left )
+		replace_record(left.first, left.second, left.first, left.second + count);
+	else if( merge_right )
+		replace_record(right.first, right.second, page, count + right.second);
+	else
+		add_record(page, count);
 }
 
 void MergablePageCache::remove_from_cache(Pid page, Pid count){
-	auto it = cache.find(page);
-	ass(it != cache.end() && it->second >= count, "invalid remove from cache");
-	if( update_index )
-		remove_from_size_index(it->first, it->second);
-	if( count == it->second ){
-		record_count -= 1;
-		page_count -= it->second;
-		packed_size -= get_record_packed_size(it->first, it->second);
-		cache.erase(it);
-		return;
-	}
-	auto old_count = it->second;
-	record_count -= 1;
-	page_count -= it->second;
-	packed_size -= get_record_packed_size(it->first, it->second);
-	cache.erase(it);
-	old_count -= count;
-	page += count;
-	if( update_index )
-		add_to_size_index(page, old_count);
-	record_count += 1;
-	page_count += old_count;
-	packed_size += get_record_packed_size(page, old_count);
-	cache.insert(std::make_pair(page, old_count));
+	ExtentSet::Extent it;
+	ass(cache.lower_bound(ExtentSet::Extent(page, 0), &it) && it.first == page && it.second >= count, "invalid remove from cache");
+	if( count == it.second )
+		remove_record(it.first, it.second);
+	else // stays at the same place in cache
+		replace_record(it.first, it.second, page + count, it.second - count);
+}
+Pid MergablePageCache::peek_free_page(Pid contigous_count)const{
+	ExtentSet::Extent best;
+	if( !size_index.lower_bound(ExtentSet::Extent(contigous_count, 0), &best) )
+		return 0;
+	ExtentSet::Extent first;
+	if(contigous_count == 1 && cache.front(&first))
+		return first.first; // TODO - take from first half of file
+	return best.second;
 }
 Pid MergablePageCache::get_free_page(Pid contigous_count){
-	auto siit = size_index.lower_bound(contigous_count);
-	if( siit == size_index.end() )
+	Pid pa = peek_free_page(contigous_count);
+	if( !pa )
 		return 0;
-	Pid pa = *(siit->second.begin());
-	if(contigous_count == 1)
-		pa = cache.begin()->first; // TODO - take from first half of file
 	remove_from_cache(pa, contigous_count);
 	ass(pa >= META_PAGES_COUNT, "Meta somehow got into freelist");
 	// TODO - check tid of the page?
 	return pa;
 }
 Pid MergablePageCache::defrag_end(Pid meta_page_count){
-	if( cache.empty() )
+	ExtentSet::Extent last;
+	if( !cache.back(&last) )
 		return 0;
-	auto fit = cache.end();
-	--fit;
-	Pid last_page = fit->first;
-	Pid last_count = fit->second;
+	Pid last_page = last.first;
+	Pid last_count = last.second;
 	ass(last_page + last_count <= meta_page_count, "free list spans last page");
 	if( last_page + last_count != meta_page_count)
 		return 0;
@@ -132,11 +330,11 @@ Pid MergablePageCache::defrag_end(Pid meta_page_count){
 }
 void MergablePageCache::debug_print_db()const{
 	int counter = 0;
-	for(auto && it : cache){
+	cache.for_each([&](const ExtentSet::Extent & it){
 		if( counter != 0 && counter++ % 10 == 0)
 			std::cerr << std::endl;
 		std::cerr << "[" << it.first << ":" << it.second << "] ";
-	}
+	});
 	std::cerr << std::endl;
 }
 
@@ -164,7 +362,7 @@ void MergablePageCache::fill_packed_pages(TX * tx, Tid tid, const std::vector<MV
 	ass(space_index < all_space.size(), "No space to save free list, though  enough space was allocated");
 	MVal space = all_space.at(space_index);
 	ass(space.size >= get_max_record_packed_size(), "Must have place for at least 1 record in space item");
-	for(auto && pa : cache){
+	cache.for_each([&](const ExtentSet::Extent & pa){
 		const Pid pid = pa.first;
 		const Pid count = pa.second;
 		if(space.size < get_max_record_packed_size()){
@@ -178,7 +376,7 @@ void MergablePageCache::fill_packed_pages(TX * tx, Tid tid, const std::vector<MV
 		size_t s2 = write_u64_sqlite4(count, space.data + s1);
 		space.data += s1 + s2;
 		space.size -= s1 + s2;
-	}
+	});
 	memset(space.data, 0, CLEAR_FREE_SPACE ? space.size : std::min<size_t>(2, space.size));
 	space_index += 1;
 	for(;space_index < all_space.size(); space_index += 1){
@@ -188,11 +386,50 @@ void MergablePageCache::fill_packed_pages(TX * tx, Tid tid, const std::vector<MV
 }
 
 void MergablePageCache::merge_from(const MergablePageCache & other){
-	for(auto && pa : other.cache){
-		Pid pid = pa.first;
-		Pid count = pa.second;
-		add_to_cache(pid, count);
+	other.cache.for_each([&](const ExtentSet::Extent & pa){
+		add_to_cache(pa.first, pa.second);
+	});
+}
+
+void PageBitmap::add(Pid page, Pid count){
+	ass(page + count <= page_count, "page beyond end of file");
+	for(Pid pa = page; pa != page + count; ++pa){
+		uint64_t & word = words[pa / 64];
+		const uint64_t bit = uint64_t(1) << (pa % 64);
+		ass((word & bit) == 0, "page used twice");
+		word |= bit;
+	}
+	size += count;
+}
+void PageBitmap::add_from(const MergablePageCache & other){
+	other.cache.for_each([&](const ExtentSet::Extent & pa){
+		add(pa.first, pa.second);
+	});
+}
+void PageBitmap::merge_from(const PageBitmap & other){
+	ass(page_count == other.page_count, "merging bitmaps of different size");
+	for(size_t i = 0; i != words.size(); ++i){
+		ass((words[i] & other.words[i]) == 0, "page used twice");
+		words[i] |= other.words[i];
+	}
+	size += other.size;
+}
+void PageBitmap::debug_print_db()const{
+	int counter = 0;
+	for(Pid pa = 0; pa != page_count; ){
+		if( !contains(pa) ){
+			pa += 1;
+			continue;
+		}
+		Pid count = 1;
+		for(; pa + count != page_count && contains(pa + count); ++count)
+			;
+		std::cerr << "[" << pa << ":" << count << "] ";
+		if( ++counter % 10 == 0 )
+			std::cerr << std::endl;
+		pa += count;
 	}
+	std::cerr << std::endl;
 }
 
 static const Val freelist_prefix("f", 1);
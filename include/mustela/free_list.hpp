@@ -4,11 +4,50 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <memory>
 #include "pages.hpp"
 
 namespace mustela {
 
-	// TODO - get rid of std::map and use simpler tree impl
+	// Sorted set of (Pid, Pid) pairs, compared lexicographically. Two-level B-tree - pairs are in blocks of fixed capacity,
+	// binary search goes over first pairs of blocks, then inside one block. Operations move pairs of one block only,
+	// blocks are allocated only on split (or reused from spare ones)
+	class ExtentSet {
+	public:
+		typedef std::pair<Pid, Pid> Extent;
+		bool empty()const { return item_count == 0; }
+		size_t size()const { return item_count; }
+		void clear();
+		bool insert(Extent ex); // false if already in set
+		bool erase(Extent ex); // false if not in set
+		bool replace(Extent ex, Extent with); // in place, if order allows, false if ex not in set or with is already in set
+		bool lower_bound(Extent ex, Extent * result)const; // first >= ex, false if none
+		bool before(Extent ex, Extent * result)const; // last < ex, false if none
+		bool front(Extent * result)const;
+		bool back(Extent * result)const;
+		template<class F>
+		void for_each(F && f)const {
+			for(auto && block : blocks)
+				for(size_t i = 0; i != block->size; ++i)
+					f(block->items[i]);
+		}
+		static void debug_test(size_t op_count); // random operations compared with std::set, throws on difference
+	private:
+		enum { BLOCK_CAPACITY = 128, MAX_SPARE_BLOCKS = 64 };
+		struct Block {
+			size_t size = 0;
+			Extent items[BLOCK_CAPACITY];
+		};
+		std::vector<Extent> firsts; // firsts[i] == blocks[i]->items[0], search does not touch blocks
+		std::vector<std::unique_ptr<Block>> blocks;
+		std::vector<std::unique_ptr<Block>> spare_blocks;
+		size_t item_count = 0;
+
+		size_t find_block(Extent ex)const; // last block with first <= ex, or 0
+		std::unique_ptr<Block> new_block();
+		void remove_block(size_t bi);
+	};
+
 	class MergablePageCache {
 	public:
 		explicit MergablePageCache(bool update_index):update_index(update_index)
@@ -24,6 +63,7 @@ namespace mustela {
 		void remove_from_cache(Pid page, Pid count);
 
 		Pid get_free_page(Pid contigous_count);
+		Pid peek_free_page(Pid contigous_count)const; // page get_free_page would return, 0 if none
 		Pid defrag_end(Pid meta_page_count);
 		
 		void merge_from(const MergablePageCache & other);
@@ -33,23 +73,49 @@ namespace mustela {
 
 		void debug_print_db()const;
 	private:
+		friend class PageBitmap;
 		bool update_index;
 
-		std::map<Pid, Pid> cache;
+		ExtentSet cache; // (page, count)
 		size_t page_count = 0;
 		size_t record_count = 0;
 		size_t packed_size = 0;
-		std::map<Pid, std::set<Pid>> size_index;
+		// (count, page), lower_bound gives best fit with lowest page. Unlike add_to_cache, get_free_page did not get
+		// faster with ExtentSet (benchmark_page_cache), lookups are already one search per request. Index is kept,
+		// because without it each request for several pages would scan all records of cache for best fit
+		ExtentSet size_index;
 
-		void add_to_size_index(Pid page, Pid count);
-		void remove_from_size_index(Pid page, Pid count);
+		void add_record(Pid page, Pid count);
+		void remove_record(Pid page, Pid count);
+		void replace_record(Pid page, Pid count, Pid new_page, Pid new_count);
 	};
 	
+	// Set of pages [0..page_count) as bits, for check_database of big files. Each checker thread fills its own bitmap
+	class PageBitmap {
+	public:
+		explicit PageBitmap(Pid page_count):page_count(page_count), words((page_count + 63) / 64)
+		{}
+		Pid get_page_count()const { return page_count; }
+		size_t get_size()const { return size; } // pages in set
+		void add(Pid page, Pid count); // throws if any page is already in set or beyond page_count
+		void add_from(const MergablePageCache & other);
+		void merge_from(const PageBitmap & other); // throws if sets intersect
+		bool contains(Pid page)const { return (words.at(page / 64) >> (page % 64)) & 1; }
+
+		void debug_print_db()const;
+	private:
+		Pid page_count;
+		size_t size = 0;
+		std::vector<uint64_t> words;
+	};
+
 	class FreeList {
 	public:
 		FreeList():free_pages(true), future_pages(false)
 		{}
 		Pid get_free_page(TX * tx, Pid contigous_count, Tid oldest_read_tid, bool updating_meta_bucket);
+		Pid peek_free_page(Pid contigous_count)const { return free_pages.peek_free_page(contigous_count); } // only among loaded records
+		Pid get_free_page_count()const { return free_pages.get_page_count(); } // only among loaded records
 		void mark_free_in_future_page(Pid page, Pid count, bool is_from_current_tid);
 		void commit_free_pages(TX * tx);
 		void clear();
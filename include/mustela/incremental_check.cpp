@@ -0,0 +1,105 @@
+#include "mustela.hpp"
+#include <algorithm>
+
+using namespace mustela;
+
+void IncrementalChecker::set_position(const Position & pos){
+	position = pos;
+	walk_serial = 0; // next step starts new walk from position
+}
+size_t IncrementalChecker::step(TX & txn, size_t max_pages){
+	if( bytes_per_second != 0 ){
+		const double pages_per_second = double(bytes_per_second) / txn.page_size;
+		auto now = std::chrono::steady_clock::now();
+		if( has_last_step_time )
+			page_allowance += std::chrono::duration<double>(now - last_step_time).count() * pages_per_second;
+		else
+			page_allowance = pages_per_second; // first step gets one second
+		page_allowance = std::min(page_allowance, std::max(double(max_pages), 1.0)); // no burst after long pause
+		last_step_time = now;
+		has_last_step_time = true;
+		max_pages = std::min(max_pages, static_cast<size_t>(page_allowance));
+	}
+	if( max_pages == 0 )
+		return 0;
+	// r/w transaction can change pages between steps, so walk is restarted every step
+	if( !txn.read_only || walk_serial != txn.serial )
+		reset_walk(txn);
+	size_t checked = 0;
+	bool leaf_checked = false; // after restart nodes above position are checked again, each step must move position
+	while( true ){
+		if( !walk_desc && !start_bucket(txn) ){ // all buckets walked
+			pass_count += 1;
+			position = Position{};
+			reset_walk(txn);
+			break;
+		}
+		if( walk_stack.empty() ){
+			finish_bucket();
+			continue;
+		}
+		if( checked >= max_pages && leaf_checked )
+			break;
+		TX::CheckTask task = walk_stack.back();
+		walk_stack.pop_back();
+		const Comparator comparator = static_cast<Comparator>(walk_desc->comparator);
+		if( !position.key.empty() && task.right_limit.data && compare_keys(comparator, task.right_limit, Val(position.key)) <= 0 )
+			continue; // checked by previous steps
+		const size_t was_size = walk_pages->get_size();
+		try {
+			std::vector<TX::CheckTask> children;
+			txn.check_bucket_page(walk_desc, &walk_stat, task.pa, task.height, task.left_limit, task.right_limit, walk_pages.get(), &children);
+			walk_stack.insert(walk_stack.end(), children.rbegin(), children.rend());
+		}catch(const Exception & ex){
+			findings.push_back((position.meta ? std::string("meta bucket") : "bucket " + position.bucket) + ": " + ex.what() + " at page " + std::to_string(task.pa));
+			walk_stat_valid = false;
+		}
+		checked += std::max<size_t>(1, walk_pages->get_size() - was_size); // with overflow pages
+		if( task.height == 0 ){
+			leaf_checked = true;
+			if( task.right_limit.data )
+				position.key = task.right_limit.to_string();
+		}
+	}
+	if( bytes_per_second != 0 )
+		page_allowance = std::max(0.0, page_allowance - checked);
+	return checked;
+}
+void IncrementalChecker::reset_walk(TX & txn){
+	walk_serial = txn.serial;
+	walk_desc = nullptr;
+	walk_stack.clear();
+	walk_pages.reset(new PageBitmap(txn.meta_page.page_count));
+}
+bool IncrementalChecker::start_bucket(TX & txn){
+	if( position.meta )
+		walk_desc = &txn.meta_page.meta_bucket;
+	else { // bucket of position could be dropped, then we continue with the next one
+		std::vector<Val> names = txn.get_bucket_names();
+		auto nit = std::lower_bound(names.begin(), names.end(), position.bucket, [](const Val & a, const std::string & b){ return a.to_string() < b; });
+		if( nit == names.end() )
+			return false;
+		if( nit->to_string() != position.bucket ){
+			position.bucket = nit->to_string();
+			position.key.clear();
+		}
+		Val persistent_name;
+		walk_desc = txn.load_bucket_desc(*nit, &persistent_name, false);
+		ass(walk_desc, "Bucket from get_bucket_names not found in IncrementalChecker::start_bucket");
+	}
+	walk_stat = BucketDesc{};
+	walk_stat_valid = position.key.empty();
+	walk_stack.push_back(TX::CheckTask{walk_desc, walk_desc->root_page, walk_desc->height, Val(), Val()}); // no limits at root
+	return true;
+}
+void IncrementalChecker::finish_bucket(){
+	if( walk_stat_valid && !(walk_stat.count == walk_desc->count && walk_stat.leaf_page_count == walk_desc->leaf_page_count &&
+		walk_stat.node_page_count == walk_desc->node_page_count && walk_stat.overflow_page_count == walk_desc->overflow_page_count) )
+		findings.push_back((position.meta ? std::string("meta bucket") : "bucket " + position.bucket) + ": Bucket stats differ");
+	if( position.meta )
+		position.meta = false;
+	else
+		position.bucket.push_back('\0'); // smallest name after this one
+	position.key.clear();
+	walk_desc = nullptr;
+}
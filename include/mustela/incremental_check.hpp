@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "pages.hpp"
+#include "free_list.hpp"
+#include "tx.hpp"
+
+namespace mustela {
+
+	// Checks database in small steps, so it can run all the time. Buckets are walked (meta bucket first) with
+	// the same invariants as TX::check_database, each step continues from position where previous step stopped.
+	// Inside one read-only transaction steps continue walk without new descents, pages used twice and bucket stats
+	// are verified. In other transaction walk restarts from position key, stats of partially walked bucket are not verified.
+	// Free list is not walked, pages lost from it are found only by TX::check_database
+	class IncrementalChecker {
+	public:
+		struct Position {
+			bool meta = true; // meta bucket is walked first
+			std::string bucket; // name, if not meta
+			std::string key; // stored key from which next step starts, empty - from the start of bucket
+		};
+		explicit IncrementalChecker(size_t bytes_per_second = 0):bytes_per_second(bytes_per_second) // 0 - no rate limit
+		{}
+		// Checks at most max_pages pages (less if rate limit is set), returns count of checked pages.
+		// Findings do not throw, they are collected
+		size_t step(TX & txn, size_t max_pages);
+
+		const Position & get_position()const { return position; } // can be saved to continue after restart
+		void set_position(const Position & pos);
+		size_t get_pass_count()const { return pass_count; } // finished walks of all buckets
+		const std::vector<std::string> & get_findings()const { return findings; } // found so far
+		void clear_findings(){ findings.clear(); }
+	private:
+		size_t bytes_per_second;
+		double page_allowance = 0; // rate limit, accumulated between steps
+		std::chrono::steady_clock::time_point last_step_time;
+		bool has_last_step_time = false;
+
+		Position position;
+		size_t pass_count = 0;
+		std::vector<std::string> findings;
+
+		// Walk is valid only inside one read-only transaction, while its mapping stays, walk_stack limits point into pages
+		uint64_t walk_serial = 0; // TX::serial, 0 - no walk
+		const BucketDesc * walk_desc = nullptr; // nullptr - bucket of position is not started
+		std::vector<TX::CheckTask> walk_stack; // subtrees to check in current bucket, next at back
+		BucketDesc walk_stat{};
+		bool walk_stat_valid = false; // bucket is walked from the start in this transaction
+		std::unique_ptr<PageBitmap> walk_pages; // used by walked pages in this transaction
+
+		void reset_walk(TX & txn);
+		bool start_bucket(TX & txn); // at position or next existing bucket, false if no buckets left
+		void finish_bucket();
+	};
+}
@@ -8,6 +8,9 @@
 #include <chrono>
 #include <thread>
 #include <iomanip>
+#include <numeric>
+#include <fcntl.h>
+#include <unistd.h>
 #include "mustela.hpp"
 #include "testing.hpp"
 extern "C" {
@@ -162,19 +165,89 @@ void run_bank(const std::string & db_path){
 	}
 }
 
-void run_benchmark(const std::string & db_path){
+void run_scan(const std::string & db_path){
+	// Full scans of existing DB (made by --benchmark) with file evicted from page cache before each pass
+	const char * advice_names[] = {"normal", "random", "sequential"};
+	struct ScanPass {
+		size_t readahead;
+		AccessAdvice advice;
+		size_t partitions; // 0 - single ReadIterator
+	};
+	const ScanPass passes[] = {{0, AccessAdvice::NORMAL, 0}, {DBOptions{}.scan_readahead_leaves, AccessAdvice::NORMAL, 0},
+		{0, AccessAdvice::SEQUENTIAL, 0}, {0, AccessAdvice::RANDOM, 0}, {DBOptions{}.scan_readahead_leaves, AccessAdvice::NORMAL, 4}};
+	for(auto && pass : passes){
+		const size_t readahead = pass.readahead;
+		int fd = open(db_path.c_str(), O_RDONLY);
+		if( fd == -1 || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0 )
+			std::cout << "Failed to evict DB from page cache" << std::endl;
+		if( fd != -1 )
+			close(fd);
+		auto idea_start  = std::chrono::high_resolution_clock::now();
+		DBOptions options;
+		options.read_only = true;
+		options.scan_readahead_leaves = readahead;
+		options.access_advice = pass.advice;
+		DB db(db_path, options);
+		TX txn(db, true);
+		size_t scanned = 0;
+		for(auto && name : txn.get_bucket_names()){
+			if( pass.partitions != 0 ){
+				std::vector<size_t> counts(pass.partitions);
+				txn.get_bucket(name, false).scan_partitions(pass.partitions, [&](size_t partition, const Val &, const Val &){ counts.at(partition) += 1; });
+				scanned += std::accumulate(counts.begin(), counts.end(), size_t(0));
+				continue;
+			}
+			ReadIterator it = txn.get_bucket(name, false).get_read_iterator();
+			Val c_key, c_value;
+			for(it.first(); it.get(&c_key, &c_value); it.next())
+				scanned += 1;
+		}
+		auto idea_ms =
+		    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+		std::cout << "Cold scan of " << scanned << " items, readahead=" << readahead << " leaves, advice=" << advice_names[static_cast<int>(pass.advice)] << ", partitions=" << pass.partitions << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+	for(size_t check_threads : {size_t(1), size_t(0)}){ // file is in page cache after scans
+		auto idea_start  = std::chrono::high_resolution_clock::now();
+		DBOptions options;
+		options.read_only = true;
+		options.check_threads = check_threads;
+		DB db(db_path, options);
+		TX txn(db, true);
+		txn.check_database(nullptr, false);
+		auto idea_ms =
+		    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+		std::cout << "Check of DB, threads=" << (check_threads == 0 ? std::thread::hardware_concurrency() : check_threads) << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+}
+
+void run_benchmark(const std::string & db_path, bool page_checksums){
 	DB::remove_db(db_path);
 	DBOptions options;
+	options.new_db_page_checksums = page_checksums;
+	if( page_checksums )
+		options.checksum_verification = ChecksumVerification::FIRST_READ;
 	options.minimal_mapping_size = 16*1024*1024;
 	options.new_db_page_size = 4096;
 	DB db(db_path, options);
 
 	const int TEST_COUNT = DEBUG_MIRROR ? 2500 : 1000000;
+	// Same data in bucket without and with key head cache, and with fixed size items
+	struct BenchmarkBucket {
+		const char * name;
+		size_t key_head_size;
+		size_t key_size;
+		size_t value_size;
+	};
+	const BenchmarkBucket buckets[] = {{"main", 0, 0, 0}, {"main_heads", 4, 0, 0}, {"main_fixed", 0, 32, 32}};
 
-	{
+	for(auto && bu : buckets){
 	auto idea_start  = std::chrono::high_resolution_clock::now();
 	TX txn(db);
-	Bucket main_bucket = txn.get_bucket(Val("main"));
+	BucketOptions bucket_options;
+	bucket_options.key_head_size = bu.key_head_size;
+	bucket_options.key_size = bu.key_size;
+	bucket_options.value_size = bu.value_size;
+	Bucket main_bucket = txn.get_bucket(Val(bu.name), true, bucket_options);
 	uint8_t keybuf[32] = {};
 	for(unsigned i = 0; i != TEST_COUNT; ++i){
 		unsigned hv = i * 2;
@@ -187,16 +260,123 @@ void run_benchmark(const std::string & db_path){
 	txn.commit();
 	auto idea_ms =
 	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
-	std::cout << "Random insert of " << TEST_COUNT << " hashes, seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	std::cout << "Random insert of " << TEST_COUNT << " hashes, bucket=" << bu.name << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
 	txn.check_database([](int progress){
 		std::cout << "Checking... " << progress << "%" << std::endl;
 	}, true);
 	std::cout << "DB passed all validity checks" << std::endl;
 	}
-	{
+	for(bool use_append : {false, true}){ // Sequential keys, like auto-increment ids
 	auto idea_start  = std::chrono::high_resolution_clock::now();
 	TX txn(db);
-	Bucket main_bucket = txn.get_bucket(Val("main"));
+	Bucket seq_bucket = txn.get_bucket(Val(use_append ? "seq_append" : "seq_put"));
+	uint8_t keybuf[8] = {};
+	for(unsigned i = 0; i != TEST_COUNT; ++i){
+		pack_uint_be(keybuf, sizeof(keybuf), i);
+		if( use_append )
+			seq_bucket.append(Val(keybuf, sizeof(keybuf)), Val(keybuf, sizeof(keybuf)));
+		else
+			seq_bucket.put(Val(keybuf, sizeof(keybuf)), Val(keybuf, sizeof(keybuf)), false);
+	}
+	txn.commit();
+	auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	std::cout << "Sequential " << (use_append ? "append" : "put") << " of " << TEST_COUNT << " keys, seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	txn.check_database([](int progress){
+		std::cout << "Checking... " << progress << "%" << std::endl;
+	}, true);
+	std::cout << "DB passed all validity checks" << std::endl;
+	}
+	for(bool use_range : {false, true}){ // Pruning old half of sequential keys
+	auto idea_start  = std::chrono::high_resolution_clock::now();
+	TX txn(db);
+	Bucket seq_bucket = txn.get_bucket(Val(use_range ? "seq_append" : "seq_put"));
+	uint8_t from_buf[8] = {};
+	uint8_t to_buf[8] = {};
+	pack_uint_be(to_buf, sizeof(to_buf), TEST_COUNT / 2);
+	size_t deleted = 0;
+	if( use_range )
+		deleted = seq_bucket.del_range(Val(from_buf, sizeof(from_buf)), Val(to_buf, sizeof(to_buf)));
+	else{
+		Cursor cur = seq_bucket.get_cursor();
+		Val c_key, c_value;
+		for(cur.first(); cur.get(&c_key, &c_value) && c_key < Val(to_buf, sizeof(to_buf)); ++deleted)
+			cur.del();
+	}
+	txn.commit();
+	auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	std::cout << (use_range ? "Range delete" : "Cursor delete") << " of " << deleted << " sequential keys, seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	txn.check_database([](int progress){
+		std::cout << "Checking... " << progress << "%" << std::endl;
+	}, true);
+	std::cout << "DB passed all validity checks" << std::endl;
+	}
+	for(size_t idle_count : {0, 1000, 10000}){ // Open cursors of other buckets must not slow down writes
+	TX txn(db);
+	Bucket idle_bucket = txn.get_bucket(Val("idle"));
+	idle_bucket.put(Val("key"), Val("value"), false);
+	std::vector<Cursor> idle_cursors(idle_count, idle_bucket.get_cursor());
+	for(auto && cur : idle_cursors)
+		cur.first();
+	auto idea_start  = std::chrono::high_resolution_clock::now();
+	Bucket write_bucket = txn.get_bucket(Val("idle_writes_" + std::to_string(idle_count)));
+	uint8_t keybuf[32] = {};
+	for(unsigned i = 0; i != TEST_COUNT / 10; ++i){
+		auto ctx = blake2b_ctx{};
+		blake2b_init(&ctx, 32, nullptr, 0);
+		blake2b_update(&ctx, &i, sizeof(i));
+		blake2b_final(&ctx, &keybuf);
+		write_bucket.put(Val(keybuf, 32), Val(keybuf, 32), false);
+	}
+	auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	idle_cursors.clear();
+	txn.commit();
+	std::cout << "Random insert of " << TEST_COUNT / 10 << " hashes with " << idle_count << " idle cursors, seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+	for(bool use_iterator : {false, true}){ // Read-only scans and seeks, each seek with new cursor
+	auto idea_start  = std::chrono::high_resolution_clock::now();
+	TX txn(db, true);
+	Bucket main_bucket = txn.get_bucket(Val("main"), false);
+	size_t scanned = 0;
+	Val c_key, c_value;
+	for(int pass = 0; pass != 5; ++pass)
+		if( use_iterator ){
+			ReadIterator it = main_bucket.get_read_iterator();
+			for(it.first(); it.get(&c_key, &c_value); it.next())
+				scanned += 1;
+		}else{
+			Cursor cur = main_bucket.get_cursor();
+			for(cur.first(); cur.get(&c_key, &c_value); cur.next())
+				scanned += 1;
+		}
+	auto scan_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	uint8_t keybuf[32] = {};
+	for(unsigned i = 0; i != TEST_COUNT; ++i){
+		auto ctx = blake2b_ctx{};
+		blake2b_init(&ctx, 32, nullptr, 0);
+		blake2b_update(&ctx, &i, sizeof(i));
+		blake2b_final(&ctx, &keybuf);
+		if( use_iterator ){
+			ReadIterator it = main_bucket.get_read_iterator();
+			it.seek(Val(keybuf, 32));
+			scanned += it.get(&c_key, &c_value) ? 1 : 0;
+		}else{
+			Cursor cur = main_bucket.get_cursor();
+			cur.seek(Val(keybuf, 32));
+			scanned += cur.get(&c_key, &c_value) ? 1 : 0;
+		}
+	}
+	auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	std::cout << "Read-only scans and seeks with " << (use_iterator ? "ReadIterator" : "Cursor") << ", items=" << scanned << ", scan seconds=" << double(scan_ms.count()) / 1000 << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+	for(auto && bu : buckets){
+	auto idea_start  = std::chrono::high_resolution_clock::now();
+	TX txn(db);
+	Bucket main_bucket = txn.get_bucket(Val(bu.name));
 	uint8_t keybuf[32] = {};
 	int found_counter = 0;
 	for(unsigned i = 0; i != 2 * TEST_COUNT; ++i){
@@ -209,12 +389,39 @@ void run_benchmark(const std::string & db_path){
 	}
 	auto idea_ms =
 	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
-	std::cout << "Random lookup of " << TEST_COUNT << " hashes, found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	std::cout << "Random lookup of " << TEST_COUNT << " hashes, bucket=" << bu.name << ", found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
 	}
-	{
+	for(auto && bu : buckets){
+	auto idea_start  = std::chrono::high_resolution_clock::now();
+	TX txn(db);
+	Bucket main_bucket = txn.get_bucket(Val(bu.name));
+	const size_t BATCH_SIZE = 1000;
+	std::vector<std::string> batch_keys;
+	std::vector<Val> keys, values;
+	size_t found_counter = 0;
+	for(unsigned i = 0; i != 2 * TEST_COUNT; ++i){
+		uint8_t keybuf[32] = {};
+		auto ctx = blake2b_ctx{};
+		blake2b_init(&ctx, 32, nullptr, 0);
+		blake2b_update(&ctx, &i, sizeof(i));
+		blake2b_final(&ctx, &keybuf);
+		batch_keys.push_back(std::string(reinterpret_cast<const char *>(keybuf), 32));
+		if( batch_keys.size() != BATCH_SIZE && i + 1 != 2 * TEST_COUNT )
+			continue;
+		keys.clear();
+		for(auto && key : batch_keys)
+			keys.push_back(Val(key));
+		found_counter += main_bucket.get_many(keys, &values);
+		batch_keys.clear();
+	}
+	auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	std::cout << "Random batch lookup of " << TEST_COUNT << " hashes, bucket=" << bu.name << ", found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+	for(auto && bu : buckets){
 	auto idea_start  = std::chrono::high_resolution_clock::now();
 	TX txn(db);
-	Bucket main_bucket = txn.get_bucket(Val("main"));
+	Bucket main_bucket = txn.get_bucket(Val(bu.name));
 	uint8_t keybuf[32] = {};
 	int found_counter = 0;
 	for(unsigned i = 0; i != 2 * TEST_COUNT; ++i){
@@ -228,7 +435,7 @@ void run_benchmark(const std::string & db_path){
 	txn.commit();
 	auto idea_ms =
 	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
-	std::cout << "Random delete of " << TEST_COUNT << " hashes, found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	std::cout << "Random delete of " << TEST_COUNT << " hashes, bucket=" << bu.name << ", found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
 	txn.check_database([](int progress){
 		std::cout << "Checking... " << progress << "%" << std::endl;
 	}, true);
@@ -236,6 +443,40 @@ void run_benchmark(const std::string & db_path){
 	}
 }
 
+void run_import(const std::string & db_path, size_t count, bool page_checksums){
+	DB::remove_db(db_path);
+	DBOptions options;
+	options.new_db_page_checksums = page_checksums;
+	options.minimal_mapping_size = 16*1024*1024;
+	options.new_db_page_size = 4096;
+	DB db(db_path, options);
+
+	auto idea_start  = std::chrono::high_resolution_clock::now();
+	TX txn(db);
+	BulkImportOptions import_options;
+	import_options.memory_budget = DEBUG_MIRROR ? 64*1024 : 256*1024*1024; // several runs even in debug
+	BulkImporter importer(txn, Val("import"), BucketOptions{}, import_options);
+	uint8_t keybuf[32] = {};
+	for(size_t i = 0; i != count; ++i){
+		auto ctx = blake2b_ctx{};
+		blake2b_init(&ctx, 32, nullptr, 0);
+		blake2b_update(&ctx, &i, sizeof(i));
+		blake2b_final(&ctx, &keybuf);
+		importer.add(Val(keybuf, 32), Val(keybuf, 32));
+	}
+	importer.finish();
+	txn.commit();
+	auto idea_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+	std::cout << "Bulk import of " << count << " hashes, runs=" << importer.get_run_count() << ", sort seconds=" << importer.get_sort_seconds() <<
+		", build seconds=" << importer.get_build_seconds() << ", seconds=" << double(idea_ms.count()) / 1000 <<
+		", records/s=" << std::fixed << std::setprecision(0) << count / std::max(0.001, double(idea_ms.count()) / 1000) << std::endl;
+	txn.check_database([](int progress){
+		std::cout << "Checking... " << progress << "%" << std::endl;
+	}, true);
+	std::cout << "DB passed all validity checks" << std::endl;
+}
+
 static size_t count_zeroes(uint64_t val){
 	for(size_t i = 0; i != sizeof(val)*8; ++i)
 		if((val & (1 << i)) != 0)
@@ -455,6 +696,41 @@ void benchmark_stdset(size_t TEST_COUNT){
 		std::cout << "std::set delete of " << TEST_COUNT << " hashes, found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
 	}
 }
+// typical results, -O2, std::map with std::set size index vs ExtentSet
+// page cache add of 1000000 runs, pages 2500000, seconds=3.04 vs 1.37
+// page cache get_free_page of 1000000 runs, found 1000000, seconds=0.41 vs 0.46
+void benchmark_page_cache(size_t TEST_COUNT){
+	// Like big commit - scattered runs are freed (some of them merge), then allocated by get_free_page of different sizes
+	Random random;
+	MergablePageCache cache(true);
+	std::vector<Pid> pages(TEST_COUNT);
+	for(size_t i = 0; i != TEST_COUNT; ++i)
+		pages[i] = META_PAGES_COUNT + 4 * i;
+	for(size_t i = TEST_COUNT; i > 1; --i)
+		std::swap(pages[i - 1], pages[random.rand() % i]);
+	{
+		auto idea_start  = std::chrono::high_resolution_clock::now();
+		for(auto && pa : pages)
+			cache.add_to_cache(pa, 1 + random.rand() % 4); // runs of 4 merge with the next one
+		auto idea_ms =
+			std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+		std::cout << "page cache add of " << TEST_COUNT << " runs, pages " << cache.get_page_count() << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+	{
+		size_t found_counter = 0;
+		auto idea_start  = std::chrono::high_resolution_clock::now();
+		for(size_t i = 0; i != TEST_COUNT; ++i){
+			Pid count = (i % 4 == 0) ? 1 + random.rand() % 8 : 1;
+			Pid pa = cache.get_free_page(count);
+			if( pa != 0 && i % 2 == 0 ) // half of pages are freed again during commit
+				cache.add_to_cache(pa, count);
+			found_counter += (pa != 0);
+		}
+		auto idea_ms =
+			std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - idea_start);
+		std::cout << "page cache get_free_page of " << TEST_COUNT << " runs, found " << found_counter << ", seconds=" << double(idea_ms.count()) / 1000 << std::endl;
+	}
+}
 // typical benchmark
 // skiplist insert of 1000000 hashes, inserted 632459, seconds=1.486
 // skiplist get of 1000000 hashes, hops 37.8428, seconds=1.428
@@ -481,6 +757,18 @@ int main(int argc, char * argv[]){
 	std::string benchmark;
 	std::string scenario;
 	std::string bank;
+	std::string import;
+	std::string scan;
+	size_t import_count = DEBUG_MIRROR ? 2500 : 1000000;
+	bool page_checksums = false;
+	for(int i = 1; i < argc; ++i)
+		if(std::string(argv[i]) == "--checksums")
+			page_checksums = true;
+	for(int i = 1; i < argc; ++i)
+		if(std::string(argv[i]) == "--page-cache-benchmark"){
+			benchmark_page_cache(1000000);
+			return 0;
+		}
 	for(int i = 1; i < argc - 1; ++i){
 		if(std::string(argv[i]) == "--test")
 			test = argv[i+1];
@@ -490,6 +778,12 @@ int main(int argc, char * argv[]){
 			benchmark = argv[i+1];
 		if(std::string(argv[i]) == "--bank")
 			bank = argv[i+1];
+		if(std::string(argv[i]) == "--import")
+			import = argv[i+1];
+		if(std::string(argv[i]) == "--scan")
+			scan = argv[i+1];
+		if(std::string(argv[i]) == "--import-count")
+			import_count = std::stoull(argv[i+1]);
 	}
 	if(!bank.empty()){
 		std::vector<std::thread> threads;
@@ -498,16 +792,24 @@ int main(int argc, char * argv[]){
 		run_bank(bank);
 		return 0;
 	}
+	if(!import.empty()){
+		run_import(import, import_count, page_checksums);
+		return 0;
+	}
+	if(!scan.empty()){
+		run_scan(scan);
+		return 0;
+	}
 	if(!benchmark.empty()){
-		run_benchmark(benchmark);
+		run_benchmark(benchmark, page_checksums);
 		return 0;
 	}
 	if(!test.empty()){
 		if(!scenario.empty()){
 	    	auto f = std::ifstream(scenario);
-			run_test_driver(test, f);
+			run_test_driver(test, f, page_checksums);
 		}else
-			run_test_driver(test, std::cin);
+			run_test_driver(test, std::cin, page_checksums);
 		return 0;
 	}
 	
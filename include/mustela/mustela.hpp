@@ -4,3 +4,6 @@
 #include "tx.hpp"
 #include "bucket.hpp"
 #include "cursor.hpp"
+#include "read_iterator.hpp"
+#include "bulk_import.hpp"
+#include "incremental_check.hpp"
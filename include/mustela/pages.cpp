@@ -1,6 +1,10 @@
 #include "pages.hpp"
 #include <map>
+#include <algorithm>
 #include <iostream>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace mustela;
 	
@@ -21,6 +25,13 @@ void BucketDesc::unpack(const char * buf, size_t size){
 	buf += unpack_uint_le(buf, sizeof(leaf_page_count), leaf_page_count);
 	buf += unpack_uint_le(buf, sizeof(node_page_count), node_page_count);
 	buf += unpack_uint_le(buf, sizeof(overflow_page_count), overflow_page_count);
+	buf += unpack_uint_le(buf, sizeof(key_head_size), key_head_size);
+	buf += unpack_uint_le(buf, sizeof(key_size), key_size);
+	buf += unpack_uint_le(buf, sizeof(value_size), value_size);
+	buf += unpack_uint_le(buf, sizeof(comparator), comparator);
+	buf += unpack_uint_le(buf, sizeof(dupsort), dupsort);
+	buf += unpack_uint_le(buf, sizeof(fill_percent), fill_percent);
+	buf += unpack_uint_le(buf, sizeof(merge_percent), merge_percent);
 }
 void BucketDesc::pack(char * buf, size_t size){
 	ass(size == sizeof(BucketDesc), "Wrong size of BucketDesc in pack");
@@ -30,6 +41,13 @@ void BucketDesc::pack(char * buf, size_t size){
 	buf += pack_uint_le(buf, sizeof(leaf_page_count), leaf_page_count);
 	buf += pack_uint_le(buf, sizeof(node_page_count), node_page_count);
 	buf += pack_uint_le(buf, sizeof(overflow_page_count), overflow_page_count);
+	buf += pack_uint_le(buf, sizeof(key_head_size), key_head_size);
+	buf += pack_uint_le(buf, sizeof(key_size), key_size);
+	buf += pack_uint_le(buf, sizeof(value_size), value_size);
+	buf += pack_uint_le(buf, sizeof(comparator), comparator);
+	buf += pack_uint_le(buf, sizeof(dupsort), dupsort);
+	buf += pack_uint_le(buf, sizeof(fill_percent), fill_percent);
+	buf += pack_uint_le(buf, sizeof(merge_percent), merge_percent);
 }
 
 MVal KeysPage::get_item_key(size_t page_size, int item){
@@ -52,14 +70,97 @@ Val KeysPage::get_item_key_no_check(size_t page_size, int item)const{
 Val KeysPage::get_item_key(size_t page_size, int item)const{
 	return const_cast<KeysPage *>(this)->get_item_key(page_size, item);
 }
-int KeysPage::lower_bound_item(size_t page_size, Val key, bool * found)const{
+
+// Heads are sorted, so number of heads less than value is lower bound of value
+static int count_heads_less(const char * heads, int count, size_t head_size, uint64_t value){
+	int result = 0;
+	int i = 0;
+	if( head_size == sizeof(uint32_t) ){
+		// Signed compare after flipping sign bit is unsigned compare, true lanes are -1
+#if defined(__AVX2__)
+		const __m256i bias = _mm256_set1_epi32(int(0x80000000u));
+		const __m256i val8 = _mm256_xor_si256(_mm256_set1_epi32(int(uint32_t(value))), bias);
+		__m256i acc8 = _mm256_setzero_si256();
+		for(; i + 8 <= count; i += 8){
+			__m256i h = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(heads + i * sizeof(uint32_t))), bias);
+			acc8 = _mm256_sub_epi32(acc8, _mm256_cmpgt_epi32(val8, h));
+		}
+		alignas(32) int32_t lanes8[8];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes8), acc8);
+		for(auto l : lanes8)
+			result += l;
+#endif
+#if defined(__SSE2__)
+		const __m128i bias4 = _mm_set1_epi32(int(0x80000000u));
+		const __m128i val4 = _mm_xor_si128(_mm_set1_epi32(int(uint32_t(value))), bias4);
+		__m128i acc4 = _mm_setzero_si128();
+		for(; i + 4 <= count; i += 4){
+			__m128i h = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(heads + i * sizeof(uint32_t))), bias4);
+			acc4 = _mm_sub_epi32(acc4, _mm_cmplt_epi32(h, val4));
+		}
+		alignas(16) int32_t lanes4[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes4), acc4);
+		for(auto l : lanes4)
+			result += l;
+#endif
+	}
+#if defined(__AVX2__)
+	if( head_size == sizeof(uint64_t) ){
+		const __m256i bias = _mm256_set1_epi64x(int64_t(0x8000000000000000ull));
+		const __m256i val4 = _mm256_xor_si256(_mm256_set1_epi64x(int64_t(value)), bias);
+		__m256i acc4 = _mm256_setzero_si256();
+		for(; i + 4 <= count; i += 4){
+			__m256i h = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(heads + i * sizeof(uint64_t))), bias);
+			acc4 = _mm256_sub_epi64(acc4, _mm256_cmpgt_epi64(val4, h));
+		}
+		alignas(32) int64_t lanes4[4];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes4), acc4);
+		for(auto l : lanes4)
+			result += static_cast<int>(l);
+	}
+#endif
+	for(; i != count; ++i){
+		uint64_t h;
+		unpack_uint_le(heads + i * head_size, head_size, h);
+		result += h < value ? 1 : 0;
+	}
+	return result;
+}
+static int lower_bound_head(const char * heads, int count, size_t head_size, uint64_t value){
+	// Binary search in dense array until window is several vectors wide, then count in window
+	int first = 0;
+	while(count > 16){
+		int step = count / 2;
+		uint64_t h;
+		unpack_uint_le(heads + (first + step) * head_size, head_size, h);
+		if( h < value ){
+			first += step + 1;
+			count -= step + 1;
+		}else
+			count = step;
+	}
+	return first + count_heads_less(heads + first * head_size, count, head_size, value);
+}
+void KeysPage::narrow_by_heads(size_t head_size, Val key, int & first, int & count)const{
+	const char * heads = item_heads();
+	const uint64_t key_head = get_key_head(key, head_size);
+	first = lower_bound_head(heads, count, head_size, key_head);
+	const uint64_t max_head = head_size == sizeof(uint64_t) ? ~uint64_t(0) : (uint64_t(1) << 8*head_size) - 1;
+	// Only items with same head need full key compare
+	int last = key_head == max_head ? count : first + lower_bound_head(heads + first * head_size, count - first, head_size, key_head + 1);
+	count = last - first;
+}
+template<class Compare>
+int KeysPage::lower_bound_item(size_t page_size, size_t head_size, Val key, bool * found)const{
 	int first = 0;
 	int count = item_count();
+	if( head_size != 0 )
+		narrow_by_heads(head_size, key, first, count);
 	while (count > 0) {
 		int step = count / 2;
 		int it = first + step;
 		Val itkey = get_item_key_no_check(page_size, it);
-		int cmp = itkey.compare(key);
+		int cmp = Compare::compare(itkey, key);
 		if( cmp == 0){
 			*found = true;
 			return it;
@@ -77,14 +178,17 @@ int KeysPage::lower_bound_item(size_t page_size, Val key, bool * found)const{
 //			*found = Val(get_item_key_no_check(page_size, first)) == key;
 	return first;
 }
-int KeysPage::upper_bound_item(size_t page_size, Val key)const{
+template<class Compare>
+int KeysPage::upper_bound_item(size_t page_size, size_t head_size, Val key)const{
 	int first = 0;
 	int count = item_count();
+	if( head_size != 0 )
+		narrow_by_heads(head_size, key, first, count);
 	while (count > 0) {
 		int step = count / 2;
 		int it = first + step;
 		Val itkey = get_item_key_no_check(page_size, it);
-		if (!(key < itkey)) {
+		if (Compare::compare(key, itkey) >= 0) {
 			first = it + 1;
 			count -= step + 1;
 		} else
@@ -92,10 +196,27 @@ int KeysPage::upper_bound_item(size_t page_size, Val key)const{
 	}
 	return first;
 }
+// Comparator is selected once per search, compares in loops are inlined
+int KeysPage::lower_bound_item(size_t page_size, size_t head_size, Comparator comparator, Val key, bool * found)const{
+	switch(comparator){
+	case Comparator::REVERSE_BYTEWISE: return lower_bound_item<ReverseBytewiseCompare>(page_size, head_size, key, found);
+	case Comparator::UINT64: return lower_bound_item<Uint64Compare>(page_size, head_size, key, found);
+	case Comparator::INT64: return lower_bound_item<Int64Compare>(page_size, head_size, key, found);
+	default: return lower_bound_item<BytewiseCompare>(page_size, head_size, key, found);
+	}
+}
+int KeysPage::upper_bound_item(size_t page_size, size_t head_size, Comparator comparator, Val key)const{
+	switch(comparator){
+	case Comparator::REVERSE_BYTEWISE: return upper_bound_item<ReverseBytewiseCompare>(page_size, head_size, key);
+	case Comparator::UINT64: return upper_bound_item<Uint64Compare>(page_size, head_size, key);
+	case Comparator::INT64: return upper_bound_item<Int64Compare>(page_size, head_size, key);
+	default: return upper_bound_item<BytewiseCompare>(page_size, head_size, key);
+	}
+}
 
-void KeysPage::erase_item(size_t page_size, int to_remove_item, size_t item_size){
+void KeysPage::erase_item(size_t page_size, size_t head_size, int to_remove_item, size_t item_size){
 	char * raw_this = (char *)this;
-	auto kv_size = item_size - sizeof(PageOffset);
+	auto kv_size = item_size - sizeof(PageOffset) - head_size;
 	if( CLEAR_FREE_SPACE )
 		memset(raw_this + item_offsets(to_remove_item), 0, kv_size); // clear unused part
 	if( item_offsets(to_remove_item) == free_end_offset() )
@@ -103,15 +224,30 @@ void KeysPage::erase_item(size_t page_size, int to_remove_item, size_t item_size
 //	for(int pos = to_remove_item; pos != item_count - 1; ++pos)
 //		item_offsets[pos] = item_offsets[pos+1];
 	memmove(static_cast<PageOffset *>(s_item_offsets) + to_remove_item, static_cast<const PageOffset *>(s_item_offsets) + to_remove_item + 1, static_cast<size_t>(item_count() - 1 - to_remove_item) * sizeof(PageOffset));
+	if( head_size != 0 ){ // heads follow offsets, so move them down
+		char * heads = item_heads();
+		const size_t before = static_cast<size_t>(to_remove_item) * head_size;
+		const size_t after = static_cast<size_t>(item_count() - 1 - to_remove_item) * head_size;
+		memmove(heads - sizeof(PageOffset), heads, before);
+		memmove(heads - sizeof(PageOffset) + before, heads + before + head_size, after);
+	}
 	set_items_size( items_size() - item_size);
 	set_item_count( item_count() - 1);
 	if( CLEAR_FREE_SPACE )
-		set_item_offsets(item_count(), 0); // clear unused part
+		memset(item_heads() + head_size * static_cast<size_t>(item_count()), 0, sizeof(PageOffset) + head_size); // clear unused part
 }
 
-MVal KeysPage::insert_item_at(size_t page_size, int insert_index, Val key, size_t item_size){
+MVal KeysPage::insert_item_at(size_t page_size, size_t head_size, int insert_index, Val key, size_t item_size){
 	char * raw_this = (char *)this;
-	auto kv_size = item_size - sizeof(PageOffset);
+	auto kv_size = item_size - sizeof(PageOffset) - head_size;
+	if( head_size != 0 ){ // heads follow offsets, so move them up
+		char * heads = item_heads();
+		const size_t before = static_cast<size_t>(insert_index) * head_size;
+		const size_t after = static_cast<size_t>(item_count() - insert_index) * head_size;
+		memmove(heads + sizeof(PageOffset) + before + head_size, heads + before, after);
+		memmove(heads + sizeof(PageOffset), heads, before);
+		pack_uint_le(heads + sizeof(PageOffset) + before, head_size, get_key_head(key, head_size));
+	}
 //	for(int pos = item_count; pos-- > insert_index;)
 //		item_offsets[pos + 1] = item_offsets[pos];
 	memmove(static_cast<PageOffset *>(s_item_offsets) + insert_index + 1, static_cast<const PageOffset *>(s_item_offsets) + insert_index, static_cast<size_t>(item_count() - insert_index) * sizeof(PageOffset));
@@ -125,9 +261,9 @@ MVal KeysPage::insert_item_at(size_t page_size, int insert_index, Val key, size_
 	return MVal(raw_this + insert_offset + keysizesize, key.size);
 }
 
-size_t mustela::get_item_size(size_t page_size, Val key, Pid value){
-	size_t item_size = sizeof(PageOffset) + get_compact_size_sqlite4(key.size) + key.size + NODE_PID_SIZE;
-	if( item_size <= node_capacity(page_size) )
+size_t CNodePtr::get_item_size(Val key, Pid value)const{
+	size_t item_size = sizeof(PageOffset) + options.key_head_size + get_compact_size_sqlite4(key.size) + key.size + NODE_PID_SIZE;
+	if( item_size <= capacity() )
 		return item_size;
 	throw std::runtime_error("Item does not fit in node");
 }
@@ -142,11 +278,11 @@ void NodePtr::init_dirty(Tid new_tid){
 	mpage()->set_free_end_offset(page_size - NODE_PID_SIZE);
 }
 void NodePtr::compact(size_t item_size){
-	if(NODE_HEADER_SIZE + sizeof(PageOffset)*static_cast<size_t>(page->item_count()) + item_size <= page->free_end_offset())
+	if( has_free_middle(item_size) )
 		return;
 	char buf[MAX_PAGE_SIZE]; // This fun is always last call in recursion, so not a problem, variable-length arrays are C99 feature
 	memcpy(buf, page, page_size);
-	CNodePtr my_copy(page_size, (NodePage *)buf);
+	CNodePtr my_copy(page_size, (NodePage *)buf, options);
 	init_dirty(page->tid());
 	set_value(-1, my_copy.get_value(-1));
 	append_range(my_copy, 0, my_copy.size());
@@ -158,7 +294,7 @@ size_t CNodePtr::get_item_size(int item)const{
 	size_t item_offset = page->item_offsets(item);
 	uint64_t keysize;
 	auto keysizesize = read_u64_sqlite4(keysize, raw_page + item_offset);
-	return sizeof(PageOffset) + keysizesize + keysize + NODE_PID_SIZE;
+	return sizeof(PageOffset) + options.key_head_size + keysizesize + keysize + NODE_PID_SIZE;
 }
 
 Pid CNodePtr::get_value(int item)const{
@@ -188,76 +324,251 @@ void NodePtr::set_value(int item, Pid value){
 	pack_uint_le(result.end(), NODE_PID_SIZE, value);
 }
 
-void LeafPtr::init_dirty(Tid new_tid){
+void LeafPtr::init_dirty(Tid new_tid, Val prefix){
 	char * raw_page = (char *)mpage();
 	if( CLEAR_FREE_SPACE )
 		memset(raw_page + LEAF_HEADER_SIZE, 0, page_size - LEAF_HEADER_SIZE);
+	ass2(prefix.size <= capacity(), "Prefix too large in LeafPtr::init_dirty", DEBUG_PAGES);
 	mpage()->set_item_count(0);
 	mpage()->set_items_size(0);
 	mpage()->set_tid(new_tid);
-	mpage()->set_free_end_offset(page_size);
+	const size_t prefix_offset = page_size - sizeof(PageOffset) - prefix.size;
+	memmove(raw_page + prefix_offset, prefix.data, prefix.size); // prefix is never in our page, but memmove is cheap
+	pack_page_object(prefix.size, raw_page + page_size - sizeof(PageOffset));
+	mpage()->set_free_end_offset(prefix_offset);
 }
 
-void LeafPtr::compact(size_t item_size){
-	if(LEAF_HEADER_SIZE + sizeof(PageOffset)*static_cast<size_t>(page->item_count()) + item_size <= page->free_end_offset())
+void LeafPtr::compact(Val insert_key, size_t item_size){
+	if(insert_key.has_prefix(get_prefix()) && has_free_middle(item_size))
 		return;
 	char buf[MAX_PAGE_SIZE]; // This fun is always last call in recursion, so not a problem, variable-length arrays are C99 feature
 	memcpy(buf, page, page_size);
-	CLeafPtr my_copy(page_size, (LeafPage *)buf);
-	init_dirty(page->tid());
+	CLeafPtr my_copy(page_size, (LeafPage *)buf, options);
+	init_dirty(page->tid(), Val(insert_key.data, get_insert_prefix_size(insert_key))); // longest possible prefix
+	append_range(my_copy, 0, my_copy.size());
+}
+void LeafPtr::set_prefix(Val prefix){
+	ass2(size() == 0 || get_prefix().has_prefix(prefix), "All keys must have new prefix", DEBUG_PAGES);
+	if( prefix == get_prefix() )
+		return;
+	char buf[MAX_PAGE_SIZE];
+	memcpy(buf, page, page_size);
+	CLeafPtr my_copy(page_size, (LeafPage *)buf, options);
+	const std::string prefix_copy = prefix.to_string(); // prefix can point into our page
+	init_dirty(page->tid(), Val(prefix_copy));
 	append_range(my_copy, 0, my_copy.size());
 }
+void LeafPtr::erase_fixed_item(int to_remove_item, size_t item_size){
+	char * item = const_cast<char *>(fixed_item(to_remove_item, item_size));
+	memmove(item, item + item_size, static_cast<size_t>(size() - 1 - to_remove_item) * item_size);
+	mpage()->set_items_size( page->items_size() - item_size);
+	mpage()->set_item_count( size() - 1);
+	if( CLEAR_FREE_SPACE )
+		memset(const_cast<char *>(fixed_item(size(), item_size)), 0, item_size); // clear unused part
+}
+char * LeafPtr::insert_fixed_item(int insert_index, Val key_tail, size_t item_size){
+	char * item = const_cast<char *>(fixed_item(insert_index, item_size));
+	memmove(item + item_size, item, static_cast<size_t>(size() - insert_index) * item_size);
+	memcpy(item, key_tail.data, key_tail.size);
+	mpage()->set_items_size( page->items_size() + item_size);
+	mpage()->set_item_count( size() + 1);
+	return item + key_tail.size;
+}
 char * LeafPtr::insert_at(int insert_index, Val key, size_t value_size, bool & overflow){
 	ass2(insert_index >= 0 && insert_index <= mpage()->item_count(), "Cannot insert at this index", DEBUG_PAGES);
 	size_t item_size = get_item_size(key, value_size, overflow);
-	compact(item_size);
-	ass2(LEAF_HEADER_SIZE + sizeof(PageOffset)*static_cast<size_t>(page->item_count()) + item_size <= page->free_end_offset(), "No space to insert in node", DEBUG_PAGES);
-	MVal new_key = mpage()->insert_item_at(page_size, insert_index, key, item_size);
+	compact(key, item_size);
+	const size_t prefix_size = get_prefix_size(); // compact could select longer prefix
+	ass2(key.has_prefix(get_prefix()), "Key must have page prefix after compact", DEBUG_PAGES);
+	item_size = get_item_size(prefix_size, key, value_size, overflow);
+	ass2(has_free_middle(item_size), "No space to insert in leaf", DEBUG_PAGES);
+	if( is_fixed() )
+		return insert_fixed_item(insert_index, Val(key.data + prefix_size, key.size - prefix_size), item_size);
+	MVal new_key = mpage()->insert_item_at(page_size, options.key_head_size, insert_index, Val(key.data + prefix_size, key.size - prefix_size), item_size);
 	auto valuesizesize = write_u64_sqlite4(value_size, new_key.end());
 	return new_key.end() + valuesizesize;
 }
+char * LeafPtr::resize_value_in_place(int item, size_t value_size, bool & overflow){
+	ass2(item >= 0 && item < size(), "Cannot resize value at this index", DEBUG_PAGES);
+	overflow = false;
+	if( is_fixed() ) // value size checked by bucket
+		return const_cast<char *>(fixed_item(item, fixed_item_size())) + options.key_size - get_prefix_size();
+	char * raw_page = (char *)mpage();
+	size_t item_offset = page->item_offsets(item);
+	uint64_t keysize;
+	auto keysizesize = read_u64_sqlite4(keysize, raw_page + item_offset);
+	char * value_size_ptr = raw_page + item_offset + keysizesize + keysize;
+	uint64_t old_value_size;
+	auto valuesizesize = read_u64_sqlite4(old_value_size, value_size_ptr);
+	const size_t full_key_size = get_prefix_size() + keysize;
+	overflow = is_overflow(full_key_size, value_size);
+	if( overflow != is_overflow(full_key_size, old_value_size) || get_compact_size_sqlite4(value_size) != valuesizesize )
+		return nullptr;
+	if( !overflow ){
+		if( value_size > old_value_size )
+			return nullptr;
+		// Shrinking leaves gap after item, it is reclaimed by next compact
+		char * value_ptr = value_size_ptr + valuesizesize;
+		if( CLEAR_FREE_SPACE )
+			memset(value_ptr + value_size, 0, old_value_size - value_size);
+		mpage()->set_items_size(page->items_size() - (old_value_size - value_size));
+	}
+	write_u64_sqlite4(value_size, value_size_ptr);
+	return value_size_ptr + valuesizesize;
+}
 
-size_t CLeafPtr::get_item_size(Val key, size_t value_size, bool & overflow)const{
-	size_t kvs_size = sizeof(PageOffset) + get_compact_size_sqlite4(key.size) + key.size + get_compact_size_sqlite4(value_size);
-	if( kvs_size + value_size <= capacity() ){
+size_t CLeafPtr::get_insert_prefix_size(Val insert_key)const{
+	if( !has_prefix_order(options.comparator) )
+		return 0;
+	if( size() == 0 )
+		return insert_key.size;
+	// Keys are sorted, so prefix common to first and last key is common to all keys
+	Val prefix = get_prefix();
+	Val first_tail = get_key_tail(0);
+	Val insert_tail;
+	if( !insert_key.has_prefix(prefix, &insert_tail) )
+		return prefix.common_prefix_size(insert_key);
+	return prefix.size + std::min(first_tail.common_prefix_size(get_key_tail(size() - 1)), first_tail.common_prefix_size(insert_tail));
+}
+int CLeafPtr::lower_bound_item(Val key, bool * found)const{
+	Val prefix = get_prefix();
+	Val tail;
+	if( !key.has_prefix(prefix, &tail) ){ // all keys in page are either larger or smaller than key
+		*found = false;
+		return compare_keys(options.comparator, key, prefix) < 0 ? 0 : size();
+	}
+	if( !is_fixed() )
+		return page->lower_bound_item(page_size, options.key_head_size, options.comparator, tail, found);
+	switch(options.comparator){
+	case Comparator::REVERSE_BYTEWISE: return lower_bound_fixed_item<ReverseBytewiseCompare>(tail, found);
+	case Comparator::UINT64: return lower_bound_fixed_item<Uint64Compare>(tail, found);
+	case Comparator::INT64: return lower_bound_fixed_item<Int64Compare>(tail, found);
+	default: return lower_bound_fixed_item<BytewiseCompare>(tail, found);
+	}
+}
+template<class Compare>
+int CLeafPtr::lower_bound_fixed_item(Val tail, bool * found)const{
+	// Items are at known offsets, so no offsets or sizes are read
+	const size_t item_size = fixed_item_size();
+	const size_t tail_size = options.key_size - get_prefix_size();
+	int first = 0;
+	int count = size();
+	while (count > 0) {
+		int step = count / 2;
+		int it = first + step;
+		int cmp = Compare::compare(Val(fixed_item(it, item_size), tail_size), tail);
+		if( cmp == 0){
+			*found = true;
+			return it;
+		}
+		if (cmp < 0) {
+			first = it + 1;
+			count -= step + 1;
+		}
+		else
+			count = step;
+	}
+	*found = false;
+	return first;
+}
+size_t CLeafPtr::get_item_size(size_t prefix_size, Val key, size_t value_size, bool & overflow)const{
+	ass2(prefix_size <= key.size, "Prefix larger than key in get_item_size", DEBUG_PAGES);
+	if( is_fixed() ){
+		ass2(key.size == options.key_size && value_size == options.value_size, "Wrong item size in fixed bucket", DEBUG_PAGES);
 		overflow = false;
-		return kvs_size + value_size;
+		return key.size - prefix_size + value_size;
 	}
-	overflow = true;
-	return kvs_size + NODE_PID_SIZE + sizeof(Tid);// std::runtime_error("Item does not fit in leaf");
+	const size_t tail_size = key.size - prefix_size;
+	size_t kvs_size = sizeof(PageOffset) + options.key_head_size + get_compact_size_sqlite4(tail_size) + tail_size + get_compact_size_sqlite4(value_size);
+	overflow = is_overflow(key.size, value_size);
+	if( !overflow )
+		return kvs_size + value_size;
+	return kvs_size + OVERFLOW_REF_SIZE;// std::runtime_error("Item does not fit in leaf");
 }
-size_t CLeafPtr::get_item_size(int item, Pid & overflow_page, Pid & overflow_count, Tid & overflow_tid)const{
+size_t CLeafPtr::get_item_size(int item, Pid & overflow_page, size_t & overflow_size, Tid & overflow_tid)const{
 	ass2(item >= 0 && item < page->item_count(), "item_size item too large", DEBUG_PAGES);
+	if( is_fixed() ){
+		overflow_page = 0;
+		overflow_size = 0;
+		return fixed_item_size();
+	}
 	const char * raw_page = (const char *)page;
 	size_t item_offset = page->item_offsets(item);
 	uint64_t keysize;
 	auto keysizesize = read_u64_sqlite4(keysize, raw_page + item_offset);
 	uint64_t valuesize;
 	auto valuesizesize = read_u64_sqlite4(valuesize, raw_page + item_offset + keysizesize + keysize);
-	size_t kvs_size = sizeof(PageOffset) + keysizesize + keysize + valuesizesize;
-	if( kvs_size + valuesize <= capacity() ){
+	size_t kvs_size = sizeof(PageOffset) + options.key_head_size + keysizesize + keysize + valuesizesize;
+	if( !is_overflow(get_prefix_size() + keysize, valuesize) ){
 		overflow_page = 0;
-		overflow_count = 0;
+		overflow_size = 0;
 		return kvs_size + valuesize;
 	}
 	const char * value_ptr = raw_page + item_offset + keysizesize + keysize + valuesizesize;
 	unpack_uint_le(value_ptr, NODE_PID_SIZE, overflow_page);
 	unpack_uint_le(value_ptr + NODE_PID_SIZE, sizeof(Tid), overflow_tid);
-	overflow_count = (valuesize + page_size - 1)/page_size;
-	return kvs_size + NODE_PID_SIZE + sizeof(Tid);
+	overflow_size = valuesize; // overflow pages use whole pages, so their count is up to TX
+	return kvs_size + OVERFLOW_REF_SIZE;
+}
+uint32_t CLeafPtr::get_overflow_checksum(int item)const{
+	std::string key_buf;
+	Pid overflow_page;
+	ValVal kv = get_kv(item, overflow_page, key_buf);
+	ass2(overflow_page != 0, "Item has no overflow value in get_overflow_checksum", DEBUG_PAGES);
+	uint32_t checksum;
+	unpack_uint_le(kv.value.data + NODE_PID_SIZE + sizeof(Tid), sizeof(uint32_t), checksum);
+	return checksum;
 }
-ValVal CLeafPtr::get_kv(int item, Pid & overflow_page)const{
+void LeafPtr::set_overflow_checksum(int item, uint32_t checksum){
+	std::string key_buf;
+	Pid overflow_page;
+	ValVal kv = get_kv(item, overflow_page, key_buf);
+	ass2(overflow_page != 0, "Item has no overflow value in set_overflow_checksum", DEBUG_PAGES);
+	pack_uint_le(const_cast<char *>(kv.value.data) + NODE_PID_SIZE + sizeof(Tid), sizeof(uint32_t), checksum);
+}
+size_t CLeafPtr::get_item_size(int item, size_t prefix_size)const{
+	if( is_fixed() )
+		return options.key_size - prefix_size + options.value_size;
+	const size_t my_prefix_size = get_prefix_size();
+	const size_t tail_size = get_key_tail(item).size;
+	ass2(prefix_size <= my_prefix_size + tail_size, "Prefix larger than key in get_item_size", DEBUG_PAGES);
+	const size_t new_tail_size = tail_size + my_prefix_size - prefix_size;
+	return get_item_size(item) - get_compact_size_sqlite4(tail_size) - tail_size + get_compact_size_sqlite4(new_tail_size) + new_tail_size;
+}
+size_t CLeafPtr::data_size(size_t prefix_size)const{
+	if( prefix_size == get_prefix_size() )
+		return data_size();
+	size_t result = prefix_size;
+	for(int i = 0; i != size(); ++i)
+		result += get_item_size(i, prefix_size);
+	return result;
+}
+Val CLeafPtr::get_key(int item, std::string & key_buf)const{
+	Val tail = get_key_tail(item);
+	Val prefix = get_prefix();
+	if( prefix.empty() )
+		return tail;
+	key_buf.assign(prefix.data, prefix.size);
+	key_buf.append(tail.data, tail.size);
+	return Val(key_buf);
+}
+ValVal CLeafPtr::get_kv(int item, Pid & overflow_page, std::string & key_buf)const{
 	ValVal result;
-	result.key = get_key(item);
+	Val tail = get_key_tail(item);
+	result.key = get_key(item, key_buf);
+	if( is_fixed() ){
+		overflow_page = 0;
+		result.value = Val(tail.end(), options.value_size);
+		return result;
+	}
 	uint64_t valuesize;
-	auto valuesizesize = read_u64_sqlite4(valuesize, result.key.end());
-	size_t kvs_size = sizeof(PageOffset) + get_compact_size_sqlite4(result.key.size) + result.key.size + valuesizesize;
-	if( kvs_size + valuesize <= capacity() ){
+	auto valuesizesize = read_u64_sqlite4(valuesize, tail.end());
+	if( !is_overflow(result.key.size, valuesize) ){
 		overflow_page = 0;
-		result.value = Val(result.key.end() + valuesizesize, valuesize);
+		result.value = Val(tail.end() + valuesizesize, valuesize);
 	}else{
-		unpack_uint_le(result.key.end() + valuesizesize, NODE_PID_SIZE, overflow_page);
-		result.value = Val(result.key.end() + valuesizesize, valuesize);
+		unpack_uint_le(tail.end() + valuesizesize, NODE_PID_SIZE, overflow_page);
+		result.value = Val(tail.end() + valuesizesize, valuesize);
 	}
 	return result;
 }
@@ -280,7 +591,7 @@ void test_node_page(){
 			pa.erase(existing_item);
 			mirror.erase(key);
 		}
-		size_t new_kvsize = get_item_size(page_size, Val(key), val);
+		size_t new_kvsize = pa.get_item_size(Val(key), val);
 		bool add_new = rand() % 2;
 		if( add_new && pa.free_capacity() >= new_kvsize ){
 			pa.insert_at(existing_item, Val(key), val);
@@ -320,17 +631,19 @@ void mustela::test_data_pages(){
 		if( same_key ){
 			if( !remove_existing )
 				continue;
-			Pid overflow_page, overflow_count;
+			Pid overflow_page;
+			size_t overflow_size;
 			Tid overflow_tid;
-			pa.erase(existing_item, overflow_page, overflow_count, overflow_tid);
+			pa.erase(existing_item, overflow_page, overflow_size, overflow_tid);
 			ass(overflow_page == 0, "This test should not use overflow");
 			mirror.erase(key);
 		}
 		bool overflow;
-		size_t new_kvsize = pa.get_item_size(Val(key), Val(val).size, overflow);
+		const size_t prefix_size = pa.get_insert_prefix_size(Val(key));
+		size_t new_kvsize = pa.get_item_size(prefix_size, Val(key), Val(val).size, overflow);
 		ass(!overflow, "This test should not use overflow");
 		bool add_new = rand() % 2;
-		if( add_new && new_kvsize <= pa.free_capacity() ){
+		if( add_new && pa.data_size(prefix_size) + new_kvsize <= pa.capacity() ){
 			pa.insert_at(existing_item, Val(key), Val(val));
 			mirror[key] = val;
 		}
@@ -338,10 +651,11 @@ void mustela::test_data_pages(){
 	std::cerr << "Mirror" << std::endl;
 	for(auto && ma : mirror)
 		std::cerr << ma.first << ":" << ma.second << std::endl;
-	std::cerr << "Page" << std::endl;
+	std::cerr << "Page prefix=" << pa.get_prefix().to_string() << std::endl;
+	std::string key_buf;
 	for(int i = 0; i != pa.size(); ++i){
 		Pid overflow_page;
-		ValVal va = pa.get_kv(i, overflow_page);
+		ValVal va = pa.get_kv(i, overflow_page, key_buf);
 		ass(overflow_page == 0, "This test should not use overflow");
 		std::cerr << va.key.to_string() << ":" << va.value.to_string() << std::endl;
 	}
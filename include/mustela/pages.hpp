@@ -2,11 +2,21 @@
 
 #include <string>
 #include <cstring>
+#include <algorithm>
 #include "defs.hpp"
 #include "utils.hpp"
 
 namespace mustela {
 
+	struct BucketOptions { // Set when creating bucket, then stored in BucketDesc. Page layout depends on them
+		size_t key_head_size = 0; // 0, 4 or 8. First bytes of keys are stored near item offsets, speeding up search at cost of space
+		size_t key_size = 0; // If not 0, all keys have this size and all values have value_size
+		size_t value_size = 0; // leaf items of such buckets are stored as plain array, without offsets and sizes
+		Comparator comparator = Comparator::BYTEWISE; // key_head_size can be used only with BYTEWISE
+		bool dupsort = false; // each key has sorted set of values, BYTEWISE and not fixed only
+		size_t fill_percent = 50; // 50..100, share of split page kept in left page. 50 balances halves, 90 suits append-mostly archives
+		size_t merge_percent = 50; // 1..50, page is merged with siblings when its data is below this share of capacity
+	};
 #pragma pack(push, 1)
 	struct BucketDesc {
 		uint64_t root_page;
@@ -15,6 +25,26 @@ namespace mustela {
 		uint64_t leaf_page_count;
 		uint64_t node_page_count;
 		uint64_t overflow_page_count;
+		uint8_t key_head_size;
+		uint16_t key_size;
+		uint16_t value_size;
+		uint8_t comparator;
+		uint8_t dupsort;
+		uint8_t fill_percent; // 0 means default, as in meta bucket
+		uint8_t merge_percent;
+		BucketOptions get_options()const{
+			BucketOptions options;
+			options.key_head_size = key_head_size;
+			options.key_size = key_size;
+			options.value_size = value_size;
+			options.comparator = static_cast<Comparator>(comparator);
+			options.dupsort = dupsort != 0;
+			if( fill_percent != 0 )
+				options.fill_percent = fill_percent;
+			if( merge_percent != 0 )
+				options.merge_percent = merge_percent;
+			return options;
+		}
 		void unpack(const char * buf, size_t size);
 		void pack(char * buf, size_t size);
 	};
@@ -27,6 +57,7 @@ namespace mustela {
 		uint32_t version;
 		uint32_t page_size;
 		uint32_t pid_size; // TODO - implement
+		uint32_t page_checksums; // if not 0, leaf and node pages end with CRC32C of the rest of page
 		uint32_t crc32; // Must be last one
 	};
 	// TODO - detect hot copy made with "cp" utility
@@ -67,13 +98,23 @@ namespace mustela {
 		size_t item_offsets(int item)const { return unpack_page_object(static_cast<const PageOffset *>(s_item_offsets) + item); }
 		void set_item_offsets(int item, size_t c) { pack_page_object(c, static_cast<PageOffset *>(s_item_offsets) + item); }
 
+		// When head_size != 0, array of key heads follows offsets
+		const char * item_heads()const { return reinterpret_cast<const char *>(static_cast<const PageOffset *>(s_item_offsets) + item_count()); }
+		char * item_heads() { return reinterpret_cast<char *>(static_cast<PageOffset *>(s_item_offsets) + item_count()); }
+
 		MVal get_item_key(size_t page_size, int item);
 		Val get_item_key(size_t page_size, int item)const;
 		Val get_item_key_no_check(size_t page_size, int item)const;
-		int lower_bound_item(size_t page_size, Val key, bool * found)const;
-		int upper_bound_item(size_t page_size, Val key)const;
-		void erase_item(size_t page_size, int to_remove_item, size_t item_size);
-		MVal insert_item_at(size_t page_size, int insert_index, Val key, size_t item_size);
+		int lower_bound_item(size_t page_size, size_t head_size, Comparator comparator, Val key, bool * found)const;
+		int upper_bound_item(size_t page_size, size_t head_size, Comparator comparator, Val key)const;
+		void erase_item(size_t page_size, size_t head_size, int to_remove_item, size_t item_size);
+		MVal insert_item_at(size_t page_size, size_t head_size, int insert_index, Val key, size_t item_size);
+	private:
+		template<class Compare>
+		int lower_bound_item(size_t page_size, size_t head_size, Val key, bool * found)const;
+		template<class Compare>
+		int upper_bound_item(size_t page_size, size_t head_size, Val key)const;
+		void narrow_by_heads(size_t head_size, Val key, int & first, int & count)const;
 	};
 
 	struct NodePage : public KeysPage {
@@ -86,33 +127,51 @@ namespace mustela {
 	inline size_t node_capacity(size_t page_size){
 		return page_size - NODE_HEADER_SIZE - NODE_PID_SIZE;
 	}
-	inline size_t max_key_size(size_t page_size){
-		size_t space = (page_size - NODE_HEADER_SIZE - NODE_PID_SIZE)/MIN_KEY_COUNT - NODE_PID_SIZE - sizeof(PageOffset);
+	inline size_t max_key_size(size_t page_size, size_t key_head_size = 0){
+		size_t space = (page_size - NODE_HEADER_SIZE - NODE_PID_SIZE)/MIN_KEY_COUNT - NODE_PID_SIZE - sizeof(PageOffset) - key_head_size;
 		space -= get_compact_size_sqlite4(space);
 		return space;
 	}
-	size_t get_item_size(size_t page_size, Val key, Pid value);
+	// Heads are first bytes of key as big-endian number, so they are ordered as keys are
+	// Short keys are padded with zeroes, so equal heads do not mean equal keys
+	inline uint64_t get_key_head(Val key, size_t head_size){
+		uint64_t result = 0;
+		for(size_t i = 0; i != head_size; ++i)
+			result = (result << 8) | (i < key.size ? static_cast<unsigned char>(key.data[i]) : 0);
+		return result;
+	}
+
+	// Shortest key larger than left_last and not larger than right_first, separates neighbour leaves in parent node
+	// Other comparators order truncated keys differently, so full key is used
+	inline Val get_leaf_separator(Comparator comparator, Val left_last, Val right_first){
+		if( comparator != Comparator::BYTEWISE )
+			return right_first;
+		return Val(right_first.data, std::min(right_first.size, left_last.common_prefix_size(right_first) + 1));
+	}
 
 	struct LeafPage : public KeysPage {
 		// Leaf page
-		// header [io0, io1, io2] free_middle [skey2 svalue2, gap, skey0 svalue0, gap, skey1 svalue1]
+		// header [io0, io1, io2] free_middle [skey2 svalue2, gap, skey0 svalue0, gap, skey1 svalue1] prefix prefix_size
+		// each LeafPage has sizeof(PageOffset) bytes at the end, storing size of prefix common to all keys in page.
+		// prefix itself is stored just before, skeys are stored without it
 	};
 	constexpr size_t LEAF_HEADER_SIZE = sizeof(LeafPage) - sizeof(KeysPage::s_item_offsets);
 	inline size_t leaf_capacity(size_t page_size){
-		return page_size - LEAF_HEADER_SIZE;
+		return page_size - LEAF_HEADER_SIZE - sizeof(PageOffset);
 	}
 #pragma pack(pop)
 
 	static_assert(MIN_PAGE_SIZE >= sizeof(MetaPage), "Metapage does not fit into page size");
-	static_assert(MIN_PAGE_SIZE >= (NODE_PID_SIZE + 1 + sizeof(PageOffset))*MIN_KEY_COUNT + NODE_PID_SIZE + NODE_HEADER_SIZE, "Node page with min keys does not fit into page size");
+	static_assert(MIN_PAGE_SIZE >= (NODE_PID_SIZE + 1 + sizeof(PageOffset) + sizeof(uint64_t))*MIN_KEY_COUNT + NODE_PID_SIZE + NODE_HEADER_SIZE, "Node page with min keys does not fit into page size");
 
 	struct CNodePtr {
 		size_t page_size;
 		const NodePage * page;
+		BucketOptions options; // from BucketDesc
 		
 		CNodePtr():page_size(0), page(nullptr)
 		{}
-		CNodePtr(size_t page_size, const NodePage * page):page_size(page_size), page(page)
+		CNodePtr(size_t page_size, const NodePage * page, const BucketOptions & options = BucketOptions{}):page_size(page_size), page(page), options(options)
 		{}
 		int size()const{ return page->item_count(); }
 		Val get_key(int item)const{
@@ -121,11 +180,15 @@ namespace mustela {
 		Pid get_value(int item)const;
 		ValPid get_kv(int item)const;
 		size_t get_item_size(int item)const;
+		size_t get_item_size(Val key, Pid value)const;
 		int lower_bound_item(Val key, bool * found)const{
-			return page->lower_bound_item(page_size, key, found);
+			return page->lower_bound_item(page_size, options.key_head_size, options.comparator, key, found);
 		}
 		int upper_bound_item(Val key)const{
-			return page->upper_bound_item(page_size, key);
+			return page->upper_bound_item(page_size, options.key_head_size, options.comparator, key);
+		}
+		bool has_free_middle(size_t item_size)const{ // new item offset and head are included in item_size
+			return NODE_HEADER_SIZE + (sizeof(PageOffset) + options.key_head_size)*static_cast<size_t>(page->item_count()) + item_size <= page->free_end_offset();
 		}
 	 	size_t capacity()const{
 	 		return node_capacity(page_size);
@@ -138,9 +201,9 @@ namespace mustela {
 		}
 	};
 	struct NodePtr : public CNodePtr {
-		NodePtr():CNodePtr(0, nullptr)
+		NodePtr()
 		{}
-		NodePtr(size_t page_size, NodePage * page):CNodePtr(page_size, page)
+		NodePtr(size_t page_size, NodePage * page, const BucketOptions & options = BucketOptions{}):CNodePtr(page_size, page, options)
 		{}
 		NodePage * mpage()const { return const_cast<NodePage *>(page); }
 		
@@ -151,7 +214,7 @@ namespace mustela {
 		void set_value(int item, Pid value);
 		void erase(int to_remove_item){
 			size_t item_size = get_item_size(to_remove_item);
-			mpage()->erase_item(page_size, to_remove_item, item_size);
+			mpage()->erase_item(page_size, options.key_head_size, to_remove_item, item_size);
 			if( mpage()->item_count() == 0)
 				mpage()->set_free_end_offset(page_size - NODE_PID_SIZE); // compact on last delete :)
 		}
@@ -165,16 +228,16 @@ namespace mustela {
 			ass2(insert_index >= 0 && insert_index <= mpage()->item_count(), "Cannot insert at this index", DEBUG_PAGES);
 			if(insert_index < mpage()->item_count()){
 				ValPid right_kv = get_kv(insert_index);
-				ass2(key < right_kv.key, "Wrong insert order 1", DEBUG_PAGES);
+				ass2(compare_keys(options.comparator, key, right_kv.key) < 0, "Wrong insert order 1", DEBUG_PAGES);
 			}
 			if( insert_index > 0){
 				ValPid left_kv = get_kv(insert_index - 1);
-				ass2(left_kv.key < key, "Wrong insert order 2", DEBUG_PAGES);
+				ass2(compare_keys(options.comparator, left_kv.key, key) < 0, "Wrong insert order 2", DEBUG_PAGES);
 			}
-			size_t item_size = mustela::get_item_size(page_size, key, value);
+			size_t item_size = get_item_size(key, value);
 			compact(item_size);
-			ass2(NODE_HEADER_SIZE + sizeof(PageOffset)*static_cast<size_t>(page->item_count()) + item_size <= page->free_end_offset(), "No space to insert in node", DEBUG_PAGES);
-			MVal new_key = mpage()->insert_item_at(page_size, insert_index, key, item_size);
+			ass2(has_free_middle(item_size), "No space to insert in node", DEBUG_PAGES);
+			MVal new_key = mpage()->insert_item_at(page_size, options.key_head_size, insert_index, key, item_size);
 			pack_uint_le((unsigned char *)new_key.end(), NODE_PID_SIZE, value);
 		}
 		void insert_at(int insert_index, ValPid kv){
@@ -199,27 +262,69 @@ namespace mustela {
 		}
 	};
 	
+	inline void pack_overflow_ref(char * dst, Pid overflow_page, Tid overflow_tid){ // checksum is written at commit
+		pack_uint_le(dst, NODE_PID_SIZE, overflow_page);
+		pack_uint_le(dst + NODE_PID_SIZE, sizeof(Tid), overflow_tid);
+		pack_uint_le(dst + NODE_PID_SIZE + sizeof(Tid), sizeof(uint32_t), uint32_t(0));
+	}
 	struct CLeafPtr {
 		size_t page_size;
 		const LeafPage * page;
+		BucketOptions options; // from BucketDesc, heads are made from key tails
 		
 		CLeafPtr():page_size(0), page(nullptr)
 		{}
-		CLeafPtr(size_t page_size, const LeafPage * page):page_size(page_size), page(page)
+		CLeafPtr(size_t page_size, const LeafPage * page, const BucketOptions & options = BucketOptions{}):page_size(page_size), page(page), options(options)
 		{}
 		int size()const{ return page->item_count(); }
-		Val get_key(int item)const{
+		size_t get_prefix_size()const{
+			return unpack_page_object(reinterpret_cast<const char *>(page) + page_size - sizeof(PageOffset));
+		}
+		Val get_prefix()const{
+			size_t prefix_size = get_prefix_size();
+			return Val(reinterpret_cast<const char *>(page) + page_size - sizeof(PageOffset) - prefix_size, prefix_size);
+		}
+		size_t get_common_prefix_size(Val key)const{
+			return get_prefix().common_prefix_size(key);
+		}
+		size_t get_insert_prefix_size(Val insert_key)const; // longest prefix common to all keys and insert_key, can be longer than page prefix
+		bool is_fixed()const{ return options.key_size != 0; }
+		size_t fixed_item_size()const{ // key tail and value, all items in page have the same size
+			return options.key_size - get_prefix_size() + options.value_size;
+		}
+		const char * fixed_item(int item, size_t item_size)const{
+			return reinterpret_cast<const char *>(page) + LEAF_HEADER_SIZE + static_cast<size_t>(item) * item_size;
+		}
+		Val get_key_tail(int item)const{ // key without prefix
+			if( is_fixed() )
+				return Val(fixed_item(item, fixed_item_size()), options.key_size - get_prefix_size());
 			return page->get_item_key(page_size, item);
 		}
-		ValVal get_kv(int item, Pid & overflow_page)const;
-		size_t get_item_size(int item, Pid & overflow_page, Pid & overflow_count, Tid & overflow_tid)const;
+		Val get_key(int item, std::string & key_buf)const; // key_buf is used only if prefix is not empty
+		ValVal get_kv(int item, Pid & overflow_page, std::string & key_buf)const;
+		size_t get_item_size(int item, Pid & overflow_page, size_t & overflow_size, Tid & overflow_tid)const;
+		uint32_t get_overflow_checksum(int item)const; // item must have overflow value
 		size_t get_item_size(int item)const{
 			Pid a; Tid b; return get_item_size(item, a, a, b);
 		}
-		int lower_bound_item(Val key, bool * found)const{
-			return page->lower_bound_item(page_size, key, found);
+		size_t get_item_size(int item, size_t prefix_size)const; // if item is stored with different prefix
+		int lower_bound_item(Val key, bool * found)const;
+		template<class Compare>
+		int lower_bound_fixed_item(Val tail, bool * found)const;
+		size_t get_item_size(size_t prefix_size, Val key, size_t value_size, bool & overflow)const;
+		size_t get_item_size(Val key, size_t value_size, bool & overflow)const{
+			return get_item_size(get_common_prefix_size(key), key, value_size, overflow);
+		}
+		bool is_overflow(size_t key_size, size_t value_size)const{ // decided by full key size, so items can move between pages with different prefixes
+			if( is_fixed() )
+				return false; // checked when creating bucket
+			return sizeof(PageOffset) + options.key_head_size + get_compact_size_sqlite4(key_size) + key_size + get_compact_size_sqlite4(value_size) + value_size > capacity();
+		}
+		bool has_free_middle(size_t item_size)const{ // new item offset and head are included in item_size
+			if( is_fixed() )
+				return LEAF_HEADER_SIZE + page->items_size() + item_size <= page->free_end_offset();
+			return LEAF_HEADER_SIZE + (sizeof(PageOffset) + options.key_head_size)*static_cast<size_t>(page->item_count()) + item_size <= page->free_end_offset();
 		}
-		size_t get_item_size(Val key, size_t value_size, bool & overflow)const;
 		size_t capacity()const{
 			return leaf_capacity(page_size);
 		}
@@ -227,39 +332,45 @@ namespace mustela {
 			return capacity() - data_size();
 		}
 		size_t data_size()const{
-			return page->items_size();
+			return page->items_size() + get_prefix_size();
 		}
+		size_t data_size(size_t prefix_size)const; // if all items are stored with (shorter) prefix
 	};
 	struct LeafPtr : public CLeafPtr {
-		LeafPtr():CLeafPtr(0, nullptr)
+		LeafPtr()
 		{}
-		LeafPtr(size_t page_size, LeafPage * page):CLeafPtr(page_size, page)
+		LeafPtr(size_t page_size, LeafPage * page, const BucketOptions & options = BucketOptions{}):CLeafPtr(page_size, page, options)
 		{}
 		LeafPage * mpage()const { return const_cast<LeafPage *>(page); }
 		
-		void init_dirty(Tid tid);
-		MVal get_key(int item){
-			return mpage()->get_item_key(page_size, item);
-		}
-		void erase(int to_remove_item, Pid & overflow_page, Pid & overflow_count, Tid & overflow_tid){
-			size_t item_size = get_item_size(to_remove_item, overflow_page, overflow_count, overflow_tid);
-			mpage()->erase_item(page_size, to_remove_item, item_size);
+		void init_dirty(Tid tid, Val prefix = Val{});
+		void set_overflow_checksum(int item, uint32_t checksum); // item must have overflow value
+		void erase(int to_remove_item, Pid & overflow_page, size_t & overflow_size, Tid & overflow_tid){
+			size_t item_size = get_item_size(to_remove_item, overflow_page, overflow_size, overflow_tid);
+			if( is_fixed() )
+				erase_fixed_item(to_remove_item, item_size);
+			else
+				mpage()->erase_item(page_size, options.key_head_size, to_remove_item, item_size);
 			if( mpage()->item_count() == 0)
-				mpage()->set_free_end_offset(page_size); // compact on last delete :)
+				init_dirty(page->tid()); // compact on last delete, also forget prefix :)
 		}
 		void erase(int begin, int end){
-			Pid overflow_page, overflow_count;
+			Pid overflow_page;
+			size_t overflow_size;
 			Tid overflow_tid;
 			ass2(begin <= end, "Invalid range at erase", DEBUG_PAGES);
 			for(int it = end; it-- > begin; )
-				erase(it, overflow_page, overflow_count, overflow_tid);
+				erase(it, overflow_page, overflow_size, overflow_tid);
 		}
-		void compact(size_t item_size);
+		void compact(Val insert_key, size_t item_size);
+		void set_prefix(Val prefix); // before inserting range of items with different common prefix, all keys in page must have new prefix
 		char * insert_at(int insert_index, Val key, size_t value_size, bool & overflow);
+		// Same or smaller value keeps its place, returns nullptr if item must be erased and inserted again
+		char * resize_value_in_place(int item, size_t value_size, bool & overflow);
 		void insert_at(int insert_index, Val key, Val value){
 			bool overflow = false;
 			char * dst = insert_at(insert_index, key, value.size, overflow);
-			memcpy(dst, value.data, overflow ? NODE_PID_SIZE + sizeof(Tid) : value.size);
+			memcpy(dst, value.data, overflow ? OVERFLOW_REF_SIZE : value.size);
 		}
 		void append(Val key, Val value){
 			insert_at(page->item_count(), key, value);
@@ -270,15 +381,19 @@ namespace mustela {
 		void insert_range(int insert_index, const CLeafPtr & other, int begin, int end){
 			ass2(begin <= end, "Invalid range at insert_range", DEBUG_PAGES);
 			// TODO - compact at start if needed midway, move all page offsets at once
+			std::string key_buf;
 			for(;begin != end; ++begin){
 				Pid overflow_page;
-				auto kv = other.get_kv(begin, overflow_page);
+				auto kv = other.get_kv(begin, overflow_page, key_buf);
 				insert_at(insert_index++, kv.key, kv.value);
 			}
 		}
 		void append_range(const CLeafPtr & other, int begin, int end){
 			insert_range(page->item_count(), other, begin, end);
 		}
+	private:
+		void erase_fixed_item(int to_remove_item, size_t item_size);
+		char * insert_fixed_item(int insert_index, Val key_tail, size_t item_size);
 	};
 	
 	void test_data_pages();
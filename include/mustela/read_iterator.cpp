@@ -0,0 +1,161 @@
+#include "mustela.hpp"
+#include <algorithm>
+
+using namespace mustela;
+
+ReadIterator & ReadIterator::operator=(const ReadIterator & other){
+	my_txn = other.my_txn;
+	bucket_desc = other.bucket_desc;
+	dup_index = other.dup_index;
+	if( bucket_desc )
+		std::copy(other.path.begin(), other.path.begin() + bucket_desc->height + 1, path.begin());
+	return *this;
+}
+bool ReadIterator::seek(const Val & key){
+	ass(is_valid(), "ReadIterator not valid");
+	if( bucket_desc->dupsort == 0 )
+		return seek_stored(key);
+	Val prefix = encode_dup_key(key, dup_buffer);
+	seek_stored(prefix); // pair with empty value is the first one
+	Val c_key, c_value;
+	return get_stored(&c_key, &c_value) && c_key.has_prefix(prefix);
+}
+bool ReadIterator::seek_stored(const Val & stored_key){
+	ass(is_valid(), "ReadIterator not valid");
+	dup_index = 0;
+	Pid pa = bucket_desc->root_page;
+	for(size_t height = bucket_desc->height; height != 0; --height){
+		CNodePtr nap = my_txn->readable_node(bucket_desc, pa);
+		int nitem = nap.upper_bound_item(stored_key) - 1;
+		path[height] = Element{pa, nitem};
+		pa = nap.get_value(nitem);
+	}
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, pa);
+	bool found;
+	path[0] = Element{pa, dap.lower_bound_item(stored_key, &found)};
+	return found;
+}
+void ReadIterator::before_first(){
+	ass(is_valid(), "ReadIterator not valid");
+	path[0].pid = 0;
+	dup_index = 0;
+}
+void ReadIterator::end(){
+	ass(is_valid(), "ReadIterator not valid");
+	set_at_direction(bucket_desc->height, bucket_desc->root_page, 1);
+}
+void ReadIterator::first(){
+	ass(is_valid(), "ReadIterator not valid");
+	set_at_direction(bucket_desc->height, bucket_desc->root_page, -1);
+	if( bucket_desc->height != 0 )
+		my_txn->scan_readahead(bucket_desc, path[1].pid, path[1].item);
+}
+void ReadIterator::last(){
+	end();
+	prev();
+}
+bool ReadIterator::get(Val * key, Val * value){
+	Val stored_value;
+	if( !get_stored(key, &stored_value) )
+		return false;
+	if( bucket_desc->dupsort == 0 ){
+		*value = stored_value;
+		return true;
+	}
+	ass(decode_dup(*key, key, value, dup_buffer), "Wrong dupsort pair in ReadIterator::get");
+	if( !stored_value.empty() ){ // long value, start is in stored key and tail in shared item
+		Val tail = get_dup_tail(stored_value, dup_index);
+		dup_value_buffer.assign(value->data, value->size);
+		dup_value_buffer.append(tail.data, tail.size);
+		*value = Val(dup_value_buffer);
+	}
+	return true;
+}
+size_t ReadIterator::count_item_dups(){
+	Val c_key, c_value;
+	if( !get_stored(&c_key, &c_value) )
+		return 0;
+	return c_value.empty() ? 1 : count_dup_tails(c_value);
+}
+void ReadIterator::next(){
+	ass(is_valid(), "ReadIterator not valid");
+	if( bucket_desc->dupsort != 0 && dup_index + 1 < count_item_dups() ){
+		dup_index += 1;
+		return;
+	}
+	dup_index = 0;
+	if( is_before_first() )
+		return first();
+	if( fix_after_last_item() )
+		path[0].item += 1;
+}
+void ReadIterator::prev(){
+	ass(is_valid(), "ReadIterator not valid");
+	if( dup_index > 0 ){
+		dup_index -= 1;
+		return;
+	}
+	prev_stored();
+	if( bucket_desc->dupsort != 0 ) // to the last value of shared item
+		dup_index = std::max<size_t>(count_item_dups(), 1) - 1;
+}
+void ReadIterator::prev_stored(){
+	if( is_before_first() )
+		return;
+	if( path[0].item > 0 ){
+		path[0].item -= 1;
+		return;
+	}
+	size_t height = 1;
+	for(; height != bucket_desc->height + 1 && path[height].item == -1; ++height)
+		;
+	if( height == bucket_desc->height + 1 )
+		return before_first();
+	path[height].item -= 1;
+	set_at_direction(height - 1, my_txn->readable_node(bucket_desc, path[height].pid).get_value(path[height].item), 1);
+	ass(path[0].item > 0, "Invalid iterator after set_at_direction in ReadIterator::prev");
+	path[0].item -= 1;
+}
+bool ReadIterator::get_stored(Val * key, Val * value){
+	ass(is_valid(), "ReadIterator not valid");
+	if( !fix_after_last_item() )
+		return false;
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, path[0].pid);
+	Pid overflow_page;
+	auto kv = dap.get_kv(path[0].item, overflow_page, key_buffer);
+	if( overflow_page ){
+		if( my_txn->verify_on_read )
+			my_txn->verify_overflow_checksum(dap, path[0].item);
+		kv.value.data = my_txn->readable_overflow(overflow_page, my_txn->get_overflow_count(kv.value.size));
+	}
+	*key = kv.key;
+	*value = kv.value;
+	return true;
+}
+bool ReadIterator::fix_after_last_item(){
+	if( is_before_first() )
+		return false;
+	if( path[0].item < my_txn->readable_leaf(bucket_desc, path[0].pid).size() )
+		return true;
+	for(size_t height = 1; height != bucket_desc->height + 1; ++height){
+		CNodePtr nap = my_txn->readable_node(bucket_desc, path[height].pid);
+		if( path[height].item + 1 < nap.size() ){
+			path[height].item += 1;
+			set_at_direction(height - 1, nap.get_value(path[height].item), -1);
+			my_txn->scan_readahead(bucket_desc, path[1].pid, path[1].item); // scan moved to next leaf
+			return true;
+		}
+	}
+	return false; // at end(), path stays at last leaf end
+}
+void ReadIterator::set_at_direction(size_t height, Pid pa, int dir){
+	dup_index = 0;
+	for(; height != 0; --height){
+		CNodePtr nap = my_txn->readable_node(bucket_desc, pa);
+		int nitem = dir > 0 ? nap.size() - 1 : -1;
+		path[height] = Element{pa, nitem};
+		pa = nap.get_value(nitem);
+	}
+	CLeafPtr dap = my_txn->readable_leaf(bucket_desc, pa);
+	path[0] = Element{pa, dir > 0 ? dap.size() : 0};
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <array>
+#include "pages.hpp"
+
+namespace mustela {
+
+	// Cursor without registration in TX, for scans in read-only transactions. It is never fixed up,
+	// so in r/w transactions any modification of its bucket invalidates it. Must not outlive transaction.
+	// Copy copies only active part of path
+	class ReadIterator {
+	public:
+		ReadIterator(){}
+		ReadIterator(const ReadIterator & other){ *this = other; }
+		ReadIterator & operator=(const ReadIterator & other);
+
+		bool is_valid()const { return bucket_desc != nullptr; }
+
+		bool seek(const Val & key); // sets to key and returns true if key is found, otherwise sets to next key or end() and returns false
+		void before_first(); // sets before first
+		void end(); // sets to end
+		void first(); // sets to end(), if db is empty
+		void last(); // sets to end(), if db is empty
+
+		bool get(Val * key, Val * value); // key is valid until iterator is moved, in dupsort buckets returns pair
+		void next(); // next from last() goes to the end(), next from end() is nop
+		void prev(); // prev from first() goes to the before_first(), prev from before_first() is nop
+	private:
+		friend class Bucket;
+		explicit ReadIterator(TX * my_txn, const BucketDesc * bucket_desc):my_txn(my_txn), bucket_desc(bucket_desc)
+		{}
+
+		TX * my_txn = nullptr;
+		const BucketDesc * bucket_desc = nullptr;
+		std::string key_buffer; // keys in leaves are stored without common prefix, we assemble them here
+		std::string dup_buffer; // encoded keys for search
+		std::string dup_value_buffer; // long dupsort values, assembled from stored key and tail
+		size_t dup_index = 0; // of value tail in shared item of long dupsort values, 0 for other items
+
+		struct Element {
+			Pid pid = 0;
+			int item = 0;
+		};
+		std::array<Element, MAX_HEIGHT + 1> path; // only [0..bucket height] is used and copied
+		bool is_before_first()const { return path[0].pid == 0; }
+		bool seek_stored(const Val & key); // for dupsort buckets key is encoded pair
+		bool get_stored(Val * key, Val * value);
+		void prev_stored(); // by items, shared items of dupsort values are not entered
+		bool fix_after_last_item(); // true if points to item
+		size_t count_item_dups(); // values in item at iterator, 0 at end()
+		void set_at_direction(size_t height, Pid pa, int dir);
+	};
+}
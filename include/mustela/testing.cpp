@@ -1,8 +1,10 @@
 #include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -81,13 +83,18 @@ namespace {
         for (auto name: tx.get_bucket_names()) {
             blake2b_update_val(&ctx, 'b', name);
 
+            // partitions are encoded in parallel and hashed in key order, so hash does not depend on partition count
             mustela::Bucket b = tx.get_bucket(name, false);
-            mustela::Cursor cur = b.get_cursor();
-            mustela::Val k, v;
-            for (cur.first(); cur.get(&k, &v); cur.next()) {
-                blake2b_update_val(&ctx, 'k', k);
-                blake2b_update_val(&ctx, 'v', v);
-            }
+            std::vector<bytes> parts(4);
+            b.scan_partitions(parts.size(), [&](size_t partition, mustela::Val const &k, mustela::Val const &v) {
+                auto & part = parts.at(partition);
+                auto ek = encode_nulls('k', k);
+                auto ev = encode_nulls('v', v);
+                part.insert(part.end(), ek.begin(), ek.end());
+                part.insert(part.end(), ev.begin(), ev.end());
+            });
+            for (auto const &part: parts)
+                blake2b_update(&ctx, part.data(), part.size());
         }
 
         uint8_t h[32] = {};
@@ -98,16 +105,23 @@ namespace {
 
     struct test_state {
         std::string db_path;
+        bool page_checksums;
         std::unique_ptr<mustela::DB> db;
         std::unique_ptr<mustela::TX> tx;
         std::vector<std::unique_ptr<mustela::TX>> read_txs;
         std::map<bytes, mustela::Bucket> buckets;
         std::map<bytes, mustela::Cursor> cursors;
+        mustela::IncrementalChecker checker;
+        std::streamoff relocated_file_size = 0; // before first relocate-tail
 
-        explicit test_state(std::string db_path) : db_path(std::move(db_path)) {
+        explicit test_state(std::string db_path, bool page_checksums) : db_path(std::move(db_path)), page_checksums(page_checksums) {
             reset();
         }
 
+        std::streamoff get_file_size() const {
+            return std::ifstream(db_path, std::ios::binary | std::ios::ate).tellg();
+        }
+
         void commit() {
             cursors.clear();
             buckets.clear();
@@ -132,6 +146,12 @@ namespace {
             mustela::DBOptions options;
             options.new_db_page_size = mustela::MIN_PAGE_SIZE;
             options.minimal_mapping_size = 256; // Small increase of mapped region == lots of mmap/munmap when DB grows
+            options.dropped_pages_per_commit = 4; // Dropped trees are freed over several commits
+            options.check_threads = 3; // check_database after each command also checks merging of thread bitmaps
+            if (page_checksums) {
+                options.new_db_page_checksums = true;
+                options.checksum_verification = mustela::ChecksumVerification::FIRST_READ;
+            }
             db = std::make_unique<mustela::DB>(db_path, options);
 
             tx = std::make_unique<mustela::TX>(*db, false);
@@ -141,18 +161,40 @@ namespace {
             return tokens.size() > n ? tokens[n] : std::string{};
         }
 
-        mustela::Bucket& obtain_bucket(bytes const& name, bool create) {
+        mustela::Bucket& obtain_bucket(bytes const& name, bool create, mustela::BucketOptions const& options = mustela::BucketOptions{}) {
             auto it = buckets.find(name);
             if (create) {
                 assert(it == buckets.end());
             }
             if (it == buckets.end()) {
-                auto r = buckets.emplace(name, tx->get_bucket(mustela::Val(name), create));
+                auto r = buckets.emplace(name, tx->get_bucket(mustela::Val(name), create, options));
                 it = r.first;
             }
             return (*it).second;
         }
 
+        static mustela::BucketOptions parse_bucket_options(bytes const& k) {
+            auto options = mustela::BucketOptions{};
+            if (k.size() > 0) {
+                options.key_head_size = k.at(0);
+            }
+            if (k.size() > 2) {
+                options.key_size = k.at(1);
+                options.value_size = k.at(2);
+            }
+            if (k.size() > 3) {
+                options.comparator = static_cast<mustela::Comparator>(k.at(3));
+            }
+            if (k.size() > 4) {
+                options.dupsort = k.at(4) != 0;
+            }
+            if (k.size() > 6) {
+                options.fill_percent = k.at(5);
+                options.merge_percent = k.at(6);
+            }
+            return options;
+        }
+
         void drop_bucket(bytes const& name) {
             cursors.erase(name);
             buckets.erase(name);
@@ -175,9 +217,27 @@ namespace {
             auto v = from_hex(get_nth_tok(tokens, 3));
 
             if (cmd == "create-bucket") {
-                obtain_bucket(b, true);
+                obtain_bucket(b, true, parse_bucket_options(k));
             } else if (cmd == "drop-bucket") {
                 drop_bucket(b);
+            } else if (cmd == "access-advice") { // 0 - normal, 1 - random, 2 - sequential, for all transactions
+                auto advice = static_cast<mustela::AccessAdvice>(from_hex(get_nth_tok(tokens, 4)).at(0));
+                tx->set_access_advice(advice);
+                for (auto&& r : read_txs)
+                    r->set_access_advice(advice);
+            } else if (cmd == "reader-advice") { // for last reader only, it reads the same through shared or private mapping
+                auto advice = static_cast<mustela::AccessAdvice>(from_hex(get_nth_tok(tokens, 4)).at(0));
+                auto& reader = *read_txs.back();
+                std::string s1 = db_hash(reader);
+                reader.set_access_advice(advice);
+                assert(db_hash(reader) == s1);
+            } else if (cmd == "truncate-bucket") {
+                tx->truncate_bucket(mustela::Val(b));
+            } else if (cmd == "free-dropped") { // at most n pages
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                if (tx->free_dropped_pages(n)) {
+                    assert(tx->get_dropped_page_count() == 0);
+                }
             } else if (cmd == "put") {
                 obtain_bucket(b, false).put(mustela::Val(k), mustela::Val(v), false);
                 obtain_cursor(b).seek(mustela::Val(k));
@@ -190,6 +250,75 @@ namespace {
                     v_.push_back(i);
                     obtain_bucket(b, false).put(mustela::Val(k_), mustela::Val(v_), false);
                 }
+            } else if (cmd == "append") {
+                obtain_bucket(b, false).append(mustela::Val(k), mustela::Val(v));
+            } else if (cmd == "append-n") {
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                for (uint8_t i = 0; i < n; i++) {
+                    auto k_ = bytes(k);
+                    auto v_ = bytes(v);
+                    k_.push_back(i);
+                    v_.push_back(i);
+                    obtain_bucket(b, false).append(mustela::Val(k_), mustela::Val(v_));
+                }
+            } else if (cmd == "append-n-rev") { // for buckets with REVERSE_BYTEWISE comparator
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                for (int i = n - 1; i >= 0; i--) {
+                    auto k_ = bytes(k);
+                    auto v_ = bytes(v);
+                    k_.push_back(static_cast<uint8_t>(i));
+                    v_.push_back(static_cast<uint8_t>(i));
+                    obtain_bucket(b, false).append(mustela::Val(k_), mustela::Val(v_));
+                }
+            } else if (cmd == "import-n") { // into new bucket, descending keys, then even keys again with reversed values
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                mustela::BulkImportOptions import_options;
+                import_options.memory_budget = 256; // many small runs
+                import_options.thread_count = 2;
+                mustela::BulkImporter importer(*tx, mustela::Val(b), mustela::BucketOptions{}, import_options);
+                for (int pass = 0; pass != 2; ++pass)
+                    for (int i = n - 1; i >= 0; i -= pass + 1) {
+                        auto k_ = bytes(k);
+                        auto v_ = bytes(v);
+                        k_.push_back(static_cast<uint8_t>(i));
+                        v_.push_back(static_cast<uint8_t>(pass == 0 ? i : 255 - i));
+                        importer.add(mustela::Val(k_), mustela::Val(v_));
+                    }
+                importer.finish();
+            } else if (cmd == "check-import") { // n records into new buckets with options k, built full (b), appended (b01), built half full (b02)
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                std::vector<std::vector<std::pair<bytes, bytes>>> contents(3);
+                std::vector<uint64_t> leaf_counts;
+                for (uint8_t variant = 0; variant != 3; ++variant) {
+                    auto name = b;
+                    if (variant != 0)
+                        name.push_back(variant);
+                    mustela::BulkImportOptions import_options;
+                    import_options.memory_budget = 512; // several runs
+                    import_options.thread_count = 2;
+                    import_options.build_pages = variant != 1;
+                    import_options.fill_percent = variant == 2 ? 50 : 100;
+                    mustela::BulkImporter importer(*tx, mustela::Val(name), parse_bucket_options(k), import_options);
+                    for (int i = 0; i != n; ++i) { // 8-byte keys fit all comparators, several values per key
+                        uint8_t k_[8] = {0, 0, 0, 0, 0, 0, 0, static_cast<uint8_t>((i * 37) % 64)};
+                        auto v_ = bytes(v);
+                        if (!v_.empty())
+                            v_.back() = static_cast<uint8_t>(i);
+                        importer.add(mustela::Val(k_, sizeof(k_)), mustela::Val(v_));
+                    }
+                    importer.finish();
+                    mustela::Bucket bucket = tx->get_bucket(mustela::Val(name), false);
+                    mustela::Cursor cur = bucket.get_cursor();
+                    mustela::Val c_key, c_value;
+                    for (cur.first(); cur.get(&c_key, &c_value); cur.next())
+                        contents.at(variant).emplace_back(bytes(c_key.data, c_key.data + c_key.size), bytes(c_value.data, c_value.data + c_value.size));
+                    auto stats = bucket.get_stats();
+                    auto pos = stats.find("'leaf_pages': ");
+                    assert(pos != std::string::npos);
+                    leaf_counts.push_back(std::stoull(stats.substr(pos + 14)));
+                }
+                assert(!contents.at(0).empty() && contents.at(0) == contents.at(1) && contents.at(0) == contents.at(2));
+                assert(leaf_counts.at(0) <= leaf_counts.at(1) && leaf_counts.at(0) <= leaf_counts.at(2));
             } else if (cmd == "put-n-rev") {
                 auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
                 for (int i = n - 1; i >= 0; i--) {
@@ -199,6 +328,152 @@ namespace {
                     v_.push_back(static_cast<uint8_t>(i));
                     obtain_bucket(b, false).put(mustela::Val(k_), mustela::Val(v_), false);
                 }
+            } else if (cmd == "get-many-n") { // keys with suffixes 2n-1..0, compared with get
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                auto& bucket = obtain_bucket(b, false);
+                std::vector<bytes> keys;
+                for (int i = 2 * n - 1; i >= 0; i--) {
+                    keys.push_back(bytes(k));
+                    keys.back().push_back(static_cast<uint8_t>(i));
+                }
+                std::vector<mustela::Val> key_vals;
+                for (auto&& key : keys)
+                    key_vals.push_back(mustela::Val(key));
+                std::vector<mustela::Val> values;
+                std::vector<bool> found;
+                size_t found_count = bucket.get_many(key_vals, &values, &found);
+                std::vector<std::string> value_strings; // get invalidates values kept by get_many
+                for (auto&& val : values)
+                    value_strings.push_back(val.to_string());
+                size_t expected_count = 0;
+                for (size_t i = 0; i != keys.size(); ++i) {
+                    mustela::Val value;
+                    bool f = bucket.get(key_vals[i], &value);
+                    expected_count += f ? 1 : 0;
+                    assert(f == found[i] && (!f || value.to_string() == value_strings[i]));
+                }
+                assert(found_count == expected_count);
+            } else if (cmd == "replace-n") { // from key, values get suffix of their position
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                auto& c = obtain_cursor(b);
+                c.seek(mustela::Val(k));
+                for (uint8_t i = 0; i < n; i++) {
+                    auto v_ = bytes(v);
+                    v_.push_back(i);
+                    if (!c.replace(mustela::Val(v_))) {
+                        break;
+                    }
+                    c.next();
+                }
+            } else if (cmd == "insert-here-n") { // descending keys, each before the previous one
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                auto& c = obtain_cursor(b);
+                auto k_ = bytes(k);
+                k_.push_back(static_cast<uint8_t>(n - 1));
+                c.seek(mustela::Val(k_));
+                for (int i = n - 1; i >= 0; i--) {
+                    k_ = bytes(k);
+                    auto v_ = bytes(v);
+                    k_.push_back(static_cast<uint8_t>(i));
+                    v_.push_back(static_cast<uint8_t>(i));
+                    c.insert_here(mustela::Val(k_), mustela::Val(v_));
+                }
+            } else if (cmd == "check-iterator") { // ReadIterator and Cursor in both directions and after seek to k
+                auto& bucket = obtain_bucket(b, false);
+                mustela::Cursor cur = bucket.get_cursor();
+                mustela::ReadIterator it = bucket.get_read_iterator();
+                mustela::Val c_key, c_value, i_key, i_value;
+                for (int dir = 0; dir != 2; ++dir) {
+                    dir == 0 ? cur.first() : cur.last();
+                    dir == 0 ? it.first() : it.last();
+                    for (; cur.get(&c_key, &c_value); dir == 0 ? cur.next() : cur.prev()) {
+                        assert(it.get(&i_key, &i_value) && i_key == c_key && i_value == c_value);
+                        mustela::ReadIterator copy = it;
+                        dir == 0 ? it.next() : it.prev();
+                        assert(copy.get(&i_key, &i_value) && i_key == c_key);
+                    }
+                    assert(!it.get(&i_key, &i_value));
+                }
+                bool found = cur.seek(mustela::Val(k));
+                assert(it.seek(mustela::Val(k)) == found);
+                for (int i = 0; i != 3 && cur.get(&c_key, &c_value); ++i, cur.prev(), it.prev())
+                    assert(it.get(&i_key, &i_value) && i_key == c_key && i_value == c_value);
+                assert(cur.get(&c_key, &c_value) == it.get(&i_key, &i_value));
+            } else if (cmd == "check-partitions") { // scan in n partitions gives the same items as cursor, partitions in key order
+                auto& bucket = obtain_bucket(b, false);
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                std::vector<std::vector<std::pair<bytes, bytes>>> parts(n);
+                bucket.scan_partitions(n, [&](size_t partition, mustela::Val const &key, mustela::Val const &value) {
+                    parts.at(partition).emplace_back(bytes(key.data, key.data + key.size), bytes(value.data, value.data + value.size));
+                });
+                mustela::Cursor cur = bucket.get_cursor();
+                mustela::Val c_key, c_value;
+                cur.first();
+                for (auto const &part: parts)
+                    for (auto const &kv: part) {
+                        assert(cur.get(&c_key, &c_value));
+                        assert(bytes(c_key.data, c_key.data + c_key.size) == kv.first && bytes(c_value.data, c_value.data + c_value.size) == kv.second);
+                        cur.next();
+                    }
+                assert(!cur.get(&c_key, &c_value));
+            } else if (cmd == "del-range") { // keys in [k, v)
+                obtain_bucket(b, false).del_range(mustela::Val(k), mustela::Val(v));
+            } else if (cmd == "check-dup-prefix") { // values shorter than dup_value_prefix_size, of it and longer are all found
+                auto& bucket = obtain_bucket(b, false);
+                auto prefix_size = bucket.dup_value_prefix_size(mustela::Val(k));
+                assert(prefix_size != 0);
+                for (auto size : {prefix_size - 1, prefix_size, prefix_size + 1, 3 * prefix_size}) {
+                    auto value = bytes(size, 0xab);
+                    assert(bucket.put(mustela::Val(k), mustela::Val(value), true));
+                    assert(!bucket.put(mustela::Val(k), mustela::Val(value), true));
+                    mustela::Cursor cur = bucket.get_cursor();
+                    mustela::Val c_key, c_value;
+                    assert(cur.seek_dup(mustela::Val(k), mustela::Val(value)) && cur.get(&c_key, &c_value) && c_value == mustela::Val(value));
+                }
+                auto zeros = bytes(k.size(), 0); // each zero byte of key is stored twice
+                assert(bucket.dup_value_prefix_size(mustela::Val(zeros)) + k.size() == prefix_size);
+            } else if (cmd == "check-dups") { // n values of new key k from v, compared with set after puts and after deleting every third
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                auto& bucket = obtain_bucket(b, false);
+                std::set<bytes> values;
+                for (size_t i = 0; i != n; ++i) { // short, cut and in overflow pages, often with common start
+                    auto v_ = v;
+                    v_.resize(v.size() + (i * 29) % 97, static_cast<uint8_t>(i));
+                    bucket.put(mustela::Val(k), mustela::Val(v_), false);
+                    values.insert(v_);
+                }
+                auto check = [&]() {
+                    mustela::Cursor cur = bucket.get_cursor();
+                    mustela::ReadIterator it = bucket.get_read_iterator();
+                    mustela::Val c_key, c_value, i_key, i_value;
+                    assert(cur.seek(mustela::Val(k)) && it.seek(mustela::Val(k)) && cur.count_dups() == values.size());
+                    assert(bucket.get(mustela::Val(k), &c_value) && c_value == mustela::Val(*values.begin()));
+                    size_t i = 0;
+                    for (auto const& value : values) {
+                        assert(cur.get(&c_key, &c_value) && c_key == mustela::Val(k) && c_value == mustela::Val(value));
+                        assert(it.get(&i_key, &i_value) && i_key == c_key && i_value == c_value);
+                        mustela::Cursor found = bucket.get_cursor();
+                        assert(found.seek_dup(mustela::Val(k), mustela::Val(value)) && found == cur);
+                        assert(cur.next_dup() == (++i != values.size()));
+                        it.next();
+                    }
+                    for (auto vit = values.rbegin(); vit != values.rend(); ++vit, cur.prev()) // back from the last value
+                        assert(cur.get(&c_key, &c_value) && c_key == mustela::Val(k) && c_value == mustela::Val(*vit));
+                };
+                check();
+                size_t i = 0;
+                for (auto vit = values.begin(); vit != values.end(); ++i) {
+                    if (i % 3 != 0) {
+                        ++vit;
+                        continue;
+                    }
+                    assert(obtain_cursor(b).del_dup(mustela::Val(k), mustela::Val(*vit)));
+                    assert(!obtain_cursor(b).del_dup(mustela::Val(k), mustela::Val(*vit)));
+                    vit = values.erase(vit);
+                }
+                check();
+            } else if (cmd == "del-dup") {
+                obtain_cursor(b).del_dup(mustela::Val(k), mustela::Val(v));
             } else if (cmd == "del" || cmd == "del-cursor") {
                 obtain_cursor(b).seek(mustela::Val(k));
                 if (cmd == "del") {
@@ -230,6 +505,86 @@ namespace {
                 raise(SIGKILL);
             } else if (cmd == "noop") {
                 return db_hash(*tx);
+            } else if (cmd == "check-incremental") { // steps of n pages until all buckets are walked, in last reader if any
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                mustela::TX& txn = read_txs.empty() ? *tx : *read_txs.back();
+                auto passes = checker.get_pass_count();
+                while (checker.get_pass_count() == passes) {
+                    checker.step(txn, n);
+                }
+                assert(checker.get_findings().empty());
+            } else if (cmd == "check-incremental-loop") { // steps of n pages, each in new reader at the same address with own advice
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                auto passes = checker.get_pass_count();
+                while (checker.get_pass_count() == passes) {
+                    mustela::TX txn(*db, true);
+                    txn.set_access_advice(mustela::AccessAdvice::RANDOM);
+                    checker.step(txn, n);
+                }
+                assert(checker.get_findings().empty());
+            } else if (cmd == "check-extent-set") { // n thousands of random operations compared with std::set
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                mustela::ExtentSet::debug_test(size_t(n) * 1000);
+            } else if (cmd == "check-corrupt-read") { // k=v in separate DB with checksums, v is corrupted in file, every read throws
+                std::string path = db_path + "-corrupt";
+                std::remove(path.c_str());
+                std::remove((path + ".lock").c_str());
+                mustela::DBOptions options;
+                options.new_db_page_size = mustela::MIN_PAGE_SIZE;
+                options.new_db_page_checksums = true;
+                options.checksum_verification = mustela::ChecksumVerification::FIRST_READ;
+                mustela::DB cdb(path, options);
+                {
+                    mustela::TX wtx(cdb, false);
+                    wtx.get_bucket(mustela::Val(b)).put(mustela::Val(k), mustela::Val(v), false);
+                    wtx.commit();
+                }
+                mustela::TX reader(cdb, true);
+                auto read_value = [&]() {
+                    mustela::Val value;
+                    assert(reader.get_bucket(mustela::Val(b), false).get(mustela::Val(k), &value));
+                    return bytes(value.data, value.data + value.size);
+                };
+                std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+                bytes contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                std::vector<size_t> offsets; // old copies of page are corrupted too
+                for (auto it = std::search(contents.begin(), contents.end(), v.begin(), v.end()); it != contents.end(); it = std::search(it + 1, contents.end(), v.begin(), v.end()))
+                    offsets.push_back(it - contents.begin());
+                assert(!offsets.empty());
+                auto flip = [&]() {
+                    for (auto pos : offsets) {
+                        contents[pos] ^= 0x5a;
+                        file.seekp(pos);
+                        file.put(contents[pos]);
+                    }
+                    file.flush();
+                };
+                flip();
+                reader.debug_forget_verified_pages();
+                for (int i = 0; i != 2; ++i) { // failed check must not mark page as verified
+                    bool thrown = false;
+                    try {
+                        read_value();
+                    } catch (const mustela::Exception&) {
+                        thrown = true;
+                    }
+                    assert(thrown);
+                }
+                flip();
+                reader.debug_forget_verified_pages();
+                assert(read_value() == v);
+                std::remove(path.c_str());
+                std::remove((path + ".lock").c_str());
+            } else if (cmd == "relocate-tail") { // at most n pages, contents must stay the same
+                auto n = from_hex(get_nth_tok(tokens, 4)).at(0);
+                if (relocated_file_size == 0)
+                    relocated_file_size = get_file_size();
+                std::string s1 = db_hash(*tx);
+                auto moved = tx->relocate_tail(n);
+                assert(moved <= n);
+                assert(db_hash(*tx) == s1);
+            } else if (cmd == "ensure-file-shrunk") { // since first relocate-tail
+                assert(get_file_size() < relocated_file_size);
             } else if (cmd == "create-reader") {
                 read_txs.push_back(std::make_unique<mustela::TX>(*db, true));
             } else if (cmd == "ensure-hash") {
@@ -253,8 +608,8 @@ namespace {
     };
 }
 
-void run_test_driver(std::string const& db_path, std::istream& scenario) {
-    auto state = test_state(db_path);
+void run_test_driver(std::string const& db_path, std::istream& scenario, bool page_checksums) {
+    auto state = test_state(db_path, page_checksums);
     std::cerr << ">>> test (re-)start " << state.db->max_bucket_name_size() << " >>> " << state.db->max_key_size() <<  " >>>" << std::endl;
 
     for (std::string line; std::getline(scenario, line, '\n');) {
@@ -266,6 +621,15 @@ void run_test_driver(std::string const& db_path, std::istream& scenario) {
             tokens.push_back(tok);
         }
 
-        std::cout << state.handle_test_command(tokens) << "\n";
+        try {
+            std::cout << state.handle_test_command(tokens) << "\n";
+        } catch (const mustela::Exception& ex) {
+            // checksums lower max_key_size, so scenarios written for plain pages may have keys that no longer fit
+            if (!page_checksums || ex.what() != "Key size too big in Bucket::put")
+                throw;
+            std::cerr << ">>> skipped, key exceeds checksummed limit " << state.db->max_key_size() << std::endl;
+            state.tx->check_database(nullptr, false);
+            std::cout << "skipped\n";
+        }
     }
 }
@@ -1,6 +1,9 @@
 #include "mustela.hpp"
 #include <algorithm>
 #include <iostream>
+#include <thread>
+#include <condition_variable>
+#include <exception>
 #include <sys/mman.h>
 
 // MEGA TODO - check all cursor updates for order invariance
@@ -10,10 +13,12 @@ using namespace mustela;
 static const bool BULK_LOADING = true;
 
 static const char bucket_prefix = 'b';
+static const char dropped_prefix = 'd'; // + root pid, trees of dropped buckets waiting to be freed
 
 int TX::debug_mirror_counter = 0;
 
-TX::TX(DB & my_db, bool read_only):my_db(my_db), read_only(read_only), page_size(my_db.page_size) {
+TX::TX(DB & my_db, bool read_only):my_db(my_db), read_only(read_only), page_size(my_db.page_size), page_layout_size(my_db.page_size - my_db.page_checksum_size),
+	verify_on_read(my_db.page_checksum_size != 0 && my_db.options.checksum_verification == ChecksumVerification::FIRST_READ) {
 	if( !read_only && my_db.options.read_only)
 		throw Exception("Read-write transaction impossible on read-only DB");
 	my_db.start_transaction(this);
@@ -30,19 +35,138 @@ DataPage * TX::writable_page(Pid page, Pid count){
 	return (DataPage *)(wr_file_ptr + page * page_size);
 }
 
-LeafPtr TX::writable_leaf(Pid pa){
+LeafPtr TX::writable_leaf(const BucketDesc * bucket_desc, Pid pa){
 	LeafPage * result = (LeafPage *)writable_page(pa, 1);
 	ass(result->tid() == meta_page.tid, "writable_leaf is not from our transaction");
-	return LeafPtr(page_size, result);
+	return LeafPtr(page_layout_size, result, bucket_desc->get_options());
 }
-NodePtr TX::writable_node(Pid pa){
+NodePtr TX::writable_node(const BucketDesc * bucket_desc, Pid pa){
 	NodePage * result = (NodePage *)writable_page(pa, 1);
 	ass(result->tid() == meta_page.tid, "writable_node is not from our transaction");
-	return NodePtr(page_size, result);
+	return NodePtr(page_layout_size, result, bucket_desc->get_options());
 }
 char * TX::writable_overflow(Pid pa, Pid count){
 	return (char *)writable_page(pa, count);
 }
+void TX::prefetch_pages(Pid page, Pid count)const{
+	// We can only madvise on phys page limits, find them
+	const size_t physical_page_size = my_db.physical_page_size;
+	size_t low = page * page_size;
+	size_t high = (page + count) * page_size;
+	low = (low / physical_page_size) * physical_page_size;
+	high = ((high + physical_page_size - 1) / physical_page_size) * physical_page_size;
+	madvise(const_cast<char *>(c_file_ptr) + low, high - low, MADV_WILLNEED); // only advice, errors ignored
+}
+void TX::scan_readahead(const BucketDesc * bucket_desc, Pid node_pid, int item){
+	const int window = static_cast<int>(my_db.options.scan_readahead_leaves);
+	if( window == 0 || access_advice == AccessAdvice::RANDOM )
+		return;
+	CNodePtr nap = readable_node(bucket_desc, node_pid);
+	if( bucket_desc->overflow_page_count != 0 ){ // values of leaf will be read soon
+		CLeafPtr dap = readable_leaf(bucket_desc, nap.get_value(item));
+		for(int di = 0; di != dap.size(); ++di){
+			Pid overflow_page;
+			size_t overflow_size;
+			Tid overflow_tid;
+			dap.get_item_size(di, overflow_page, overflow_size, overflow_tid);
+			if( overflow_page )
+				prefetch_pages(overflow_page, get_overflow_count(overflow_size));
+		}
+	}
+	// Every window leaves we prefetch next window, so scan stays at least window - 1 leaves behind prefetch
+	int from = item + 1 + window;
+	if( item == -1 ) // entered node, nothing prefetched yet
+		from = 0;
+	else if( (item + 1) % window != 0 )
+		return;
+	const int to = std::min(item + 1 + 2 * window, nap.size());
+	Pid run_page = 0, run_count = 0; // leaves of sequentially built trees are contiguous, one madvise per run
+	for(int pi = from; pi < to; ++pi){
+		Pid pa = nap.get_value(pi);
+		if( run_count != 0 && pa == run_page + run_count ){
+			run_count += 1;
+			continue;
+		}
+		if( run_count != 0 )
+			prefetch_pages(run_page, run_count);
+		run_page = pa;
+		run_count = 1;
+	}
+	if( run_count != 0 )
+		prefetch_pages(run_page, run_count);
+}
+void TX::set_access_advice(AccessAdvice advice){
+	my_db.set_transaction_advice(this, advice);
+}
+bool TX::is_page_checksum_valid(Pid pa){
+	if( page_size == page_layout_size )
+		return true; // DB without checksums
+	const char * raw_page = (const char *)readable_page(pa, 1);
+	if( !read_only && ((const DataPage *)raw_page)->tid() == meta_page.tid )
+		return true; // checksum is written at commit
+	uint32_t stored;
+	unpack_uint_le(raw_page + page_layout_size, page_size - page_layout_size, stored);
+	return stored == crc32c(0, raw_page, page_layout_size);
+}
+void TX::verify_page_checksum(Pid pa){
+	{
+		std::lock_guard<std::mutex> lock(verified_pages_mutex);
+		if( verified_pages.count(pa) != 0 )
+			return;
+	}
+	if( !is_page_checksum_valid(pa) ) // corrupted page is not remembered, so each read throws
+		throw Exception("Page checksum mismatch - database corrupted");
+	std::lock_guard<std::mutex> lock(verified_pages_mutex);
+	verified_pages.insert(pa);
+}
+bool TX::is_overflow_checksum_valid(const CLeafPtr & dap, int item){
+	if( page_size == page_layout_size )
+		return true; // DB without checksums
+	Pid overflow_page;
+	size_t overflow_size;
+	Tid overflow_tid;
+	dap.get_item_size(item, overflow_page, overflow_size, overflow_tid);
+	if( !overflow_page || (!read_only && overflow_tid == meta_page.tid) )
+		return true; // checksum is written at commit
+	return dap.get_overflow_checksum(item) == crc32c(0, readable_overflow(overflow_page, get_overflow_count(overflow_size)), overflow_size);
+}
+void TX::verify_overflow_checksum(const CLeafPtr & dap, int item){
+	Pid overflow_page;
+	size_t overflow_size;
+	Tid overflow_tid;
+	dap.get_item_size(item, overflow_page, overflow_size, overflow_tid);
+	{
+		std::lock_guard<std::mutex> lock(verified_pages_mutex);
+		if( verified_pages.count(overflow_page) != 0 )
+			return;
+	}
+	if( !is_overflow_checksum_valid(dap, item) )
+		throw Exception("Overflow checksum mismatch - database corrupted");
+	std::lock_guard<std::mutex> lock(verified_pages_mutex);
+	verified_pages.insert(overflow_page);
+}
+void TX::write_page_checksums(const BucketDesc * bucket_desc, Pid pa, size_t height){
+	// Copy-on-write makes all parents of dirty pages dirty, so we visit only dirty subtrees
+	if( readable_page(pa, 1)->tid() != meta_page.tid )
+		return;
+	if( height != 0 ){
+		CNodePtr nap = readable_node(bucket_desc, pa);
+		for(int pi = -1; pi != nap.size(); ++pi)
+			write_page_checksums(bucket_desc, nap.get_value(pi), height - 1);
+	}else if( bucket_desc->overflow_page_count != 0 ){ // overflow values written by us are checksummed in their items
+		LeafPtr wr_dap = writable_leaf(bucket_desc, pa);
+		for(int item = 0; item != wr_dap.size(); ++item){
+			Pid overflow_page;
+			size_t overflow_size;
+			Tid overflow_tid;
+			wr_dap.get_item_size(item, overflow_page, overflow_size, overflow_tid);
+			if( overflow_page && overflow_tid == meta_page.tid )
+				wr_dap.set_overflow_checksum(item, crc32c(0, readable_overflow(overflow_page, get_overflow_count(overflow_size)), overflow_size));
+		}
+	}
+	char * raw_page = (char *)writable_page(pa, 1);
+	pack_uint_le(raw_page + page_layout_size, page_size - page_layout_size, crc32c(0, raw_page, page_layout_size));
+}
 void TX::mark_free_in_future_page(Pid page, Pid contigous_count, Tid page_tid){
 	free_list.mark_free_in_future_page(page, contigous_count, this->tid() == page_tid);
 }
@@ -84,8 +208,8 @@ DataPage * TX::make_pages_writable(Cursor & cur, size_t height){
 	}
 	mark_free_in_future_page(old_page, 1, dap->tid());
 	Pid new_page = get_free_page(1);
-	for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
-		if( c->get_current()->bucket_desc == cur.bucket_desc && c->get_current()->at(height).pid == old_page )
+	for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+		if( c->get_current()->at(height).pid == old_page )
 			c->get_current()->at(height).pid = new_page;
 	DataPage * wr_dap = writable_page(new_page, 1);
 	memcpy(wr_dap, dap, page_size);
@@ -95,23 +219,22 @@ DataPage * TX::make_pages_writable(Cursor & cur, size_t height){
 		cur.bucket_desc->root_page = new_page;
 		return wr_dap;
 	}
-	NodePtr wr_parent(page_size, (NodePage *)make_pages_writable(cur, height + 1));
+	NodePtr wr_parent(page_layout_size, (NodePage *)make_pages_writable(cur, height + 1), cur.bucket_desc->get_options());
 	wr_parent.set_value(cur.at(height + 1).item, new_page);
 	return wr_dap;
 }
 void TX::new_increase_height(Cursor & cur){
 	ass(cur.bucket_desc->height + 1 <= MAX_HEIGHT, "Maximum bucket height reached, congratulation!");
 	const Pid wr_root_pid = get_free_page(1);
-	NodePtr wr_root = writable_node(wr_root_pid);
+	NodePtr wr_root = writable_node(cur.bucket_desc, wr_root_pid);
 	cur.bucket_desc->node_page_count += 1;
 	wr_root.init_dirty(meta_page.tid);
 	Pid previous_root = cur.bucket_desc->root_page;
 	wr_root.set_value(-1, previous_root);
 	cur.bucket_desc->root_page = wr_root_pid;
 	cur.bucket_desc->height += 1;
-	for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
-		if(c->get_current()->bucket_desc == cur.bucket_desc)
-			c->get_current()->at(cur.bucket_desc->height) = Cursor::Element{cur.bucket_desc->root_page, -1};
+	for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+		c->get_current()->at(cur.bucket_desc->height) = Cursor::Element{cur.bucket_desc->root_page, -1};
 }
 static size_t get_item_size_with_insert(const NodePtr & wr_dap, int pos, int insert_pos, size_t required_size1, size_t required_size2){
 	if(pos == insert_pos)
@@ -141,7 +264,13 @@ static ValPid get_kv_with_insert(const NodePtr & wr_dap, int pos, int insert_pos
 	}
 	return wr_dap.get_kv(pos);
 }
-static void find_best_node_split(int & left_split, int & right_split, const NodePtr & wr_dap, int insert_index, size_t required_size1, size_t required_size2){
+// Parts grow towards each other, left part gets fill_percent share of items
+static bool prefer_left_part(size_t left_size, size_t right_size, size_t capacity, size_t fill_percent){
+	if( left_size > capacity )
+		return false;
+	return right_size > capacity || left_size * (100 - fill_percent) <= right_size * fill_percent;
+}
+static void find_best_node_split(int & left_split, int & right_split, const NodePtr & wr_dap, int insert_index, size_t required_size1, size_t required_size2, size_t fill_percent){
 	const int size_with_insert = wr_dap.size() + 1 + (required_size2 != 0 ? 1 : 0);
 	size_t left_size = get_item_size_with_insert(wr_dap, 0, insert_index, required_size1, required_size2);
 	size_t right_size = get_item_size_with_insert(wr_dap, size_with_insert - 1, insert_index, required_size1, required_size2);
@@ -150,13 +279,13 @@ static void find_best_node_split(int & left_split, int & right_split, const Node
 	size_t left_add = get_item_size_with_insert(wr_dap, left_split, insert_index, required_size1, required_size2);
 	size_t right_add = get_item_size_with_insert(wr_dap, right_split - 1, insert_index, required_size1, required_size2);
 	while(left_split + 1 != right_split){
-		if( left_size + left_add <= wr_dap.capacity() && left_size + left_add <= right_size + right_add ){
+		if( prefer_left_part(left_size + left_add, right_size + right_add, wr_dap.capacity(), fill_percent) ){
 			left_split += 1;
 			left_size += left_add;
 			left_add = get_item_size_with_insert(wr_dap, left_split, insert_index, required_size1, required_size2);
 			continue;
 		}
-		if( right_size + right_add <= wr_dap.capacity() && right_size + right_add <= left_size + left_add ){
+		if( right_size + right_add <= wr_dap.capacity() ){
 			right_split -= 1;
 			right_size += right_add;
 			right_add = get_item_size_with_insert(wr_dap, right_split - 1, insert_index, required_size1, required_size2);
@@ -167,9 +296,9 @@ static void find_best_node_split(int & left_split, int & right_split, const Node
 }
 void TX::new_insert2node(Cursor & cur, size_t height, ValPid insert_kv1, ValPid insert_kv2){
 	auto path_el = cur.at(height);
-	NodePtr wr_dap = writable_node(path_el.pid);
-	const size_t required_size1 = get_item_size(page_size, insert_kv1.key, insert_kv1.pid);
-	const size_t required_size2 = insert_kv2.key.data ? get_item_size(page_size, insert_kv2.key, insert_kv2.pid) : 0;
+	NodePtr wr_dap = writable_node(cur.bucket_desc, path_el.pid);
+	const size_t required_size1 = wr_dap.get_item_size(insert_kv1.key, insert_kv1.pid);
+	const size_t required_size2 = insert_kv2.key.data ? wr_dap.get_item_size(insert_kv2.key, insert_kv2.pid) : 0;
 	if( wr_dap.free_capacity() >= required_size1 + required_size2 ){
 		wr_dap.insert_at(path_el.item, insert_kv1.key, insert_kv1.pid);
 		if(insert_kv2.key.data)
@@ -184,13 +313,13 @@ void TX::new_insert2node(Cursor & cur, size_t height, ValPid insert_kv1, ValPid
 	auto path_pa = cur.at(height + 1);
 	const int insert_index = path_el.item;
 	int left_split = 0, right_split = 0;
-	find_best_node_split(left_split, right_split, wr_dap, insert_index, required_size1, required_size2);
+	find_best_node_split(left_split, right_split, wr_dap, insert_index, required_size1, required_size2, cur.bucket_desc->get_options().fill_percent);
 	// We must leave at least 1 key to the left and to the right
 	if( BULK_LOADING && insert_index == wr_dap.size() ){ // Bulk loading?
 		bool right_sibling = false; // No right sibling when inserting into root node
 		if( cur.bucket_desc->height > height ){
 //			auto & path_pa = cur.at(height + 1);
-			CNodePtr wr_parent = readable_node(path_pa.pid);
+			CNodePtr wr_parent = readable_node(cur.bucket_desc, path_pa.pid);
 			right_sibling = path_pa.item + 1 < wr_parent.size();
 		}
 		if( !right_sibling) {
@@ -199,12 +328,12 @@ void TX::new_insert2node(Cursor & cur, size_t height, ValPid insert_kv1, ValPid
 		}
 	}
 	const Pid wr_right_pid = get_free_page(1);
-	NodePtr wr_right = writable_node(wr_right_pid);
+	NodePtr wr_right = writable_node(cur.bucket_desc, wr_right_pid);
 	cur.bucket_desc->node_page_count += 1;
 	wr_right.init_dirty(meta_page.tid);
 	for(int i = right_split; i != size_with_insert; ++i)
 		wr_right.append(get_kv_with_insert(wr_dap, i, insert_index, insert_kv1, insert_kv2));
-	for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+	for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 		c->get_current()->on_insert(cur.bucket_desc, height + 1, path_pa.pid, path_pa.item + 1);
 		c->get_current()->on_split(cur.bucket_desc, height, path_el.pid, wr_right_pid, left_split, 1); // !!!
 	}
@@ -230,76 +359,144 @@ void TX::new_insert2node(Cursor & cur, size_t height, ValPid insert_kv1, ValPid
 			wr_dap.insert_at(insert_index + 1, insert_kv2);
 	}
 }
-static size_t get_item_size_with_insert(const LeafPtr & wr_dap, int pos, int insert_pos, size_t required_size){
-	if(pos == insert_pos)
-		return required_size;
+static ValVal get_kv_with_insert(const LeafPtr & wr_dap, int pos, int insert_pos, std::string & key_buf){
+	ass(pos != insert_pos, "Insert2Leaf does not have data for replace item");
 	if(pos > insert_pos)
 		pos -= 1;
-	return wr_dap.get_item_size(pos);
+	Pid op;
+	return wr_dap.get_kv(pos, op, key_buf);
 }
-static ValVal get_kv_with_insert(const LeafPtr & wr_dap, int pos, int insert_pos){
-	ass(pos != insert_pos, "Insert2Leaf does not have data for replace item");
+static Val get_key_with_insert(const LeafPtr & wr_dap, int pos, int insert_pos, Val insert_key, std::string & key_buf){
+	if(pos == insert_pos)
+		return insert_key;
 	if(pos > insert_pos)
 		pos -= 1;
-	Pid op;
-	return wr_dap.get_kv(pos, op);
+	return wr_dap.get_key(pos, key_buf);
+}
+static Val get_prefix_with_insert(const LeafPtr & wr_dap, int begin, int end, int insert_pos, Val insert_key, std::string & key_buf){
+	// keys are sorted, so common prefix of first and last keys is common for all keys in range
+	if( !has_prefix_order(wr_dap.options.comparator) )
+		return Val();
+	std::string last_buf;
+	Val first_key = get_key_with_insert(wr_dap, begin, insert_pos, insert_key, key_buf);
+	Val last_key = get_key_with_insert(wr_dap, end - 1, insert_pos, insert_key, last_buf);
+	return Val(first_key.data, first_key.common_prefix_size(last_key));
 }
+// Separators between nodes cannot be shortened, because we do not know keys in subtrees
+static Val get_separator(const CLeafPtr & left, const CLeafPtr & right, std::string & key_buf){
+	std::string left_buf;
+	return get_leaf_separator(left.options.comparator, left.get_key(left.size() - 1, left_buf), right.get_key(0, key_buf));
+}
+// Part of splitting leaf, sized as if stored with prefix common to its keys
+// Parts grow from the anchor item (first for left part, last for right part)
+class LeafSplitPart {
+public:
+	LeafSplitPart(const LeafPtr & wr_dap, int insert_pos, Val insert_key, size_t insert_value_size, int anchor_pos):
+		wr_dap(wr_dap), insert_pos(insert_pos), insert_key(insert_key), insert_value_size(insert_value_size), anchor_pos(anchor_pos){
+		anchor = get_key_with_insert(wr_dap, anchor_pos, insert_pos, insert_key, anchor_buf);
+		prefix_size = has_prefix_order(wr_dap.options.comparator) ? anchor.size : 0;
+		size = prefix_size;
+	}
+	size_t size_with(int pos){ // size of part if item at pos is added
+		next_prefix_size = std::min(prefix_size, anchor.common_prefix_size(get_key_with_insert(wr_dap, pos, insert_pos, insert_key, key_buf)));
+		if( next_prefix_size == prefix_size )
+			return size + get_item_size(pos, prefix_size);
+		// Rare, all items grow by shorter prefix
+		size_t result = next_prefix_size;
+		for(int i = std::min(anchor_pos, pos); i <= std::max(anchor_pos, pos); ++i)
+			result += get_item_size(i, next_prefix_size);
+		return result;
+	}
+	void add(size_t new_size){ // must be called after size_with(pos)
+		prefix_size = next_prefix_size;
+		size = new_size;
+	}
+private:
+	size_t get_item_size(int pos, size_t with_prefix_size)const{
+		if(pos == insert_pos){
+			bool overflow = false;
+			return wr_dap.get_item_size(with_prefix_size, insert_key, insert_value_size, overflow);
+		}
+		if(pos > insert_pos)
+			pos -= 1;
+		return wr_dap.get_item_size(pos, with_prefix_size);
+	}
+	const LeafPtr & wr_dap;
+	const int insert_pos;
+	const Val insert_key;
+	const size_t insert_value_size;
+	const int anchor_pos;
+	std::string anchor_buf;
+	std::string key_buf;
+	Val anchor;
+	size_t prefix_size = 0;
+	size_t size = 0;
+	size_t next_prefix_size = 0;
+};
 char * TX::new_insert2leaf(Cursor & cur, Val insert_key, size_t insert_value_size, bool * overflow){
 	auto path_el = cur.at(0);
-	LeafPtr wr_dap = writable_leaf(path_el.pid);
-	const size_t required_size = wr_dap.get_item_size(insert_key, insert_value_size, *overflow);
-	if( required_size <= wr_dap.free_capacity() ) {
+	LeafPtr wr_dap = writable_leaf(cur.bucket_desc, path_el.pid);
+	// If insert_key does not have page prefix, all items will grow
+	const size_t prefix_size = wr_dap.get_insert_prefix_size(insert_key);
+	const size_t required_size = wr_dap.get_item_size(prefix_size, insert_key, insert_value_size, *overflow);
+	if( wr_dap.data_size(prefix_size) + required_size <= wr_dap.capacity() ) {
 		return wr_dap.insert_at(path_el.item, insert_key, insert_value_size, *overflow);
 	}
 	if(cur.bucket_desc->height == 0)
 		new_increase_height(cur);
 	path_el = cur.at(0); // Could change in increase height
 	auto path_pa = cur.at(1);
-	size_t left_size = 0;
-	size_t right_size = 0;
 	const int size_with_insert = wr_dap.size() + 1;
 	const int insert_index = path_el.item;
 	int left_split = 0;
 	int right_split = size_with_insert;
-	size_t left_add = get_item_size_with_insert(wr_dap, left_split, insert_index, required_size);
-	size_t right_add = get_item_size_with_insert(wr_dap, right_split - 1, insert_index, required_size);
+	bool bulk_loading = false;
+	if( BULK_LOADING && insert_index == wr_dap.size() ){ // Bulk loading?
+		bool right_sibling = false; // No right sibling when height == 0
+		if( cur.bucket_desc->height > 0 ){
+//			auto & path_pa = cur.at(1);
+			CNodePtr wr_parent = readable_node(cur.bucket_desc, path_pa.pid);
+			right_sibling = path_pa.item + 1 < wr_parent.size();
+		}
+		bulk_loading = !right_sibling;
+	}
+	if( bulk_loading ) // Existing items stay in full left page
+		right_split = left_split = size_with_insert - 1;
+	LeafSplitPart left(wr_dap, insert_index, insert_key, insert_value_size, 0);
+	LeafSplitPart right(wr_dap, insert_index, insert_key, insert_value_size, size_with_insert - 1);
+	size_t left_add = bulk_loading ? 0 : left.size_with(left_split);
+	size_t right_add = bulk_loading ? 0 : right.size_with(right_split - 1);
+	const size_t fill_percent = cur.bucket_desc->get_options().fill_percent;
 	while(left_split != right_split){
-		if( left_size + left_add <= wr_dap.capacity() && left_size + left_add <= right_size + right_add ){
+		if( prefer_left_part(left_add, right_add, wr_dap.capacity(), fill_percent) ){
+			left.add(left_add);
 			left_split += 1;
-			left_size += left_add;
-			left_add = get_item_size_with_insert(wr_dap, left_split, insert_index, required_size);
+			if( left_split != right_split )
+				left_add = left.size_with(left_split);
 			continue;
 		}
-		if( right_size + right_add <= wr_dap.capacity() && right_size + right_add <= left_size + left_add ){
+		if( right_add <= wr_dap.capacity() ){
+			right.add(right_add);
 			right_split -= 1;
-			right_size += right_add;
-			right_add = get_item_size_with_insert(wr_dap, right_split - 1, insert_index, required_size);
+			if( left_split != right_split )
+				right_add = right.size_with(right_split - 1);
 			continue;
 		}
 		ass(left_split + 1 == right_split, "3-split is wrong");
 		break;
 	}
-	if( BULK_LOADING && insert_index == wr_dap.size() ){ // Bulk loading?
-		bool right_sibling = false; // No right sibling when height == 0
-		if( cur.bucket_desc->height > 0 ){
-//			auto & path_pa = cur.at(1);
-			CNodePtr wr_parent = readable_node(path_pa.pid);
-			right_sibling = path_pa.item + 1 < wr_parent.size();
-		}
-		if( !right_sibling)
-			right_split = left_split = size_with_insert - 1;
-	}
+	std::string key_buf;
 	const Pid wr_right_pid = get_free_page(1);
-	LeafPtr wr_right = writable_leaf(wr_right_pid);
+	LeafPtr wr_right = writable_leaf(cur.bucket_desc, wr_right_pid);
 	cur.bucket_desc->leaf_page_count += 1;
-	wr_right.init_dirty(meta_page.tid);
+	wr_right.init_dirty(meta_page.tid, get_prefix_with_insert(wr_dap, right_split, size_with_insert, insert_index, insert_key, key_buf));
 	char * result = nullptr;
 	for(int i = right_split; i != size_with_insert; ++i)
 		if( i == insert_index)
 			result = wr_right.insert_at(wr_right.size(), insert_key, insert_value_size, *overflow);
 		else
-			wr_right.append(get_kv_with_insert(wr_dap, i, insert_index));
-	for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+			wr_right.append(get_kv_with_insert(wr_dap, i, insert_index, key_buf));
+	for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 		c->get_current()->on_insert(cur.bucket_desc, 1, path_pa.pid, path_pa.item + 1);
 		c->get_current()->on_split(cur.bucket_desc, 0, path_el.pid, wr_right_pid, right_split, 0);
 	}
@@ -307,14 +504,14 @@ char * TX::new_insert2leaf(Cursor & cur, Val insert_key, size_t insert_value_siz
 	LeafPtr wr_middle;
 	if(left_split + 1 == right_split){
 		wr_middle_pid = get_free_page(1);
-		wr_middle = writable_leaf(wr_middle_pid);
+		wr_middle = writable_leaf(cur.bucket_desc, wr_middle_pid);
 		cur.bucket_desc->leaf_page_count += 1;
-		wr_middle.init_dirty(meta_page.tid);
+		wr_middle.init_dirty(meta_page.tid, get_prefix_with_insert(wr_dap, left_split, right_split, insert_index, insert_key, key_buf));
 		if( left_split == insert_index)
 			result = wr_middle.insert_at(wr_middle.size(), insert_key, insert_value_size, *overflow);
 		else
-			wr_middle.append(get_kv_with_insert(wr_dap, left_split, insert_index));
-		for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+			wr_middle.append(get_kv_with_insert(wr_dap, left_split, insert_index, key_buf));
+		for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 			c->get_current()->on_insert(cur.bucket_desc, 1, path_pa.pid, path_pa.item + 1);
 			c->get_current()->on_split(cur.bucket_desc, 0, path_el.pid, wr_middle_pid, left_split, 0);
 		}
@@ -337,15 +534,16 @@ char * TX::new_insert2leaf(Cursor & cur, Val insert_key, size_t insert_value_siz
 	Cursor truncated_validity(cur); // truncated_validity will not be valid below height
 	truncated_validity.at(1).item = path_pa.item + 1; // original item
 	truncated_validity.debug_set_truncated_validity_guard();
+	std::string right_buf;
 	if(left_split + 1 == right_split){
-		new_insert2node(truncated_validity, 1, ValPid(wr_middle.get_key(0), wr_middle_pid), ValPid(wr_right.get_key(0), wr_right_pid));
+		new_insert2node(truncated_validity, 1, ValPid(get_separator(wr_dap, wr_middle, key_buf), wr_middle_pid), ValPid(get_separator(wr_middle, wr_right, right_buf), wr_right_pid));
 	}else{
-		new_insert2node(truncated_validity, 1, ValPid(wr_right.get_key(0), wr_right_pid));
+		new_insert2node(truncated_validity, 1, ValPid(get_separator(wr_dap, wr_right, right_buf), wr_right_pid));
 	}
 	return result;
 }
 void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
-	if( wr_dap.data_size() >= wr_dap.capacity()/2 )
+	if( wr_dap.data_size() * 100 >= wr_dap.capacity() * wr_dap.options.merge_percent )
 		return;
 	if(height == cur.bucket_desc->height){ // merging root
 		if( wr_dap.size() != 0) // wait until only key at -1 offset remains, make it new root
@@ -355,14 +553,13 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 		cur.bucket_desc->node_page_count -= 1;
 		cur.bucket_desc->root_page = wr_dap.get_value(-1);
 		cur.bucket_desc->height -= 1;
-		for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
-			if( c->get_current()->bucket_desc == cur.bucket_desc)
-				c->get_current()->at(height) = Cursor::Element{0, 0};
+		for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+			c->get_current()->at(height) = Cursor::Element{0, 0};
 		return;
 	}
 	auto path_el = cur.at(height);
 	auto path_pa = cur.at(height + 1);
-	NodePtr wr_parent = writable_node(path_pa.pid);
+	NodePtr wr_parent = writable_node(cur.bucket_desc, path_pa.pid);
 	ass(wr_parent.size() > 0, "Found parent node with 0 items");
 	ValPid my_kv;
 	
@@ -378,16 +575,16 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 		my_kv = wr_parent.get_kv(path_pa.item);
 		ass(my_kv.pid == path_el.pid, "merge_if_needed_node my pid in parent does not match");
 		left_sib_pid = wr_parent.get_value(path_pa.item - 1);
-		left_sib = readable_node(left_sib_pid);
+		left_sib = readable_node(cur.bucket_desc, left_sib_pid);
 		left_data_size = left_sib.data_size();
-		left_data_size += get_item_size(page_size, my_kv.key, Pid{}); // will need to insert key from parent. Achtung - 0 works only when fixed-size pids are used
+		left_data_size += wr_dap.get_item_size(my_kv.key, Pid{}); // will need to insert key from parent. Achtung - 0 works only when fixed-size pids are used
 		use_left_sib = left_data_size <= wr_dap.free_capacity();
 	}
 	if(path_pa.item + 1 < wr_parent.size()){
 		right_kv = wr_parent.get_kv(path_pa.item + 1);
-		right_sib = readable_node(right_kv.pid);
+		right_sib = readable_node(cur.bucket_desc, right_kv.pid);
 		right_data_size = right_sib.data_size();
-		right_data_size += get_item_size(page_size, right_kv.key, Pid{}); // will need to insert key from parent! Achtung - 0 works only when fixed-size pids are used
+		right_data_size += wr_dap.get_item_size(right_kv.key, Pid{}); // will need to insert key from parent! Achtung - 0 works only when fixed-size pids are used
 		use_right_sib = right_data_size <= wr_dap.free_capacity();
 	}
 	if( use_left_sib && use_right_sib && wr_dap.free_capacity() < left_data_size + right_data_size ){ // If cannot merge both, select smallest
@@ -411,13 +608,13 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 			cur2.at(height + 1).item -= 1;
 			cur2.at(height) = Cursor::Element{left_sib_pid, -1};
 			cur2.debug_set_truncated_validity_guard();
-			NodePtr wr_left(page_size, (NodePage *)make_pages_writable(cur2, height));
+			NodePtr wr_left(page_layout_size, (NodePage *)make_pages_writable(cur2, height), cur.bucket_desc->get_options());
 			const Pid wr_left_pid = cur2.at(height).pid;
 
-			const size_t required_size1 = get_item_size(page_size, my_kv.key, my_kv.pid);
+			const size_t required_size1 = wr_dap.get_item_size(my_kv.key, my_kv.pid);
 			int left_split = 0, right_split = 0;
-			find_best_node_split(left_split, right_split, wr_left, wr_left.size(), required_size1, 0);
-			for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+			find_best_node_split(left_split, right_split, wr_left, wr_left.size(), required_size1, 0, 50); // rotation balances siblings
+			for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 				c->get_current()->on_insert(cur.bucket_desc, height, path_el.pid, -1, wr_left.size() - right_split + 1);
 				c->get_current()->on_rotate_right(cur.bucket_desc, height, wr_left_pid, path_el.pid, left_split);
 			}
@@ -435,13 +632,13 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 			cur2.at(height + 1).item += 1;
 			cur2.at(height) = Cursor::Element{right_kv.pid, right_sib.size() - 1};
 			cur2.debug_set_truncated_validity_guard();
-			NodePtr wr_right(page_size, (NodePage *)make_pages_writable(cur2, height));
+			NodePtr wr_right(page_layout_size, (NodePage *)make_pages_writable(cur2, height), cur.bucket_desc->get_options());
 			const Pid wr_right_pid = cur2.at(height).pid;
 
-			const size_t required_size1 = get_item_size(page_size, right_kv.key, right_kv.pid);
+			const size_t required_size1 = wr_dap.get_item_size(right_kv.key, right_kv.pid);
 			int left_split = 0, right_split = 0;
-			find_best_node_split(left_split, right_split, wr_right, 0, required_size1, 0);
-			for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+			find_best_node_split(left_split, right_split, wr_right, 0, required_size1, 0, 50);
+			for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 				c->get_current()->on_rotate_left(cur.bucket_desc, height, wr_right_pid, path_el.pid, left_split - 1);
 				c->get_current()->on_erase(cur.bucket_desc, height, wr_right_pid, -1, left_split);
 			}
@@ -466,7 +663,7 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 		cur.bucket_desc->node_page_count -= 1;
 		wr_parent.erase(path_pa.item);
 		wr_parent.set_value(path_pa.item - 1, path_el.pid);
-		for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+		for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 			c->get_current()->on_erase(cur.bucket_desc, height + 1, path_pa.pid, path_pa.item - 1);
 			c->get_current()->on_insert(cur.bucket_desc, height, path_el.pid, -1, left_sib.size() + 1);
 			c->get_current()->on_merge(cur.bucket_desc, height, left_sib_pid, path_el.pid, 0);
@@ -475,7 +672,7 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 		path_pa = cur.at(height + 1); // path_pa was modified by code above
 	}
 	if( use_right_sib ){
-		for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+		for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 			c->get_current()->on_erase(cur.bucket_desc, height + 1, path_pa.pid, path_pa.item);
 			c->get_current()->on_merge(cur.bucket_desc, height, right_kv.pid, path_el.pid, wr_dap.size() + 1);
 		}
@@ -489,35 +686,57 @@ void TX::new_merge_node(Cursor & cur, size_t height, NodePtr wr_dap){
 	if( use_left_sib || use_right_sib )
 		new_merge_node(cur, height + 1, wr_parent);
 }
+static Val get_merged_prefix(const CLeafPtr & a, const CLeafPtr & b){ // common to all keys of both pages
+	Val a_prefix = a.get_prefix();
+	Val b_prefix = b.get_prefix();
+	if( a.size() == 0 )
+		return b_prefix;
+	if( b.size() == 0 )
+		return a_prefix;
+	return Val(a_prefix.data, a_prefix.common_prefix_size(b_prefix));
+}
+static size_t get_merged_size(const CLeafPtr & a, const CLeafPtr & b, size_t prefix_size){
+	return a.data_size(prefix_size) + b.data_size(prefix_size) - prefix_size;
+}
 void TX::new_merge_leaf(Cursor & cur, LeafPtr wr_dap){
-	if( wr_dap.data_size() >= wr_dap.capacity()/2 )
+	if( wr_dap.data_size() * 100 >= wr_dap.capacity() * wr_dap.options.merge_percent )
 		return;
 	if(cur.bucket_desc->height == 0) // root is leaf, cannot merge anyway
 		return;
 	auto path_el = cur.at(0);
 	auto path_pa = cur.at(1);
-	NodePtr wr_parent = writable_node(path_pa.pid);
+	NodePtr wr_parent = writable_node(cur.bucket_desc, path_pa.pid);
 	Pid left_sib_pid = 0;
 	CLeafPtr left_sib;
 	Pid right_sib_pid = 0;
 	CLeafPtr right_sib;
+	// Merged page will have prefix common to all merged pages
+	Val left_prefix;
+	Val right_prefix;
 	if( path_pa.item != -1){
 		left_sib_pid = wr_parent.get_value(path_pa.item - 1);
-		left_sib = readable_leaf(left_sib_pid);
-		if( wr_dap.free_capacity() < left_sib.data_size() )
+		left_sib = readable_leaf(cur.bucket_desc, left_sib_pid);
+		left_prefix = get_merged_prefix(wr_dap, left_sib);
+		if( get_merged_size(wr_dap, left_sib, left_prefix.size) > wr_dap.capacity() )
 			left_sib = CLeafPtr(); // forget about left!
 	}
 	if( path_pa.item + 1 < wr_parent.size()){
 		right_sib_pid = wr_parent.get_value(path_pa.item + 1);
-		right_sib = readable_leaf(right_sib_pid);
-		if( wr_dap.free_capacity() < right_sib.data_size() )
+		right_sib = readable_leaf(cur.bucket_desc, right_sib_pid);
+		right_prefix = get_merged_prefix(wr_dap, right_sib);
+		if( get_merged_size(wr_dap, right_sib, right_prefix.size) > wr_dap.capacity() )
 			right_sib = CLeafPtr(); // forget about right!
 	}
-	if( left_sib.page && right_sib.page && wr_dap.free_capacity() < left_sib.data_size() + right_sib.data_size() ){ // If cannot merge both, select smallest
-		if( left_sib.data_size() < right_sib.data_size() ) // <= will also work
-			right_sib = CLeafPtr();
-		else
-			left_sib = CLeafPtr();
+	Val merged_prefix = left_sib.page ? left_prefix : right_prefix;
+	if( left_sib.page && right_sib.page ){
+		merged_prefix = Val(left_prefix.data, left_prefix.common_prefix_size(right_prefix));
+		if( get_merged_size(wr_dap, left_sib, merged_prefix.size) + right_sib.data_size(merged_prefix.size) - merged_prefix.size > wr_dap.capacity() ){ // If cannot merge both, select smallest
+			if( left_sib.data_size() < right_sib.data_size() ) // <= will also work
+				right_sib = CLeafPtr();
+			else
+				left_sib = CLeafPtr();
+			merged_prefix = left_sib.page ? left_prefix : right_prefix;
+		}
 	}
 	if( wr_dap.size() == 0){
 		ass(left_sib.page || right_sib.page, "Cannot merge leaf with 0 items" );
@@ -525,13 +744,15 @@ void TX::new_merge_leaf(Cursor & cur, LeafPtr wr_dap){
 	}
 //	if( left_sib.page && right_sib.page )
 //		std::cerr << "3-way merge" << std::endl;
+	if( left_sib.page || right_sib.page )
+		wr_dap.set_prefix(merged_prefix);
 	if( left_sib.page ){
 		wr_dap.insert_range(0, left_sib, 0, left_sib.size());
 		mark_free_in_future_page(left_sib_pid, 1, left_sib.page->tid()); // unlink left, point its slot in parent to us, remove our slot in parent
 		cur.bucket_desc->leaf_page_count -= 1;
 		wr_parent.erase(path_pa.item);
 		wr_parent.set_value(path_pa.item - 1, path_el.pid);
-		for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+		for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 			c->get_current()->on_erase(cur.bucket_desc, 1, path_pa.pid, path_pa.item - 1);
 			c->get_current()->on_insert(cur.bucket_desc, 0, path_el.pid, 0, left_sib.size());
 			c->get_current()->on_merge(cur.bucket_desc, 0, left_sib_pid, path_el.pid, 0);
@@ -540,7 +761,7 @@ void TX::new_merge_leaf(Cursor & cur, LeafPtr wr_dap){
 		path_pa = cur.at(1); // path_pa was modified by code above
 	}
 	if( right_sib.page ){
-		for(IntrusiveNode<Cursor> * c = &my_cursors; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
+		for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors)){
 			c->get_current()->on_erase(cur.bucket_desc, 1, path_pa.pid, path_pa.item);
 			c->get_current()->on_merge(cur.bucket_desc, 0, right_sib_pid, path_el.pid, wr_dap.size());
 		}
@@ -552,13 +773,290 @@ void TX::new_merge_leaf(Cursor & cur, LeafPtr wr_dap){
 	if( left_sib.page || right_sib.page )
 		new_merge_node(cur, 1, wr_parent);
 }
+bool TX::is_subtree_before(const BucketDesc * bucket_desc, Pid pa, size_t height, Val key){
+	for(; height != 0; --height){ // last key is in the rightmost leaf
+		CNodePtr nap = readable_node(bucket_desc, pa);
+		pa = nap.get_value(nap.size() - 1);
+	}
+	CLeafPtr dap = readable_leaf(bucket_desc, pa);
+	std::string key_buf;
+	return dap.size() == 0 || compare_keys(dap.options.comparator, dap.get_key(dap.size() - 1, key_buf), key) < 0;
+}
+size_t TX::find_erasable_subtree(Cursor & cur, Val before_key){
+	if( cur.at(0).item != 0 )
+		return 0;
+	size_t result = 0;
+	for(size_t height = 1; height <= cur.bucket_desc->height; ++height){
+		CNodePtr nap = readable_node(cur.bucket_desc, cur.at(height).pid);
+		if( nap.size() != 0 ){ // only child cannot be unlinked, try larger subtree
+			if( !is_subtree_before(cur.bucket_desc, nap.get_value(cur.at(height).item), height - 1, before_key) )
+				break; // larger subtrees contain this one
+			result = height;
+		}
+		if( cur.at(height).item != -1 ) // cursor is not at first item of larger subtree
+			break;
+	}
+	return result;
+}
+void TX::free_subtree(BucketDesc * bucket_desc, Pid pa, size_t height, BucketMirror * mirror){
+	if( height != 0 ){
+		CNodePtr nap = readable_node(bucket_desc, pa);
+		for(int pi = -1; pi != nap.size(); ++pi)
+			free_subtree(bucket_desc, nap.get_value(pi), height - 1, mirror);
+		bucket_desc->node_page_count -= 1;
+	}else{
+		CLeafPtr dap = readable_leaf(bucket_desc, pa);
+		std::string key_buf;
+		for(int item = 0; item != dap.size(); ++item){
+			Pid overflow_page;
+			size_t overflow_size;
+			Tid overflow_tid;
+			dap.get_item_size(item, overflow_page, overflow_size, overflow_tid);
+			if( overflow_page ){
+				Pid overflow_count = get_overflow_count(overflow_size);
+				bucket_desc->overflow_page_count -= overflow_count;
+				mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
+			}
+			if( mirror )
+				ass(mirror->erase(dap.get_key(item, key_buf).to_string()) == 1, "inconsistent mirror in free_subtree");
+		}
+		bucket_desc->count -= dap.size();
+		bucket_desc->leaf_page_count -= 1;
+	}
+	mark_free_in_future_page(pa, 1, readable_page(pa, 1)->tid());
+}
+void TX::new_erase_subtree(Cursor & cur, size_t height, BucketMirror * mirror){
+	NodePtr wr_dap(page_layout_size, (NodePage *)make_pages_writable(cur, height), cur.bucket_desc->get_options());
+	auto path_el = cur.at(height);
+	ass(wr_dap.size() > 0, "Cannot erase only child of node");
+	free_subtree(cur.bucket_desc, wr_dap.get_value(path_el.item), height - 1, mirror);
+	if( path_el.item == -1 ){ // next child becomes -1 child, its key is not needed
+		wr_dap.set_value(-1, wr_dap.get_value(0));
+		wr_dap.erase(0);
+	}else
+		wr_dap.erase(path_el.item);
+	for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+		c->get_current()->on_erase_subtree(cur.bucket_desc, height, path_el.pid, path_el.item);
+	start_update(cur.bucket_desc);
+	new_merge_node(cur, height, wr_dap);
+	finish_update(cur.bucket_desc);
+}
+void TX::add_dropped_tree(BucketDesc * bucket_desc){
+	// Detached pages are never written again, so checksums of our dirty pages are final now
+	if( page_size != page_layout_size )
+		write_page_checksums(bucket_desc, bucket_desc->root_page, bucket_desc->height);
+	char keybuf[1 + sizeof(uint64_t)];
+	keybuf[0] = dropped_prefix;
+	pack_uint_be((unsigned char *)keybuf + 1, sizeof(uint64_t), bucket_desc->root_page);
+	std::string value = pack_dropped_tree(bucket_desc, std::vector<int>(bucket_desc->height, -1));
+	Bucket meta_bucket = get_meta_bucket();
+	ass(meta_bucket.put(Val(keybuf, sizeof(keybuf)), Val(value), true), "Dropped tree recorded twice");
+}
+std::string TX::pack_dropped_tree(BucketDesc * tree_desc, const std::vector<int> & resume){
+	std::string result(sizeof(BucketDesc) + resume.size() * sizeof(uint32_t), '\0');
+	tree_desc->pack(&result[0], sizeof(BucketDesc));
+	for(size_t i = 0; i != resume.size(); ++i)
+		pack_uint_le(&result[sizeof(BucketDesc) + i * sizeof(uint32_t)], sizeof(uint32_t), static_cast<uint32_t>(resume[i] + 1));
+	return result;
+}
+std::vector<int> TX::unpack_dropped_tree(Val value, BucketDesc * tree_desc){
+	ass(value.size >= sizeof(BucketDesc), "Dropped tree record too short");
+	tree_desc->unpack(value.data, sizeof(BucketDesc));
+	ass(value.size == sizeof(BucketDesc) + tree_desc->height * sizeof(uint32_t), "Dropped tree record has wrong size");
+	std::vector<int> resume(tree_desc->height);
+	for(size_t i = 0; i != resume.size(); ++i){
+		uint32_t item = 0;
+		unpack_uint_le(value.data + sizeof(BucketDesc) + i * sizeof(uint32_t), sizeof(uint32_t), item);
+		resume[i] = static_cast<int>(item) - 1;
+	}
+	return resume;
+}
+bool TX::walk_dropped_tree(BucketDesc * tree_desc, std::vector<int> & resume, Pid pa, size_t height, size_t * page_budget, MergablePageCache * pages){
+	// resume[height - 1] is next child of node on leftmost remaining path, children before it are already freed
+	if( height != 0 ){
+		CNodePtr nap = readable_node(tree_desc, pa);
+		for(int & pi = resume.at(height - 1); pi != nap.size(); ++pi){
+			if( !walk_dropped_tree(tree_desc, resume, nap.get_value(pi), height - 1, page_budget, pages) )
+				return false;
+			if( height > 1 )
+				resume.at(height - 2) = -1; // next child is walked from its first child
+		}
+		tree_desc->node_page_count -= 1;
+	}else{
+		if( *page_budget == 0 )
+			return false;
+		CLeafPtr dap = readable_leaf(tree_desc, pa);
+		for(int item = 0; item != dap.size(); ++item){
+			Pid overflow_page;
+			size_t overflow_size;
+			Tid overflow_tid;
+			dap.get_item_size(item, overflow_page, overflow_size, overflow_tid);
+			if( !overflow_page )
+				continue;
+			Pid overflow_count = get_overflow_count(overflow_size);
+			tree_desc->overflow_page_count -= overflow_count;
+			*page_budget -= std::min<size_t>(*page_budget, overflow_count);
+			if( pages )
+				pages->add_to_cache(overflow_page, overflow_count);
+			else
+				mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
+		}
+		tree_desc->count -= dap.size();
+		tree_desc->leaf_page_count -= 1;
+	}
+	*page_budget -= std::min<size_t>(*page_budget, 1);
+	if( pages ){
+		ass(is_page_checksum_valid(pa), "page checksum mismatch");
+		pages->add_to_cache(pa, 1);
+	}else
+		mark_free_in_future_page(pa, 1, readable_page(pa, 1)->tid());
+	return true;
+}
+bool TX::free_dropped_pages(size_t page_budget){
+	if( read_only )
+		throw Exception("Attempt to modify read-only transaction");
+	const Val prefix(&dropped_prefix, 1);
+	Bucket meta_bucket = get_meta_bucket();
+	while( true ){
+		Cursor cur = meta_bucket.get_cursor();
+		Val c_key, c_value;
+		cur.seek(prefix);
+		if( !cur.get(&c_key, &c_value) || !c_key.has_prefix(prefix) )
+			return true;
+		if( page_budget == 0 )
+			return false;
+		const std::string key = c_key.to_string();
+		BucketDesc tree_desc{};
+		std::vector<int> resume = unpack_dropped_tree(c_value, &tree_desc);
+		if( walk_dropped_tree(&tree_desc, resume, tree_desc.root_page, tree_desc.height, &page_budget, nullptr) ){
+			ass(tree_desc.leaf_page_count == 0 && tree_desc.node_page_count == 0 && tree_desc.overflow_page_count == 0, "Dropped tree stats differ");
+			ass(meta_bucket.del(Val(key)), "Dropped tree record not found");
+		}else
+			meta_bucket.put(Val(key), Val(pack_dropped_tree(&tree_desc, resume)), false);
+	}
+}
+Pid TX::get_dropped_page_count(){
+	Pid result = 0;
+	const Val prefix(&dropped_prefix, 1);
+	Cursor cur(this, &meta_page.meta_bucket, Val{});
+	Val c_key, c_value;
+	for(cur.seek(prefix); cur.get(&c_key, &c_value) && c_key.has_prefix(prefix); cur.next()){
+		BucketDesc tree_desc{};
+		unpack_dropped_tree(c_value, &tree_desc);
+		result += tree_desc.leaf_page_count + tree_desc.node_page_count + tree_desc.overflow_page_count;
+	}
+	return result;
+}
+bool TX::relocate_page(Cursor & cur, size_t height){
+	const Pid old_page = cur.at(height).pid;
+	const Pid lower_page = free_list.peek_free_page(1);
+	if( lower_page == 0 || lower_page >= old_page )
+		return false;
+	const DataPage * dap = readable_page(old_page, 1);
+	if( dap->tid() != meta_page.tid ){
+		make_pages_writable(cur, height); // copy goes to the lowest free page
+		return true;
+	}
+	// Page is already ours, so copy-on-write would not move it
+	const Pid new_page = get_free_page(1);
+	for(IntrusiveNode<Cursor> * c = cur.cursor_slot; !c->is_end(); c = c->get_next(&Cursor::tx_cursors))
+		if( c->get_current()->at(height).pid == old_page )
+			c->get_current()->at(height).pid = new_page;
+	memcpy(writable_page(new_page, 1), dap, page_size);
+	if(height == cur.bucket_desc->height) // node is root
+		cur.bucket_desc->root_page = new_page;
+	else {
+		NodePtr wr_parent(page_layout_size, (NodePage *)make_pages_writable(cur, height + 1), cur.bucket_desc->get_options());
+		wr_parent.set_value(cur.at(height + 1).item, new_page);
+	}
+	mark_free_in_future_page(old_page, 1, meta_page.tid); // back to free pages
+	return true;
+}
+bool TX::relocate_overflows(Cursor & cur, Pid threshold, size_t * page_budget){
+	const int count = readable_leaf(cur.bucket_desc, cur.at(0).pid).size();
+	for(int item = 0; item != count; ++item){
+		Pid overflow_page;
+		size_t overflow_size;
+		Tid overflow_tid;
+		readable_leaf(cur.bucket_desc, cur.at(0).pid).get_item_size(item, overflow_page, overflow_size, overflow_tid);
+		const Pid overflow_count = get_overflow_count(overflow_size);
+		if( !overflow_page || overflow_page + overflow_count <= threshold )
+			continue;
+		if( *page_budget < overflow_count )
+			return false;
+		const Pid lower_page = free_list.peek_free_page(overflow_count);
+		if( lower_page == 0 || lower_page >= overflow_page )
+			continue;
+		cur.at(0).item = item;
+		LeafPtr wr_dap(page_layout_size, (LeafPage *)make_pages_writable(cur, 0), cur.bucket_desc->get_options());
+		if( free_list.peek_free_page(overflow_count) >= overflow_page ) // leaf copy took it
+			continue;
+		bool overflow;
+		char * result = wr_dap.resize_value_in_place(item, overflow_size, overflow);
+		ass(result && overflow, "Overflow reference not found in TX::relocate_overflows");
+		const Pid opa = get_free_page(overflow_count);
+		memcpy(writable_overflow(opa, overflow_count), readable_overflow(overflow_page, overflow_count), overflow_count * page_size);
+		pack_overflow_ref(result, opa, tid());
+		mark_free_in_future_page(overflow_page, overflow_count, overflow_tid);
+		*page_budget -= overflow_count;
+	}
+	return true;
+}
+bool TX::relocate_subtree(Cursor & cur, size_t height, Pid threshold, size_t * page_budget){
+	if( cur.at(height).pid >= threshold ){
+		if( *page_budget == 0 )
+			return false;
+		if( relocate_page(cur, height) )
+			*page_budget -= 1;
+	}
+	if( height == 0 )
+		return cur.bucket_desc->overflow_page_count == 0 || relocate_overflows(cur, threshold, page_budget);
+	const int count = readable_node(cur.bucket_desc, cur.at(height).pid).size();
+	for(int pi = -1; pi != count; ++pi){
+		// node is reread, because it moves when first of its children moves
+		const Pid child = readable_node(cur.bucket_desc, cur.at(height).pid).get_value(pi);
+		if( height == 1 && child < threshold && cur.bucket_desc->overflow_page_count == 0 )
+			continue; // no need to read leaf
+		cur.at(height).item = pi;
+		cur.at(height - 1) = Cursor::Element{child, 0};
+		if( !relocate_subtree(cur, height - 1, threshold, page_budget) )
+			return false;
+	}
+	return true;
+}
+size_t TX::relocate_tail(size_t page_budget){
+	if( read_only )
+		throw Exception("Attempt to modify read-only transaction");
+	free_list.load_all_free_pages(this, oldest_reader_tid); // also cuts free pages at the end of file
+	// live pages at or above threshold fit into free pages below it
+	const Pid threshold = meta_page.page_count - free_list.get_free_page_count();
+	std::vector<BucketDesc *> descs{&meta_page.meta_bucket};
+	for(auto && name : get_bucket_names()){ // before moving meta bucket pages
+		Val persistent_name;
+		descs.push_back(load_bucket_desc(name, &persistent_name, false));
+	}
+	size_t budget = page_budget;
+	for(auto && bucket_desc : descs){
+		start_update(bucket_desc);
+		Cursor cur(this, bucket_desc, Val{});
+		cur.at(bucket_desc->height) = Cursor::Element{bucket_desc->root_page, 0};
+		const bool finished = relocate_subtree(cur, bucket_desc->height, threshold, &budget);
+		finish_update(bucket_desc);
+		if( !finished )
+			break;
+	}
+	meta_page_dirty = true; // commit also saves free pages cut from the end of file
+	return page_budget - budget;
+}
 void TX::commit(){
 	if(read_only)
 		return;
 	if( meta_page_dirty ) {
+		if( my_db.options.dropped_pages_per_commit != 0 )
+			free_dropped_pages(my_db.options.dropped_pages_per_commit);
 		Bucket meta_bucket = get_meta_bucket();
 		for (auto &&tit : bucket_descs) { // First write all dirty table descriptions
-			CLeafPtr dap = readable_leaf(tit.second.root_page);
+			CLeafPtr dap = readable_leaf(&tit.second, tit.second.root_page);
 			if (dap.page->tid() != meta_page.tid) // Table not dirty
 				continue;
 			std::string key = bucket_prefix + tit.first;
@@ -568,22 +1066,32 @@ void TX::commit(){
 			ass(meta_bucket.put(Val(key), value, false), "Writing table desc failed during commit");
 		}
 		free_list.commit_free_pages(this);
+		if( page_size != page_layout_size ){
+			for (auto &&tit : bucket_descs)
+				write_page_checksums(&tit.second, tit.second.root_page, tit.second.height);
+			write_page_checksums(&meta_page.meta_bucket, meta_page.meta_bucket.root_page, meta_page.meta_bucket.height);
+		}
 		my_db.commit_transaction(this, meta_page);
+		verified_pages.clear();
 	}
 	meta_page_dirty = false;
 }
 void TX::unlink_buckets_and_cursors(){
 	// Now invalidate all cursors and buckets
-	while(!my_cursors.is_end()){
-		Cursor * c = my_cursors.get_current();
-		c->my_txn = nullptr;
-		c->bucket_desc = nullptr;
-		c->tx_cursors.unlink(&Cursor::tx_cursors);
-	}
+	for(auto && cit : my_cursors)
+		while(!cit.second.is_end()){
+			Cursor * c = cit.second.get_current();
+			c->my_txn = nullptr;
+			c->bucket_desc = nullptr;
+			c->cursor_slot = nullptr;
+			c->tx_cursors.unlink(&Cursor::tx_cursors);
+		}
+	my_cursors.clear();
 	while(!my_buckets.is_end()){
 		Bucket * c = my_buckets.get_current();
 		c->my_txn = nullptr;
 		c->bucket_desc = nullptr;
+		c->cursor_slot = nullptr;
 		c->tx_buckets.unlink(&Bucket::tx_buckets);
 	}
 	bucket_descs.clear();
@@ -593,6 +1101,7 @@ void TX::rollback(){
 	if(read_only)
 		return;
 	free_list.clear();
+	verified_pages.clear();
 	meta_page_dirty = false;
 	my_db.finish_transaction(this);
 	unlink_buckets_and_cursors();
@@ -624,9 +1133,9 @@ std::vector<Val> TX::get_bucket_names(){
 //			return false;
 //		return true;
 //	}
-Bucket TX::get_bucket(const Val & name, bool create_if_not_exists){
+Bucket TX::get_bucket(const Val & name, bool create_if_not_exists, const BucketOptions & options){
 	Val persistent_name;
-	BucketDesc * bucket_desc = load_bucket_desc(name, &persistent_name, create_if_not_exists);
+	BucketDesc * bucket_desc = load_bucket_desc(name, &persistent_name, create_if_not_exists, options);
 	ass(!DEBUG_MIRROR || (debug_mirror.count(name.to_string()) != 0) == (bucket_desc != 0), "mirror violation in get_bucket");
 	return Bucket(this, bucket_desc, persistent_name);
 }
@@ -643,26 +1152,15 @@ bool TX::drop_bucket(const Val & name){
 	if( !bucket_desc ){
 		return false;
 	}
-	{
-		// TODO - delete page by page
-		Cursor cursor(this, bucket_desc, persistent_name);
-		cursor.first();
-		while(bucket_desc->count != 0){
-			cursor.del();
-		}
-		ass(bucket_desc->leaf_page_count == 1 && bucket_desc->node_page_count == 0 && bucket_desc->overflow_page_count == 0 && bucket_desc->height == 0, "Bucket in wrong state after deleting all keys");
-		const DataPage * dap = readable_page(bucket_desc->root_page, 1);
-		mark_free_in_future_page(bucket_desc->root_page, 1, dap->tid());
-	}
-	for(IntrusiveNode<Cursor> * cit = &my_cursors; !cit->is_end();){
-		Cursor * c = cit->get_current();
-		if( c->bucket_desc == bucket_desc ){
-			c->my_txn = nullptr;
-			c->bucket_desc = nullptr;
-			cit->unlink(&Cursor::tx_cursors);
-		}else
-			cit = cit->get_next(&Cursor::tx_cursors);
+	add_dropped_tree(bucket_desc); // pages are freed by later commits
+	for(IntrusiveNode<Cursor> & cursors = bucket_cursors(bucket_desc); !cursors.is_end();){
+		Cursor * c = cursors.get_current();
+		c->my_txn = nullptr;
+		c->bucket_desc = nullptr;
+		c->cursor_slot = nullptr;
+		c->tx_cursors.unlink(&Cursor::tx_cursors);
 	}
+	my_cursors.erase(bucket_desc);
 	if(DEBUG_MIRROR)
 		ass(debug_mirror.erase(name.to_string()) != 0, "inconsistency with mirror in drop_bucket");
 	for(IntrusiveNode<Bucket> * cit = &my_buckets; !cit->is_end();){
@@ -670,7 +1168,8 @@ bool TX::drop_bucket(const Val & name){
 		if( c->bucket_desc == bucket_desc ){
 			c->my_txn = nullptr;
 			c->bucket_desc = nullptr;
-			cit->unlink(&Bucket::tx_buckets);
+			c->cursor_slot = nullptr;
+			c->tx_buckets.unlink(&Bucket::tx_buckets);
 		}else
 			cit = cit->get_next(&Bucket::tx_buckets);
 	}
@@ -680,7 +1179,35 @@ bool TX::drop_bucket(const Val & name){
 	ass(bucket_descs.erase(name.to_string()) == 1, "bucket_desc not found during erase");
 	return true;
 }
-BucketDesc * TX::load_bucket_desc(const Val & name, Val * persistent_name, bool create_if_not_exists){
+bool TX::truncate_bucket(const Val & name){
+	if( read_only )
+		throw Exception("Attempt to modify read-only transaction");
+	Val persistent_name;
+	BucketDesc * bucket_desc = load_bucket_desc(name, &persistent_name, false);
+	if(DEBUG_MIRROR){
+		ass(debug_mirror.count(name.to_string()) == (bucket_desc != 0), "mirror violation in truncate_bucket");
+		before_mirror_operation(bucket_desc, persistent_name);
+	}
+	if( !bucket_desc ){
+		return false;
+	}
+	add_dropped_tree(bucket_desc); // pages are freed by later commits
+	for(IntrusiveNode<Cursor> * cit = &bucket_cursors(bucket_desc); !cit->is_end(); cit = cit->get_next(&Cursor::tx_cursors))
+		cit->get_current()->before_first();
+	if(DEBUG_MIRROR)
+		debug_mirror.at(name.to_string()).clear();
+	bucket_desc->root_page = get_free_page(1);
+	LeafPtr wr_root = writable_leaf(bucket_desc, bucket_desc->root_page);
+	wr_root.init_dirty(meta_page.tid);
+	bucket_desc->height = 0;
+	bucket_desc->count = 0;
+	bucket_desc->leaf_page_count = 1;
+	bucket_desc->node_page_count = 0;
+	bucket_desc->overflow_page_count = 0;
+	meta_page_dirty = true;
+	return true;
+}
+BucketDesc * TX::load_bucket_desc(const Val & name, Val * persistent_name, bool create_if_not_exists, const BucketOptions & options){
 	const std::string str_name = name.to_string();
 	auto tit = bucket_descs.find(str_name);
 	if( tit != bucket_descs.end() ){
@@ -700,14 +1227,37 @@ BucketDesc * TX::load_bucket_desc(const Val & name, Val * persistent_name, bool
 		return nullptr;
 	if( read_only )
 		throw Exception("Attempt to modify read-only transaction");
+	if( options.key_head_size != 0 && options.key_head_size != 4 && options.key_head_size != 8 )
+		throw Exception("key_head_size must be 0, 4 or 8");
+	if( options.comparator > Comparator::INT64 )
+		throw Exception("Unknown comparator");
+	if( options.key_head_size != 0 && options.comparator != Comparator::BYTEWISE )
+		throw Exception("key_head_size can be used only with BYTEWISE comparator"); // heads are compared as big-endian numbers
+	if( options.dupsort && (options.comparator != Comparator::BYTEWISE || options.key_size != 0) )
+		throw Exception("dupsort can be used only with BYTEWISE comparator and without fixed key_size"); // pairs are stored as escaped keys
+	if( options.key_size != 0 ){ // items must never overflow and at least 2 must fit into leaf
+		if( options.key_head_size != 0 )
+			throw Exception("key_head_size cannot be used with fixed key_size");
+		if( options.key_size > max_key_size(page_layout_size) || (options.key_size + options.value_size)*MIN_KEY_COUNT > leaf_capacity(page_layout_size) )
+			throw Exception("key_size or value_size too big for fixed bucket");
+	}
+	if( options.fill_percent < 50 || options.fill_percent > 100 || options.merge_percent < 1 || options.merge_percent > 50 )
+		throw Exception("fill_percent must be 50..100 and merge_percent 1..50"); // merge above half would undo splits
 	if(DEBUG_MIRROR){
 		ass(debug_mirror.insert(std::make_pair(name.to_string(), BucketMirror{})).second, "mirror violation in load_bucket");
 		before_mirror_operation(meta_bucket.bucket_desc, meta_bucket.persistent_name);
 	}
 	tit = bucket_descs.insert(std::make_pair(str_name, BucketDesc{})).first;
 	*persistent_name = Val(tit->first);
+	tit->second.key_head_size = static_cast<uint8_t>(options.key_head_size);
+	tit->second.key_size = static_cast<uint16_t>(options.key_size);
+	tit->second.value_size = static_cast<uint16_t>(options.key_size != 0 ? options.value_size : 0);
+	tit->second.comparator = static_cast<uint8_t>(options.comparator);
+	tit->second.dupsort = options.dupsort ? 1 : 0;
+	tit->second.fill_percent = static_cast<uint8_t>(options.fill_percent);
+	tit->second.merge_percent = static_cast<uint8_t>(options.merge_percent);
 	tit->second.root_page = get_free_page(1);
-	LeafPtr wr_root = writable_leaf(tit->second.root_page);
+	LeafPtr wr_root = writable_leaf(&tit->second, tit->second.root_page);
 	wr_root.init_dirty(meta_page.tid);
 	tit->second.leaf_page_count = 1;
 	char buf[sizeof(BucketDesc)];
@@ -720,86 +1270,184 @@ Bucket TX::get_meta_bucket(){
 	return Bucket(this, &meta_page.meta_bucket);
 }
 
-void TX::check_bucket(BucketDesc * bucket_desc, MergablePageCache * pages){
-	Pid pa = bucket_desc->root_page;
-	size_t height = bucket_desc->height;
-	BucketDesc stat_bucket_desc{};
-	std::string largest_element(my_db.max_key_size(), char(0xFF));
-	check_bucket_page(bucket_desc, &stat_bucket_desc, pa, height, Val(), Val(largest_element), pages);
-	ass(stat_bucket_desc.count == bucket_desc->count && stat_bucket_desc.leaf_page_count == bucket_desc->leaf_page_count &&
-		stat_bucket_desc.node_page_count == bucket_desc->node_page_count && stat_bucket_desc.overflow_page_count == bucket_desc->overflow_page_count, "Bucket stats differ");
-}
-void TX::check_bucket_page(const BucketDesc * bucket_desc, BucketDesc * stat_bucket_desc, Pid pa, size_t height, Val left_limit, Val right_limit, MergablePageCache * pages){
-	pages->add_to_cache(pa, 1);
+void TX::check_bucket(const BucketDesc * bucket_desc, size_t min_tasks, BucketDesc * stat_bucket_desc, PageBitmap * pages, std::vector<CheckTask> * tasks){
+	std::vector<CheckTask> level{CheckTask{bucket_desc, bucket_desc->root_page, bucket_desc->height, Val(), Val()}}; // no limits at root
+	while( level.size() < min_tasks && level.front().height != 0 ){
+		std::vector<CheckTask> next_level;
+		for(auto && task : level)
+			check_bucket_page(bucket_desc, stat_bucket_desc, task.pa, task.height, task.left_limit, task.right_limit, pages, &next_level);
+		level.swap(next_level);
+	}
+	tasks->insert(tasks->end(), level.begin(), level.end());
+}
+void TX::check_bucket_page(const BucketDesc * bucket_desc, BucketDesc * stat_bucket_desc, Pid pa, size_t height, Val left_limit, Val right_limit, PageBitmap * pages, std::vector<CheckTask> * tasks){
+	pages->add(pa, 1);
+	ass(is_page_checksum_valid(pa), "page checksum mismatch");
+	const Comparator comparator = static_cast<Comparator>(bucket_desc->comparator); // Val() limits are unbounded
 	if( height == 0 ){
 		stat_bucket_desc->leaf_page_count += 1;
-		CLeafPtr dap = readable_leaf(pa);
+		CLeafPtr dap = readable_leaf(bucket_desc, pa);
 		ass(bucket_desc->height == 0 || dap.size() > 0, "leaf with 0 keys found");
 		stat_bucket_desc->count += static_cast<size_t>(dap.size());
 		Val prev_key;
+		std::string key_buf, prev_key_buf;
 		for(int pi = 0; pi != dap.size(); ++pi){
 			Pid overflow_page = 0;
-			ValVal val = dap.get_kv(pi, overflow_page);
+			ValVal val = dap.get_kv(pi, overflow_page, key_buf);
 			if( overflow_page != 0 ){
-				Pid overflow_count = (val.value.size + page_size - 1) / page_size;
+				Pid overflow_count = get_overflow_count(val.value.size);
 				stat_bucket_desc->overflow_page_count += overflow_count;
-				pages->add_to_cache(overflow_page, overflow_count);
+				pages->add(overflow_page, overflow_count);
+				ass(is_overflow_checksum_valid(dap, pi), "overflow checksum mismatch");
+			}
+			if( bucket_desc->dupsort != 0 && !val.value.empty() ){ // shared item of long values
+				ass(val.key.size == max_key_size(page_layout_size, bucket_desc->key_head_size), "dupsort shared item with wrong key size");
+				if( overflow_page != 0 )
+					val.value.data = readable_overflow(overflow_page, get_overflow_count(val.value.size));
+				ass(are_dup_tails_sorted(val.value), "dupsort shared item with wrong tails");
 			}
 			if( pi == 0)
-				ass(val.key >= left_limit, "first leaf element < left_limit");
+				ass(!left_limit.data || compare_keys(comparator, val.key, left_limit) >= 0, "first leaf element < left_limit");
 			else
-				ass(val.key > prev_key, "leaf elements are in wrong order");
-			prev_key = val.key;
+				ass(compare_keys(comparator, val.key, prev_key) > 0, "leaf elements are in wrong order");
+			prev_key_buf.assign(val.key.data, val.key.size);
+			prev_key = Val(prev_key_buf);
 		}
-		ass(stat_bucket_desc->count == bucket_desc->count || prev_key < right_limit, "last leaf element >= right_limit");
-		// last element is the only one allowed to be equal to largest possible key
+		ass(!right_limit.data || dap.size() == 0 || compare_keys(comparator, prev_key, right_limit) < 0, "last leaf element >= right_limit");
 		return;
 	}
 	stat_bucket_desc->node_page_count += 1;
-	CNodePtr nap = readable_node(pa);
+	CNodePtr nap = readable_node(bucket_desc, pa);
 	ass(nap.size() > 0, "node with 0 keys found");
 	for(int pi = -1; pi != nap.size(); ++pi){
 		Val prev_limit = (pi == -1) ? left_limit : nap.get_key(pi);
 		Val next_limit = (pi + 1 < nap.size()) ? nap.get_key(pi + 1) : right_limit;
-		ass(prev_limit < next_limit, "node with wrong keys order found");
-		check_bucket_page(bucket_desc, stat_bucket_desc, nap.get_value(pi), height - 1, prev_limit, next_limit, pages);
+		ass(!prev_limit.data || !next_limit.data || compare_keys(comparator, prev_limit, next_limit) < 0, "node with wrong keys order found");
+		if( tasks )
+			tasks->push_back(CheckTask{bucket_desc, nap.get_value(pi), height - 1, prev_limit, next_limit});
+		else
+			check_bucket_page(bucket_desc, stat_bucket_desc, nap.get_value(pi), height - 1, prev_limit, next_limit, pages);
 	}
 }
-void TX::check_database(std::function<void(int percent)> on_progress, bool verbose){
-	MergablePageCache pages(false);
-	free_list.get_all_free_pages(this, &pages);
-	if (verbose) {
-		std::cerr << "Free Pages" << std::endl;
-		pages.debug_print_db();
+void TX::run_check_tasks(std::vector<CheckTask> & tasks, size_t thread_count, PageBitmap * pages, std::function<void(int percent)> on_progress){
+	// Each thread has own bitmap, bitmaps are merged at the end, so pages used by 2 threads are also found
+	thread_count = std::min(thread_count, tasks.size());
+	std::vector<PageBitmap> thread_pages(thread_count, PageBitmap(pages->get_page_count()));
+	std::vector<std::exception_ptr> errors(thread_count);
+	std::mutex mutex;
+	std::condition_variable progress_cv;
+	size_t next_task = 0;
+	size_t done_tasks = 0;
+	size_t finished_threads = 0;
+	bool failed = false;
+	auto worker = [&](size_t ti){
+		try {
+			while( true ){
+				size_t task_index = 0;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if( failed || next_task == tasks.size() )
+						break;
+					task_index = next_task++;
+				}
+				CheckTask & task = tasks.at(task_index);
+				check_bucket_page(task.bucket_desc, &task.stat, task.pa, task.height, task.left_limit, task.right_limit, &thread_pages.at(ti));
+				std::lock_guard<std::mutex> lock(mutex);
+				done_tasks += 1;
+				progress_cv.notify_one();
+			}
+		}catch(...){
+			errors.at(ti) = std::current_exception();
+			std::lock_guard<std::mutex> lock(mutex);
+			failed = true;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		finished_threads += 1;
+		progress_cv.notify_one();
+	};
+	std::vector<std::thread> threads;
+	for(size_t ti = 0; ti != thread_count; ++ti)
+		threads.emplace_back(worker, ti);
+	int reported_percent = -1; // on_progress is called only from our thread
+	std::unique_lock<std::mutex> lock(mutex);
+	while( finished_threads != thread_count ){
+		const int percent = static_cast<int>(done_tasks * 100 / tasks.size());
+		if( on_progress && percent != reported_percent ){
+			reported_percent = percent;
+			lock.unlock();
+			on_progress(percent);
+			lock.lock();
+			continue;
+		}
+		progress_cv.wait(lock);
 	}
-
-	MergablePageCache meta_pages(false);
-	Bucket meta_bucket = get_meta_bucket();
-	check_bucket(meta_bucket.bucket_desc, &meta_pages);
-
-	if (verbose) {
-        std::cerr << "Meta pages " << std::endl;
-        meta_pages.debug_print_db();
+	lock.unlock();
+	for(auto && th : threads)
+		th.join();
+	for(auto && err : errors)
+		if( err )
+			std::rethrow_exception(err);
+	for(auto && tp : thread_pages)
+		pages->merge_from(tp);
+}
+void TX::check_dropped_trees(MergablePageCache * pages){
+	const Val prefix(&dropped_prefix, 1);
+	Cursor cur(this, &meta_page.meta_bucket, Val{});
+	Val c_key, c_value;
+	for(cur.seek(prefix); cur.get(&c_key, &c_value) && c_key.has_prefix(prefix); cur.next()){
+		BucketDesc tree_desc{};
+		std::vector<int> resume = unpack_dropped_tree(c_value, &tree_desc);
+		size_t page_budget = std::numeric_limits<size_t>::max();
+		ass(walk_dropped_tree(&tree_desc, resume, tree_desc.root_page, tree_desc.height, &page_budget, pages), "Dropped tree walk stopped");
+		ass(tree_desc.leaf_page_count == 0 && tree_desc.node_page_count == 0 && tree_desc.overflow_page_count == 0, "Dropped tree stats differ");
 	}
-	pages.merge_from(meta_pages);
-	
-	for(auto bname : get_bucket_names()){
-		MergablePageCache busy_pages(false);
-		Bucket bucket = get_bucket(bname);
-		check_bucket(bucket.bucket_desc, &busy_pages);
+}
+void TX::check_database(std::function<void(int percent)> on_progress, bool verbose){
+	PageBitmap pages(meta_page.page_count);
+	{
+		MergablePageCache free_pages(false);
+		free_list.get_all_free_pages(this, &free_pages);
 		if (verbose) {
-            std::cerr << "Pages from " << bname.to_string() << std::endl;
-            busy_pages.debug_print_db();
+			std::cerr << "Free Pages" << std::endl;
+			free_pages.debug_print_db();
 		}
-		pages.merge_from(busy_pages);
+		check_dropped_trees(&free_pages);
+		pages.add_from(free_pages);
+	}
+	// Upper levels of buckets are checked here, subtrees below them by threads
+	const size_t thread_count = my_db.options.check_threads != 0 ? my_db.options.check_threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+	std::vector<CheckTask> tasks;
+	std::map<const BucketDesc *, BucketDesc> stats;
+	check_bucket(&meta_page.meta_bucket, 4 * thread_count, &stats[&meta_page.meta_bucket], &pages, &tasks);
+	std::vector<Bucket> buckets;
+	for(auto bname : get_bucket_names()){
+		buckets.push_back(get_bucket(bname));
+		check_bucket(buckets.back().bucket_desc, 4 * thread_count, &stats[buckets.back().bucket_desc], &pages, &tasks);
+	}
+	std::stable_sort(tasks.begin(), tasks.end(), [](const CheckTask & a, const CheckTask & b){ return a.height > b.height; }); // big subtrees first
+	run_check_tasks(tasks, thread_count, &pages, on_progress);
+	for(auto && task : tasks){
+		BucketDesc & stat = stats[task.bucket_desc];
+		stat.count += task.stat.count;
+		stat.leaf_page_count += task.stat.leaf_page_count;
+		stat.node_page_count += task.stat.node_page_count;
+		stat.overflow_page_count += task.stat.overflow_page_count;
+	}
+	for(auto && st : stats){
+		const BucketDesc * bucket_desc = st.first;
+		const BucketDesc & stat = st.second;
+		if (verbose)
+			std::cerr << "Bucket root=" << bucket_desc->root_page << " leafs=" << stat.leaf_page_count << " nodes=" << stat.node_page_count << " overflows=" << stat.overflow_page_count << std::endl;
+		ass(stat.count == bucket_desc->count && stat.leaf_page_count == bucket_desc->leaf_page_count &&
+			stat.node_page_count == bucket_desc->node_page_count && stat.overflow_page_count == bucket_desc->overflow_page_count, "Bucket stats differ");
 	}
 	if (verbose) {
         std::cerr << "All pages " << std::endl;
         pages.debug_print_db();
 	}
-	Pid remaining_pages = meta_page.page_count - pages.defrag_end(meta_page.page_count);
-	ass(pages.empty(), "After defrag free pages left");
-	ass(remaining_pages == META_PAGES_COUNT, "There should be exactly meta pages count left after removing everything from database");
+	for(Pid pa = 0; pa != META_PAGES_COUNT; ++pa)
+		ass(!pages.contains(pa), "meta page is used by bucket or free list");
+	ass(pages.get_size() + META_PAGES_COUNT == meta_page.page_count, "There should be exactly meta pages count left after removing everything from database");
 }
 
 static std::string trim_key(const Val & key, bool parse_meta){
@@ -818,20 +1466,22 @@ static std::string trim_key(const Val & key, bool parse_meta){
 std::string TX::print_db(const BucketDesc * bucket_desc){
 	Pid pa = bucket_desc->root_page;
 	size_t height = bucket_desc->height;
-	return print_db(pa, height, bucket_desc == &meta_page.meta_bucket);
+	return print_db(bucket_desc, pa, height);
 }
-std::string TX::print_db(Pid pid, size_t height, bool parse_meta){
+std::string TX::print_db(const BucketDesc * bucket_desc, Pid pid, size_t height){
+	const bool parse_meta = bucket_desc == &meta_page.meta_bucket;
 	std::string result = "{\"keys\":[";
 	if( height == 0 ){
-		CLeafPtr dap = readable_leaf(pid);
+		CLeafPtr dap = readable_leaf(bucket_desc, pid);
 		std::cerr << "Leaf pid=" << pid << " [";
+		std::string key_buf;
 		for(int i = 0; i != dap.size(); ++i){
 			if( i != 0)
 				result += ",";
 			Pid overflow_page;
-			auto kv = dap.get_kv(i, overflow_page);
+			auto kv = dap.get_kv(i, overflow_page, key_buf);
 			if( overflow_page ){
-				Pid overflow_count = (kv.value.size + page_size - 1)/page_size;
+				Pid overflow_count = get_overflow_count(kv.value.size);
 				kv.value.data = readable_overflow(overflow_page, overflow_count);
 			}
 			//                std::cerr << kv.key.to_string() << ":" << kv.value.to_string() << ", ";
@@ -841,7 +1491,7 @@ std::string TX::print_db(Pid pid, size_t height, bool parse_meta){
 		std::cerr << "]" << std::endl;
 		return result + "]}";
 	}
-	CNodePtr nap = readable_node(pid);
+	CNodePtr nap = readable_node(bucket_desc, pid);
 	Pid spec_value = nap.get_value(-1);
 	std::cerr << "Node pid=" << pid << " [" << spec_value << ", ";
 	for(int i = 0; i != nap.size(); ++i){
@@ -859,11 +1509,11 @@ std::string TX::print_db(Pid pid, size_t height, bool parse_meta){
 		result += "\"" + std::to_string(spec_value) + "\"";
 	result += "],\"children\":[";
 	std::cerr << "]" << std::endl;
-	std::string spec_str = print_db(spec_value, height - 1, parse_meta);
+	std::string spec_str = print_db(bucket_desc, spec_value, height - 1);
 	result += spec_str;
 	for(int i = 0; i != nap.size(); ++i){
 		ValPid va = nap.get_kv(i);
-		std::string str = print_db(va.pid, height - 1, parse_meta);
+		std::string str = print_db(bucket_desc, va.pid, height - 1);
 		result += "," + str;
 	}
 	return result + "]}";
@@ -892,10 +1542,11 @@ void TX::load_mirror(){
 		mustela::Bucket bucket = get_bucket(bn);
 		mustela::Cursor cur = bucket.get_cursor();
 		mustela::Val c_key, c_value;
-		for (cur.first(); cur.get(&c_key, &c_value); cur.next())
+		for (cur.first(); cur.get_stored(&c_key, &c_value); cur.next_stored())
 			ass(part.insert(std::make_pair(c_key.to_string(), std::make_pair(c_value.to_string(), cur))).second, "BAD mirror insert");
 		BucketMirror part2_back;
-		for (cur.last(); cur.get(&c_key, &c_value); cur.prev())
+		cur.end(); // by items, last() would enter shared item of dupsort values
+		for (cur.prev_stored(); cur.get_stored(&c_key, &c_value); cur.prev_stored())
 			ass(part2_back.insert(std::make_pair(c_key.to_string(), std::make_pair(c_value.to_string(), cur))).second, "BAD mirror insert");
 		ass(part == part2_back, "Inconsistent forward/backward iteration");
 	}
@@ -904,10 +1555,11 @@ void TX::check_mirror(){
 	for(auto && part : debug_mirror){
 		mustela::Bucket bucket = get_bucket(Val(part.first), false);
 		for(auto && ma : part.second){
-			mustela::Val value, c_key, c_value;
-			bool result = bucket.get(mustela::Val(ma.first), &value);
+			mustela::Val key, value, c_key, c_value;
+			mustela::Cursor main_cursor = bucket.get_cursor(); // mirror keeps items as stored, also for dupsort
+			bool result = main_cursor.seek_stored(mustela::Val(ma.first)) && main_cursor.get_stored(&key, &value);
 			ma.second.second.debug_check_cursor_path_up();
-			bool c_result = ma.second.second.get(&c_key, &c_value);
+			bool c_result = ma.second.second.get_stored(&c_key, &c_value);
 			if( !result || !c_result || c_key.to_string() != ma.first || value.to_string() != ma.second.first || c_value.to_string() != ma.second.first ){
 				std::string json = bucket.debug_print_db();
 				std::cerr << "Main table: " << json << std::endl;
@@ -2,7 +2,9 @@
 
 #include <string>
 #include <map>
+#include <unordered_set>
 #include <functional>
+#include <mutex>
 #include "pages.hpp"
 #include "lock.hpp"
 #include "free_list.hpp"
@@ -16,9 +18,20 @@ namespace mustela {
 		~TX();
 		Tid tid()const{ return meta_page.tid; }
 		std::string get_meta_stats();
+		// Advice is set on shared mapping of this transaction (other transactions on it get it too). If other transaction
+		// already set different advice on that mapping, reads go through private mapping. DBOptions::access_advice restores default
+		void set_access_advice(AccessAdvice advice);
 
-		Bucket get_bucket(const Val & name, bool create_if_not_exists = true);
+		Bucket get_bucket(const Val & name, bool create_if_not_exists = true, const BucketOptions & options = BucketOptions{}); // options are used only when creating
 		bool drop_bucket(const Val & name); // true if dropped, false if did not exist
+		bool truncate_bucket(const Val & name); // true if emptied, false if did not exist. Options are kept
+		// Pages of dropped and truncated buckets are freed later, at most DBOptions::dropped_pages_per_commit by each commit
+		bool free_dropped_pages(size_t page_budget); // true if all dropped pages are freed
+		Pid get_dropped_page_count(); // not yet freed
+		// Moves at most page_budget live pages from the end of file into lower free pages, returns number of moved pages.
+		// Old places are freed as usual, file is shrunk by commits after no reader can see them (DBOptions::shrink_file_on_commit)
+		// Cursors are fixed up, ReadIterators of r/w transaction become invalid
+		size_t relocate_tail(size_t page_budget);
 		std::vector<Val> get_bucket_names(); // sorted
 
 		// both rollback and commit of read-only transaction are nops
@@ -36,21 +49,33 @@ namespace mustela {
 			free_list.debug_print_db();
 		}
 		int debug_get_mirror_counter()const { return debug_mirror_counter; }
+		void debug_forget_verified_pages(){ verified_pages.clear(); } // next reads verify checksums again, for corruption tests
 		Tid debug_get_oldest_reader_tid()const { return oldest_reader_tid; }
 	private:
 		friend class Cursor;
+		friend class ReadIterator;
 		friend class FreeList;
 		friend class Bucket;
 		friend class DB;
+		friend class BulkImporter;
+		friend class IncrementalChecker;
 
 		DB & my_db;
 		// For readers & writers
-		IntrusiveNode<Cursor> my_cursors;
+		// Cursor slot per bucket, fix-ups do not visit cursors of other buckets. Looked up when Bucket is made,
+		// Bucket and Cursor keep pointer to slot (map nodes stay in place)
+		std::map<const BucketDesc *, IntrusiveNode<Cursor>> my_cursors;
+		IntrusiveNode<Cursor> & bucket_cursors(const BucketDesc * bucket_desc){ return my_cursors[bucket_desc]; }
 		IntrusiveNode<Bucket> my_buckets;
 
 		const char * c_file_ptr = nullptr;
+		uint64_t serial = 0; // unique in process, new when transaction starts or c_file_ptr moves to other mapping
 		Pid file_page_count = 0;
 		size_t used_mapping_size = 0; // r-tx uses 1 mapping, w-tx uses all mappings larger than this
+		AccessAdvice access_advice = AccessAdvice::NORMAL;
+		size_t advised_mapping_size = 0; // end_addr of shared mapping with our advice, 0 - none
+		char * own_mapping = nullptr; // set by set_access_advice, c_file_ptr points here
+		size_t own_mapping_size = 0;
 		MetaPage meta_page;
 
 		// For readers
@@ -63,7 +88,8 @@ namespace mustela {
 		FreeList free_list;
 
 		std::map<std::string, BucketDesc> bucket_descs;
-		BucketDesc * load_bucket_desc(const Val & name, Val * persistent_name, bool create_if_not_exists);
+		typedef std::map<std::string, std::pair<std::string, Cursor>> BucketMirror;
+		BucketDesc * load_bucket_desc(const Val & name, Val * persistent_name, bool create_if_not_exists, const BucketOptions & options = BucketOptions{});
 		Bucket get_meta_bucket();
 
 		Pid get_free_page(Pid contigous_count);
@@ -78,6 +104,20 @@ namespace mustela {
 		void new_merge_leaf(Cursor & cur, LeafPtr wr_dap);
 
 		void new_increase_height(Cursor & cur);
+		// Range delete. Child of node at cursor height is unlinked with the whole subtree, cursor is set to the next child
+		size_t find_erasable_subtree(Cursor & cur, Val before_key); // 0 if none, cursor must be at first item of subtree
+		bool is_subtree_before(const BucketDesc * bucket_desc, Pid pa, size_t height, Val key); // all keys are less than key
+		void new_erase_subtree(Cursor & cur, size_t height, BucketMirror * mirror);
+		void free_subtree(BucketDesc * bucket_desc, Pid pa, size_t height, BucketMirror * mirror); // pages, overflows and bucket stats
+		// Dropped trees are recorded in meta bucket with path of next children to free, pages are freed in post-order
+		void add_dropped_tree(BucketDesc * bucket_desc);
+		bool walk_dropped_tree(BucketDesc * tree_desc, std::vector<int> & resume, Pid pa, size_t height, size_t * page_budget, MergablePageCache * pages); // frees pages or adds them to pages, false if budget ended
+		std::vector<int> unpack_dropped_tree(Val value, BucketDesc * tree_desc);
+		// Tail relocation. Pages at or above threshold are moved if there is lower free page
+		bool relocate_page(Cursor & cur, size_t height); // false if there is no lower free page
+		bool relocate_overflows(Cursor & cur, Pid threshold, size_t * page_budget); // of leaf at cursor, false if budget ended
+		bool relocate_subtree(Cursor & cur, size_t height, Pid threshold, size_t * page_budget); // false if budget ended
+		std::string pack_dropped_tree(BucketDesc * tree_desc, const std::vector<int> & resume);
 		void new_insert2node(Cursor & cur, size_t height, ValPid insert_kv1, ValPid insert_kv2 = ValPid());
 		char * new_insert2leaf(Cursor & cur, Val insert_key, size_t insert_value_size, bool * overflow);
 
@@ -86,31 +126,60 @@ namespace mustela {
 			return (const DataPage *)(c_file_ptr + page * page_size);
 		}
 		DataPage * writable_page(Pid page, Pid count);
-		CLeafPtr readable_leaf(Pid pa){
-			return CLeafPtr(page_size, (const LeafPage *)readable_page(pa, 1));
+		// Page layout depends on bucket options
+		CLeafPtr readable_leaf(const BucketDesc * bucket_desc, Pid pa){
+			if( verify_on_read )
+				verify_page_checksum(pa);
+			return CLeafPtr(page_layout_size, (const LeafPage *)readable_page(pa, 1), bucket_desc->get_options());
 		}
-		LeafPtr writable_leaf(Pid pa);
-		CNodePtr readable_node(Pid pa){
-			return CNodePtr(page_size, (const NodePage *)readable_page(pa, 1));
+		LeafPtr writable_leaf(const BucketDesc * bucket_desc, Pid pa);
+		CNodePtr readable_node(const BucketDesc * bucket_desc, Pid pa){
+			if( verify_on_read )
+				verify_page_checksum(pa);
+			return CNodePtr(page_layout_size, (const NodePage *)readable_page(pa, 1), bucket_desc->get_options());
 		}
-		NodePtr writable_node(Pid pa);
+		NodePtr writable_node(const BucketDesc * bucket_desc, Pid pa);
 		const char * readable_overflow(Pid pa, Pid count){
 			return (const char *)readable_page(pa, count);
 		}
 		char * writable_overflow(Pid pa, Pid count);
+		Pid get_overflow_count(size_t value_size)const{ return (value_size + page_size - 1)/page_size; } // overflow pages use the whole page
+		void prefetch_pages(Pid page, Pid count)const; // madvise(MADV_WILLNEED), reads will not fault page by page
+		void scan_readahead(const BucketDesc * bucket_desc, Pid node_pid, int item); // cursor moved to leaf at item of node
+
+		std::unordered_set<Pid> verified_pages; // checksums are verified once per transaction
+		std::mutex verified_pages_mutex; // Bucket::scan_partitions reads from several threads
+		bool is_page_checksum_valid(Pid pa); // also true for pages written by our transaction
+		void verify_page_checksum(Pid pa);
+		bool is_overflow_checksum_valid(const CLeafPtr & dap, int item); // also true for items without overflow
+		void verify_overflow_checksum(const CLeafPtr & dap, int item);
+		void write_page_checksums(const BucketDesc * bucket_desc, Pid pa, size_t height); // dirty pages of subtree
 
 		std::string print_db(const BucketDesc * bucket_desc);
-		std::string print_db(Pid pa, size_t height, bool parse_meta);
-
-	 	void check_bucket(BucketDesc * bucket_desc, MergablePageCache * pages);
-	 	void check_bucket_page(const BucketDesc * bucket_desc, BucketDesc * stat_bucket_desc, Pid pa, size_t height, Val left_limit, Val right_limit, MergablePageCache * pages);
+		std::string print_db(const BucketDesc * bucket_desc, Pid pa, size_t height);
+
+		struct CheckTask { // subtree checked by one of check_database threads
+			const BucketDesc * bucket_desc;
+			Pid pa;
+			size_t height;
+			Val left_limit; // keys of node pages, valid until transaction ends
+			Val right_limit;
+			BucketDesc stat{};
+		};
+		// Checks upper levels until there are at least min_tasks subtrees, subtrees are added to tasks
+	 	void check_bucket(const BucketDesc * bucket_desc, size_t min_tasks, BucketDesc * stat_bucket_desc, PageBitmap * pages, std::vector<CheckTask> * tasks);
+	 	void check_dropped_trees(MergablePageCache * pages);
+	 	// If tasks is not null, children of node are added there instead of being checked
+	 	void check_bucket_page(const BucketDesc * bucket_desc, BucketDesc * stat_bucket_desc, Pid pa, size_t height, Val left_limit, Val right_limit, PageBitmap * pages, std::vector<CheckTask> * tasks = nullptr);
+	 	void run_check_tasks(std::vector<CheckTask> & tasks, size_t thread_count, PageBitmap * pages, std::function<void(int percent)> on_progress);
 
 		void unlink_buckets_and_cursors();
 
 		const bool read_only;
 		const size_t page_size; // copy from my_db
+		const size_t page_layout_size; // leaf and node pages use page_size without checksum
+		const bool verify_on_read;
 
-		typedef std::map<std::string, std::pair<std::string, Cursor>> BucketMirror;
 		std::map<std::string, BucketMirror> debug_mirror; // model of our DB
 		static int debug_mirror_counter;
 		void before_mirror_operation(BucketDesc * bucket_desc, Val name);
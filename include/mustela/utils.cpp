@@ -98,17 +98,182 @@ namespace mustela {
 // CRC-32 (Ethernet, ZIP, etc.) polynomial in reversed bit order.
 // #define POLY 0xedb88320
 
+	struct Crc32cTable {
+		uint32_t table[256];
+		Crc32cTable(){
+			for(uint32_t n = 0; n != 256; ++n){
+				uint32_t crc = n;
+				for (int k = 0; k < 8; k++)
+					crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+				table[n] = crc;
+			}
+		}
+	};
+	static uint32_t crc32c_table(uint32_t crc, const unsigned char *buf, size_t len){
+		static const Crc32cTable t;
+		while (len--)
+			crc = t.table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+#if defined(__x86_64__) && defined(__GNUC__)
+	// Compiled for SSE4.2 regardless of build flags, selected at runtime
+	__attribute__((target("sse4.2")))
+	static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf, size_t len){
+		uint64_t crc64 = crc;
+		for(; len >= sizeof(uint64_t); len -= sizeof(uint64_t), buf += sizeof(uint64_t)){
+			uint64_t word;
+			memcpy(&word, buf, sizeof(word));
+			crc64 = __builtin_ia32_crc32di(crc64, word);
+		}
+		crc = static_cast<uint32_t>(crc64);
+		for(; len != 0; --len)
+			crc = __builtin_ia32_crc32qi(crc, *buf++);
+		return crc;
+	}
+	static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
 	uint32_t crc32c(uint32_t crc, const unsigned char *buf, size_t len)
 	{
-		int k;
+#if defined(__x86_64__) && defined(__GNUC__)
+		if( has_sse42 )
+			return ~crc32c_sse42(~crc, buf, len);
+#endif
+		return ~crc32c_table(~crc, buf, len);
+	}
+
+	Val encode_dup_key(Val key, std::string & buf){
+		buf.clear();
+		for(size_t i = 0; i != key.size; ++i){
+			buf.push_back(key.data[i]);
+			if( key.data[i] == 0 )
+				buf.push_back(char(0xFF));
+		}
+		buf.push_back(0);
+		buf.push_back(0);
+		return Val(buf);
+	}
+	Val encode_dup(Val key, Val value, std::string & buf){
+		encode_dup_key(key, buf);
+		buf.append(value.data, value.size);
+		return Val(buf);
+	}
+	bool decode_dup(Val stored, Val * key, Val * value, std::string & key_buf){
+		const char * zero = static_cast<const char *>(memchr(stored.data, 0, stored.size));
+		bool escaped = false;
+		while( zero && zero + 1 != stored.end() && zero[1] != 0 ){
+			escaped = true;
+			zero = static_cast<const char *>(memchr(zero + 2, 0, stored.end() - zero - 2));
+		}
+		if( !zero || zero + 1 == stored.end() )
+			return false;
+		*value = Val(zero + 2, stored.end() - zero - 2);
+		if( !escaped ){ // common case, key is not copied
+			*key = Val(stored.data, zero - stored.data);
+			return true;
+		}
+		key_buf.clear();
+		for(const char * p = stored.data; p != zero; ++p){
+			key_buf.push_back(*p);
+			if( *p == 0 )
+				++p; // skip 0xFF
+		}
+		*key = Val(key_buf);
+		return true;
+	}
 
-		crc = ~crc;
-		while (len--) {
-			crc ^= *buf++;
-			for (k = 0; k < 8; k++)
-				crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+	bool encode_dup_item(Val key, Val value, size_t max_size, std::string & buf, Val * stored_key, Val * tail){
+		encode_dup(key, value, buf);
+		const size_t key_size = buf.size() - value.size;
+		if( key_size > max_size || buf.size() < max_size ){ // too long key is rejected by size check of caller
+			*stored_key = Val(buf);
+			*tail = Val();
+			return false;
+		}
+		*stored_key = Val(buf.data(), max_size);
+		*tail = Val(value.data + (max_size - key_size), buf.size() - max_size);
+		return true;
+	}
+	size_t read_dup_tail(Val tails, size_t pos, Val * tail){
+		uint64_t size = 0;
+		pos += read_u64_sqlite4(size, tails.data + pos);
+		ass(pos + size <= tails.size, "Dupsort tail spills over item value");
+		*tail = Val(tails.data + pos, static_cast<size_t>(size));
+		return pos + static_cast<size_t>(size);
+	}
+	Val get_dup_tail(Val tails, size_t index){
+		Val tail;
+		size_t pos = 0;
+		for(size_t i = 0; i <= index; ++i){
+			ass(pos < tails.size, "Dupsort tail index out of range");
+			pos = read_dup_tail(tails, pos, &tail);
+		}
+		return tail;
+	}
+	size_t count_dup_tails(Val tails){
+		size_t result = 0;
+		Val tail;
+		for(size_t pos = 0; pos < tails.size; pos = read_dup_tail(tails, pos, &tail))
+			result += 1;
+		return result;
+	}
+	size_t find_dup_tail(Val tails, Val tail, bool * found){
+		size_t index = 0;
+		Val other;
+		for(size_t pos = 0; pos < tails.size; ++index){
+			pos = read_dup_tail(tails, pos, &other);
+			const int cmp = other.compare(tail);
+			if( cmp >= 0 ){
+				*found = cmp == 0;
+				return index;
+			}
+		}
+		*found = false;
+		return index;
+	}
+	static size_t dup_tail_offset(Val tails, size_t index){
+		Val tail;
+		size_t pos = 0;
+		for(size_t i = 0; i != index; ++i)
+			pos = read_dup_tail(tails, pos, &tail);
+		return pos;
+	}
+	void append_dup_tail(std::string & tails, Val tail){
+		unsigned char size_buf[9];
+		tails.append(reinterpret_cast<const char *>(size_buf), write_u64_sqlite4(tail.size, size_buf));
+		tails.append(tail.data, tail.size);
+	}
+	void insert_dup_tail(Val tails, size_t index, Val tail, std::string & buf){
+		const size_t pos = dup_tail_offset(tails, index);
+		buf.assign(tails.data, pos);
+		append_dup_tail(buf, tail);
+		buf.append(tails.data + pos, tails.size - pos);
+	}
+	void erase_dup_tail(Val tails, size_t index, std::string & buf){
+		const size_t pos = dup_tail_offset(tails, index);
+		Val tail;
+		const size_t next_pos = read_dup_tail(tails, pos, &tail);
+		buf.assign(tails.data, pos);
+		buf.append(tails.data + next_pos, tails.size - next_pos);
+	}
+	bool are_dup_tails_sorted(Val tails){
+		if( tails.size == 0 )
+			return false;
+		Val prev, tail;
+		for(size_t pos = 0; pos < tails.size; prev = tail){
+			const unsigned char a0 = static_cast<unsigned char>(tails.data[pos]); // size of size, as in read_u64_sqlite4
+			const size_t size_size = 1 + (a0 <= 240 ? 0 : a0 <= 248 ? 1 : a0 == 249 ? 2 : a0 - 250 + 3);
+			if( size_size > tails.size - pos )
+				return false;
+			uint64_t size = 0;
+			read_u64_sqlite4(size, tails.data + pos);
+			if( size > tails.size - pos - size_size )
+				return false;
+			tail = Val(tails.data + pos + size_size, static_cast<size_t>(size));
+			if( pos != 0 && prev.compare(tail) >= 0 )
+				return false;
+			pos += size_size + static_cast<size_t>(size);
 		}
-		return ~crc;
+		return true;
 	}
 
 //	size_t Val::encoded_size()const{
@@ -68,8 +68,11 @@ namespace mustela {
 	};
 	class Exception {
 	public:
-		explicit Exception(const std::string & what)
+		explicit Exception(const std::string & what):what_text(what)
 		{}
+		const std::string & what()const { return what_text; }
+	private:
+		std::string what_text;
 	};
 
 #define ass(expr, what) mustela::do_assert(expr, __FILE__, __LINE__, what)
@@ -140,6 +143,13 @@ namespace mustela {
 		bool has_prefix(const Val & prefix)const {
 			return size >= prefix.size && memcmp(data, prefix.data, prefix.size) == 0;
 		}
+		size_t common_prefix_size(const Val & other)const {
+			size_t min_size = size < other.size ? size : other.size;
+			size_t pos = 0;
+			while(pos != min_size && data[pos] == other.data[pos])
+				pos += 1;
+			return pos;
+		}
 		bool has_prefix(const Val & prefix, Val * tail)const {
 			if( !has_prefix(prefix) )
 				return false;
@@ -148,6 +158,68 @@ namespace mustela {
 		}
 	};
 	
+	// Key order of bucket, selected when creating bucket
+	// Integer keys are little-endian (native on x86), shorter keys are zero-extended, ties are broken bytewise
+	enum class Comparator : uint8_t { BYTEWISE = 0, REVERSE_BYTEWISE = 1, UINT64 = 2, INT64 = 3 };
+	// Searches are templated on these, so compares are inlined. Any struct with the same compare can be used
+	struct BytewiseCompare {
+		static int compare(const Val & a, const Val & b){ return a.compare(b); }
+	};
+	struct ReverseBytewiseCompare {
+		static int compare(const Val & a, const Val & b){ return b.compare(a); }
+	};
+	struct Uint64Compare {
+		static uint64_t load(const Val & v){
+			uint64_t result;
+			unpack_uint_le(v.data, v.size < sizeof(uint64_t) ? v.size : sizeof(uint64_t), result);
+			return result;
+		}
+		static int compare(const Val & a, const Val & b){
+			uint64_t av = load(a), bv = load(b);
+			if( av != bv )
+				return av < bv ? -1 : 1;
+			return a.compare(b);
+		}
+	};
+	struct Int64Compare {
+		static int compare(const Val & a, const Val & b){
+			int64_t av = static_cast<int64_t>(Uint64Compare::load(a));
+			int64_t bv = static_cast<int64_t>(Uint64Compare::load(b)); // shorter keys are never negative
+			if( av != bv )
+				return av < bv ? -1 : 1;
+			return a.compare(b);
+		}
+	};
+	// Slow path for checks and asserts
+	inline int compare_keys(Comparator comparator, const Val & a, const Val & b){
+		switch(comparator){
+		case Comparator::REVERSE_BYTEWISE: return ReverseBytewiseCompare::compare(a, b);
+		case Comparator::UINT64: return Uint64Compare::compare(a, b);
+		case Comparator::INT64: return Int64Compare::compare(a, b);
+		default: return BytewiseCompare::compare(a, b);
+		}
+	}
+	// Keys with common prefix are ordered as their tails, and key without prefix is ordered as prefix,
+	// so pages can store common prefix once and separators can be shortened
+	inline bool has_prefix_order(Comparator comparator){
+		return comparator == Comparator::BYTEWISE || comparator == Comparator::REVERSE_BYTEWISE;
+	}
+	// Dupsort buckets store key and value together as tree key. Zero bytes of key are escaped
+	// and key is terminated with two zeroes, so pairs are sorted by key, then by value
+	Val encode_dup_key(Val key, std::string & buf); // common prefix of all pairs with key
+	Val encode_dup(Val key, Val value, std::string & buf);
+	bool decode_dup(Val stored, Val * key, Val * value, std::string & key_buf); // false if stored is not a pair
+	// Pair not shorter than max_size is cut there. Pairs cut to the same stored key share one item, whose value
+	// is sorted list of value tails (compact size and bytes each, never empty), so their order is kept
+	bool encode_dup_item(Val key, Val value, size_t max_size, std::string & buf, Val * stored_key, Val * tail); // true if cut
+	size_t read_dup_tail(Val tails, size_t pos, Val * tail); // returns position of next tail
+	Val get_dup_tail(Val tails, size_t index);
+	size_t count_dup_tails(Val tails);
+	size_t find_dup_tail(Val tails, Val tail, bool * found); // index of first tail not less than tail
+	void insert_dup_tail(Val tails, size_t index, Val tail, std::string & buf); // new tails are in buf
+	void append_dup_tail(std::string & tails, Val tail); // tail must be greater than last one
+	void erase_dup_tail(Val tails, size_t index, std::string & buf);
+	bool are_dup_tails_sorted(Val tails); // also checks that sizes cover tails exactly
 	struct ValPid {
 		Val key;
 		Pid pid;